@@ -0,0 +1,120 @@
+#include "account_store.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <getopt.h>
+
+using namespace std;
+
+// Contention benchmark for AccountStore: worker threads hammer deposits and
+// withdrawals, or transfers, either on one hot account or spread over many
+// accounts, once with page locks and once with the lock-free CAS path.
+// Hot transfers alternate into and out of account 0.
+
+enum Workload { HOT, SPREAD, TRANSFER_HOT, TRANSFER_SPREAD, NUM_WORKLOADS };
+const char* WORKLOAD_NAMES[NUM_WORKLOADS] = {"hot", "spread", "xfer-hot", "xfer-spread"};
+
+void print_usage() {
+    cout << "Usage: ./account_bench [-n OPS] [-t MAX_THREADS] [-a ACCOUNTS]" << endl;
+    cout << "  -n, --ops          Operations per thread (default: 1000000)" << endl;
+    cout << "  -t, --threads      Highest thread count to measure (default: 8)" << endl;
+    cout << "  -a, --accounts     Accounts in the spread workload (default: 100000)" << endl;
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+// Runs ops_per_thread operations on each of threads threads; returns ops/s
+double run(AccountStore::Mode mode, size_t threads, size_t ops_per_thread, size_t accounts, Workload workload) {
+    AccountStore store(accounts, mode);
+    vector<thread> workers;
+    bool hot = workload == HOT || workload == TRANSFER_HOT;
+    bool transfers = workload == TRANSFER_HOT || workload == TRANSFER_SPREAD;
+
+    // Enough funds that no transfer is refused
+    if (transfers) {
+        for (size_t id = 0; id < accounts; id++) store.deposit(id, money_from_units(threads * ops_per_thread));
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&store, t, ops_per_thread, accounts, hot, transfers]() {
+            uint64_t x = 88172645463325252ULL + t; // xorshift: cheap per-thread ids
+            Money balance, other;
+            for (size_t i = 0; i < ops_per_thread; i++) {
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                if (transfers) {
+                    int a = (int)(x % accounts);
+                    int b = hot ? 0 : (int)((x >> 32) % accounts);
+                    if (a == b) a = (a + 1) % accounts;
+                    if (hot && i % 2 == 1) store.transfer(b, a, money_from_units(1), balance, other);
+                    else store.transfer(a, b, money_from_units(1), balance, other);
+                    continue;
+                }
+                int id = hot ? 0 : (int)(x % accounts);
+                if (i % 4 == 3) store.withdraw(id, money_from_units(1), balance);
+                else store.deposit(id, money_from_units(1));
+            }
+        });
+    }
+    for (thread& w : workers) w.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    return threads * ops_per_thread / seconds;
+}
+
+int main(int argc, char* argv[]) {
+    size_t ops = 1000000;
+    size_t max_threads = 8;
+    size_t accounts = 100000;
+
+    static struct option long_options[] = {
+        {"ops", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 't'},
+        {"accounts", required_argument, 0, 'a'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "n:t:a:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'n':
+                ops = strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                max_threads = strtoul(optarg, nullptr, 10);
+                break;
+            case 'a':
+                accounts = max(strtoul(optarg, nullptr, 10), 2UL); // transfers need two
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    cout << setw(8) << "threads" << setw(13) << "workload"
+         << setw(16) << "locked ops/s" << setw(18) << "lock-free ops/s" << endl;
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        for (int w = 0; w < NUM_WORKLOADS; w++) {
+            Workload workload = static_cast<Workload>(w);
+            double locked = run(AccountStore::LOCKED, threads, ops, accounts, workload);
+            double lock_free = run(AccountStore::LOCK_FREE, threads, ops, accounts, workload);
+            cout << setw(8) << threads << setw(13) << WORKLOAD_NAMES[w]
+                 << setw(16) << fixed << setprecision(0) << locked
+                 << setw(18) << lock_free << endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include "account_store.h"
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace {
+    void* aligned_alloc_64(size_t bytes) {
+        void* p = nullptr;
+        if (posix_memalign(&p, 64, bytes) != 0) {
+            throw bad_alloc();
+        }
+        return p;
+    }
+
+    Money with_interest(Money b, Money divisor) {
+        return b > 0 ? b + b / divisor : b;
+    }
+}
+
+// A new page is settled up to the epoch it was created in
+AccountStore::Page::Page(int _first_id, uint32_t epoch) : first_id(_first_id) {
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        balances[i].store(0, memory_order_relaxed);
+        active[i].store(0, memory_order_relaxed);
+        epochs[i].store(epoch, memory_order_relaxed);
+    }
+}
+
+AccountStore::AccountStore(size_t capacity, Mode _mode)
+    : mode(_mode), requested_capacity(capacity), allocated_chunks(0), epoch(0), sweep_cursor(0) {
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free");
+    static_assert((INTEREST_HISTORY & (INTEREST_HISTORY - 1)) == 0, "the ring must wrap with the epoch");
+
+    size_t num_pages = (capacity + PAGE_SIZE - 1) / PAGE_SIZE;
+    num_chunks = (num_pages + CHUNK_PAGES - 1) / CHUNK_PAGES;
+    if (num_chunks == 0) num_chunks = 1;
+
+    directory = new atomic<PageSlot*>[num_chunks];
+    for (size_t c = 0; c < num_chunks; c++) {
+        directory[c].store(nullptr, memory_order_relaxed);
+    }
+    divisors = new Money[INTEREST_HISTORY]();
+}
+
+AccountStore::~AccountStore() {
+    for (Page* page : pages) {
+        page->~Page();
+        free(page);
+    }
+    for (size_t c = 0; c < num_chunks; c++) {
+        delete[] directory[c].load();
+    }
+    delete[] directory;
+    delete[] divisors;
+}
+
+size_t AccountStore::capacity() const {
+    return requested_capacity;
+}
+
+AccountStore::Mode AccountStore::get_mode() const {
+    return mode;
+}
+
+bool AccountStore::contains(int id) const {
+    return id >= 0 && (size_t)id < requested_capacity;
+}
+
+size_t AccountStore::page_count() {
+    lock_guard<mutex> lock(pages_mutex);
+    return pages.size();
+}
+
+size_t AccountStore::memory_bytes() {
+    lock_guard<mutex> lock(pages_mutex);
+    return num_chunks * sizeof(atomic<PageSlot*>)
+         + allocated_chunks * CHUNK_PAGES * sizeof(PageSlot)
+         + pages.size() * sizeof(Page);
+}
+
+AccountStore::Page* AccountStore::find_page(int id) {
+    size_t page_index = id / PAGE_SIZE;
+    PageSlot* chunk = directory[page_index / CHUNK_PAGES].load(memory_order_acquire);
+    if (!chunk) return nullptr;
+    return chunk[page_index % CHUNK_PAGES].load(memory_order_acquire);
+}
+
+// Missing chunks and pages are installed with CAS; the loser of a race
+// frees its copy and uses the winner's
+AccountStore::Page* AccountStore::get_or_create_page(int id) {
+    size_t page_index = id / PAGE_SIZE;
+    atomic<PageSlot*>& chunk_slot = directory[page_index / CHUNK_PAGES];
+
+    PageSlot* chunk = chunk_slot.load(memory_order_acquire);
+    if (!chunk) {
+        PageSlot* fresh = new PageSlot[CHUNK_PAGES];
+        for (size_t i = 0; i < CHUNK_PAGES; i++) {
+            fresh[i].store(nullptr, memory_order_relaxed);
+        }
+        if (chunk_slot.compare_exchange_strong(chunk, fresh, memory_order_acq_rel)) {
+            chunk = fresh;
+            lock_guard<mutex> lock(pages_mutex);
+            allocated_chunks++;
+        } else {
+            delete[] fresh;
+        }
+    }
+
+    PageSlot& page_slot = chunk[page_index % CHUNK_PAGES];
+    Page* page = page_slot.load(memory_order_acquire);
+    if (!page) {
+        Page* fresh = new (aligned_alloc_64(sizeof(Page))) Page((int)(page_index * PAGE_SIZE),
+                                                                epoch.load(memory_order_acquire));
+        if (page_slot.compare_exchange_strong(page, fresh, memory_order_acq_rel)) {
+            page = fresh;
+            lock_guard<mutex> lock(pages_mutex);
+            pages.push_back(page);
+        } else {
+            fresh->~Page();
+            free(fresh);
+        }
+    }
+
+    return page;
+}
+
+// Balances start at zero, so activation is only the flag transition
+void AccountStore::activate(Page& page, size_t slot) {
+    if (page.active[slot].load(memory_order_relaxed)) return;
+    uint8_t expected = 0;
+    page.active[slot].compare_exchange_strong(expected, 1);
+}
+
+Money AccountStore::divisor_at(uint32_t e) const {
+    return divisors[e % INTEREST_HISTORY];
+}
+
+void AccountStore::settle(Page& page, size_t slot) {
+    if (mode == LOCKED) {
+        uint32_t target = epoch.load(memory_order_acquire);
+        uint32_t e = page.epochs[slot].load(memory_order_relaxed);
+        if (e == target) return;
+        Money b = page.balances[slot].load(memory_order_relaxed);
+        for (; e != target && b > 0; e++) {
+            b = with_interest(b, divisor_at(e));
+        }
+        page.balances[slot].store(b, memory_order_relaxed);
+        page.epochs[slot].store(target, memory_order_relaxed);
+        return;
+    }
+
+    if (page.epochs[slot].load(memory_order_acquire) == epoch.load(memory_order_acquire)) return;
+
+    // One thread catches up per page; deposits that already passed the
+    // check above may still land, so each step is a CAS
+    lock_guard<mutex> lock(page.lock);
+    uint32_t target = epoch.load(memory_order_acquire);
+    for (uint32_t e = page.epochs[slot].load(memory_order_relaxed); e != target; e++) {
+        Money current = page.balances[slot].load();
+        if (current <= 0) break;
+        while (current > 0 && !page.balances[slot].compare_exchange_weak(current, with_interest(current, divisor_at(e)))) {}
+        page.epochs[slot].store(e + 1, memory_order_release);
+    }
+    page.epochs[slot].store(target, memory_order_release);
+}
+
+Money AccountStore::settled_unlocked(const Page& page, size_t slot) const {
+    uint32_t target = epoch.load(memory_order_acquire);
+    Money b = page.balances[slot].load(memory_order_relaxed);
+    for (uint32_t e = page.epochs[slot].load(memory_order_relaxed); e != target && b > 0; e++) {
+        b = with_interest(b, divisor_at(e));
+    }
+    return b;
+}
+
+Money AccountStore::deposit(int id, Money amount) {
+    Page& page = *get_or_create_page(id);
+    size_t slot = id % PAGE_SIZE;
+    activate(page, slot);
+
+    if (mode == LOCK_FREE) {
+        settle(page, slot);
+        return page.balances[slot].fetch_add(amount) + amount;
+    }
+
+    lock_guard<mutex> lock(page.lock);
+    settle(page, slot);
+    Money b = page.balances[slot].load(memory_order_relaxed) + amount;
+    page.balances[slot].store(b, memory_order_relaxed);
+    return b;
+}
+
+bool AccountStore::withdraw(int id, Money amount, Money& new_balance) {
+    Page& page = *get_or_create_page(id);
+    size_t slot = id % PAGE_SIZE;
+    activate(page, slot);
+
+    if (mode == LOCK_FREE) {
+        settle(page, slot);
+        Money current = page.balances[slot].load();
+        do {
+            if (current < amount) return false;
+        } while (!page.balances[slot].compare_exchange_weak(current, current - amount));
+        new_balance = current - amount;
+        return true;
+    }
+
+    lock_guard<mutex> lock(page.lock);
+    settle(page, slot);
+    Money b = page.balances[slot].load(memory_order_relaxed);
+    if (b < amount) {
+        return false;
+    }
+    new_balance = b - amount;
+    page.balances[slot].store(new_balance, memory_order_relaxed);
+    return true;
+}
+
+Money AccountStore::balance(int id) {
+    Page* page = find_page(id);
+    if (!page) return 0;
+    size_t slot = id % PAGE_SIZE;
+
+    if (mode == LOCK_FREE) {
+        settle(*page, slot);
+        return page->balances[slot].load();
+    }
+
+    lock_guard<mutex> lock(page->lock);
+    settle(*page, slot);
+    return page->balances[slot].load(memory_order_relaxed);
+}
+
+bool AccountStore::transfer(int from, int to, Money amount, Money& from_balance, Money& to_balance) {
+    Page& source = *get_or_create_page(from);
+    Page& target = *get_or_create_page(to);
+    size_t from_slot = from % PAGE_SIZE;
+    size_t to_slot = to % PAGE_SIZE;
+    activate(source, from_slot);
+    activate(target, to_slot);
+
+    if (mode == LOCK_FREE) {
+        settle(source, from_slot);
+        settle(target, to_slot);
+        Money current = source.balances[from_slot].load();
+        do {
+            if (current < amount) return false;
+            if (from == to) break;
+        } while (!source.balances[from_slot].compare_exchange_weak(current, current - amount));
+        if (from == to) {
+            from_balance = to_balance = current;
+            return true;
+        }
+        from_balance = current - amount;
+        to_balance = target.balances[to_slot].fetch_add(amount) + amount;
+        return true;
+    }
+
+    // Pages are locked in ID order; both accounts may share one
+    Page* first = source.first_id <= target.first_id ? &source : &target;
+    Page* second = first == &source ? &target : &source;
+    unique_lock<mutex> first_lock(first->lock);
+    unique_lock<mutex> second_lock;
+    if (second != first) second_lock = unique_lock<mutex>(second->lock);
+    settle(source, from_slot);
+    settle(target, to_slot);
+
+    Money b = source.balances[from_slot].load(memory_order_relaxed);
+    if (b < amount) {
+        return false;
+    }
+    if (from != to) {
+        source.balances[from_slot].store(b - amount, memory_order_relaxed);
+        target.balances[to_slot].store(target.balances[to_slot].load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+    from_balance = source.balances[from_slot].load(memory_order_relaxed);
+    to_balance = target.balances[to_slot].load(memory_order_relaxed);
+    return true;
+}
+
+void AccountStore::apply_interest(Money divisor) {
+    lock_guard<mutex> lock(interest_mutex);
+    uint32_t e = epoch.load(memory_order_relaxed);
+    // Overwrites the divisor of epoch e - INTEREST_HISTORY, which every
+    // account is past
+    divisors[e % INTEREST_HISTORY] = divisor;
+    // Publishes the divisor to every thread that sees the new epoch
+    epoch.store(e + 1, memory_order_release);
+
+    size_t page_total = page_count();
+    sweep((page_total + SWEEP_EPOCHS - 1) / SWEEP_EPOCHS);
+}
+
+// Settles every slot of the next count pages. A page's gap between two
+// sweeps is at most one round of SWEEP_EPOCHS accruals, since pages are
+// only ever added; pages added mid-round start settled. Caller holds
+// interest_mutex.
+void AccountStore::sweep(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Page* page;
+        {
+            lock_guard<mutex> lock(pages_mutex);
+            if (pages.empty()) return;
+            if (sweep_cursor >= pages.size()) sweep_cursor = 0;
+            page = pages[sweep_cursor++];
+        }
+        if (mode == LOCK_FREE) {
+            for (size_t slot = 0; slot < PAGE_SIZE; slot++) settle(*page, slot);
+        } else {
+            lock_guard<mutex> lock(page->lock);
+            for (size_t slot = 0; slot < PAGE_SIZE; slot++) settle(*page, slot);
+        }
+    }
+}
+
+uint32_t AccountStore::interest_epoch() const {
+    return epoch.load(memory_order_acquire);
+}
@@ -0,0 +1,161 @@
+#ifndef _ACCOUNT_STORE_H_
+#define _ACCOUNT_STORE_H_
+
+#include "common.h"
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * AccountStore class
+ *
+ * Sparse, structure-of-arrays account table for the finance server.
+ *
+ * Account IDs are split into pages of PAGE_SIZE consecutive accounts. Each
+ * page keeps its balances (as fixed-point Money) and active flags in
+ * separate cache-line aligned arrays and has one lock. Pages are reached
+ * through a two-level radix directory and are only allocated when one of
+ * their accounts is first written, so memory grows with the set of used
+ * accounts rather than with the ID space: a sparse range of 10^9 IDs costs
+ * a few kilobytes of top-level directory up front. A lookup is two atomic
+ * loads; missing chunks and pages are installed with a compare-and-swap,
+ * so readers never take a lock.
+ *
+ * Single-account operations lock one page and transfers lock two, in page
+ * order.
+ *
+ * Interest is accrued lazily. apply_interest() only records its divisor
+ * as a new interest epoch, in O(1) however many accounts exist; every
+ * account remembers the last epoch applied to it and catches up on the
+ * epochs it missed the next time it is read or written, one truncated
+ * step per epoch, so balances are exactly those an eager sweep at each
+ * accrual would give. Zero and negative balances earn nothing and skip
+ * straight to the current epoch.
+ *
+ * Only the last INTEREST_HISTORY divisors are kept, in a ring indexed by
+ * epoch (which counts modulo 2^32). So that no account falls further
+ * behind, each accrual also settles the next few pages round-robin, and
+ * every page is settled at least once per SWEEP_EPOCHS accruals. That
+ * also caps the catch-up a dormant account does under its page lock at
+ * SWEEP_EPOCHS steps.
+ *
+ * In LOCK_FREE mode the page locks are not used on the fast path:
+ * deposits are atomic adds and withdrawals check funds inside a
+ * compare-and-swap loop. This avoids lock convoys on hot accounts (e.g.
+ * merchant sinks). The page lock only serializes catching up on interest,
+ * which each account does at most once per epoch, with CAS so concurrent
+ * deposits are not lost.
+ *
+ * Accounts are created lazily on first write, with a single atomic
+ * inactive -> active transition in either mode. An account that was never
+ * used has a zero balance, which interest leaves untouched.
+ */
+class AccountStore {
+public:
+    static const size_t PAGE_SIZE = 64;     // accounts per page and per lock
+    static const size_t CHUNK_PAGES = 4096; // pages per second-level directory chunk
+    static const size_t INTEREST_HISTORY = 4096;            // divisors kept; a power of two
+    static const size_t SWEEP_EPOCHS = INTEREST_HISTORY / 2; // accruals per settling round
+
+    enum Mode { LOCKED, LOCK_FREE };
+
+    AccountStore(size_t capacity, Mode mode = LOCKED);
+    ~AccountStore();
+
+    AccountStore(const AccountStore&) = delete;
+    AccountStore& operator=(const AccountStore&) = delete;
+
+    size_t capacity() const;
+    Mode get_mode() const;
+    bool contains(int id) const;
+
+    // Number of allocated pages and the memory held by the index
+    size_t page_count();
+    size_t memory_bytes();
+
+    // Single-account operations. Deposits and withdrawals activate the
+    // account if needed; reading an account that was never written returns
+    // 0 without allocating its page.
+    Money deposit(int id, Money amount);
+    bool withdraw(int id, Money amount, Money& new_balance);
+    Money balance(int id);
+
+    // Moves amount from one account to another if from holds at least
+    // amount; from == to only checks the funds. Locked mode holds both page
+    // locks, the lower page first so concurrent transfers cannot deadlock,
+    // and the move is atomic to every reader. Lock-free mode debits with a
+    // CAS and then credits, so a reader may briefly see the amount in
+    // neither account, but it can never be spent twice.
+    bool transfer(int from, int to, Money amount, Money& from_balance, Money& to_balance);
+
+    // Adds balance / divisor (truncated) to every positive balance, e.g.
+    // divisor 100 accrues 1%; accounts settle it on their next access.
+    // Safe to run concurrently with single-account operations in either
+    // mode. Also settles pages/SWEEP_EPOCHS pages, rounded up.
+    void apply_interest(Money divisor);
+
+    // Number of apply_interest() calls so far, modulo 2^32
+    uint32_t interest_epoch() const;
+
+    // Calls fn(first_id, balances) for every allocated page, where balances
+    // holds PAGE_SIZE entries with any pending interest applied. Takes no
+    // locks and does not allocate, so the caller must already exclude
+    // writers; meant for a forked snapshot child. Reads count as writers
+    // here: settling interest stores a balance and then its epoch.
+    template<typename F>
+    void visit_pages_unlocked(F fn) const;
+
+private:
+    struct Page {
+        std::atomic<Money> balances[PAGE_SIZE];  // plain loads/stores under the lock in LOCKED mode
+        std::atomic<uint8_t> active[PAGE_SIZE];
+        std::atomic<uint32_t> epochs[PAGE_SIZE]; // last interest epoch applied to each balance
+        std::mutex lock;
+        int first_id;
+        Page(int first_id, uint32_t epoch);
+    };
+    typedef std::atomic<Page*> PageSlot;
+
+    Page* find_page(int id);
+    Page* get_or_create_page(int id);
+    void activate(Page& page, size_t slot);
+
+    // Applies the interest epochs slot has missed. In LOCKED mode the
+    // caller holds the page lock; in LOCK_FREE mode it must not.
+    void settle(Page& page, size_t slot);
+    Money settled_unlocked(const Page& page, size_t slot) const;
+    Money divisor_at(uint32_t epoch) const;
+    void sweep(size_t count);
+
+    Mode mode;
+    size_t requested_capacity;
+    size_t num_chunks;
+    std::atomic<PageSlot*>* directory;  // num_chunks entries; chunks allocated lazily
+
+    // Allocated pages in allocation order, for the interest sweep
+    std::mutex pages_mutex;
+    std::vector<Page*> pages;
+    size_t allocated_chunks;
+
+    // Divisors of the last INTEREST_HISTORY epochs; an entry below epoch
+    // is immutable until it is SWEEP_EPOCHS behind every account
+    std::mutex interest_mutex; // one accrual at a time
+    std::atomic<uint32_t> epoch;
+    Money* divisors;           // indexed by epoch % INTEREST_HISTORY
+    size_t sweep_cursor;       // next page settled by apply_interest()
+};
+
+template<typename F>
+void AccountStore::visit_pages_unlocked(F fn) const {
+    Money balances[PAGE_SIZE];
+    for (size_t i = 0; i < pages.size(); i++) {
+        for (size_t slot = 0; slot < PAGE_SIZE; slot++) {
+            balances[slot] = settled_unlocked(*pages[i], slot);
+        }
+        fn(pages[i]->first_id, balances);
+    }
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include "finance_service.h"
+#include "network_channel.h"
+#include "thread_pool.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <new>
+#include <cstdlib>
+#include <getopt.h>
+
+using namespace std;
+
+// Allocation benchmark: heap allocations the server makes per request,
+// from recv to send, for a finance service on a real reactor and thread
+// pool. The client runs on the main thread, whose allocations are not
+// counted; everything else (reactor, workers, journal writer) is.
+
+namespace {
+    atomic<uint64_t> allocations(0);
+    thread_local bool uncounted = false;
+}
+
+void* operator new(size_t size) {
+    if (!uncounted) allocations.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void print_usage() {
+    cout << "Usage: ./alloc_bench [-p PORT] [-n REQUESTS] [-t THREADS] [-w WINDOW] [-j DIR]" << endl;
+    cout << "  -p, --port         Port the benchmark server listens on (default: 9700)" << endl;
+    cout << "  -n, --requests     Measured requests per workload (default: 20000)" << endl;
+    cout << "  -t, --threads      Server worker threads (default: 2)" << endl;
+    cout << "  -w, --window       Pipelined requests in flight for the pipelined rows (default: 32)" << endl;
+    cout << "  -j, --journal      Journal deposits to DIR (default: no journal)" << endl;
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+// Sends requests one at a time, or window at a time; returns the server
+// allocations per request once everything has been touched once
+double run_workload(NetworkRequestChannel& channel, const Request& req, size_t requests, size_t window) {
+    vector<Request> reqs(max(window, (size_t)1), req);
+    size_t rounds = window > 1 ? requests / window : requests;
+
+    // First use sizes buffers, account pages and histograms
+    for (size_t i = 0; i < 100; i++) {
+        if (window > 1) channel.send_requests(reqs, window);
+        else channel.send_request(req);
+    }
+
+    uint64_t before = allocations.load();
+    for (size_t i = 0; i < rounds; i++) {
+        if (window > 1) channel.send_requests(reqs, window);
+        else channel.send_request(req);
+    }
+    uint64_t counted = allocations.load() - before;
+    return (double)counted / (rounds * reqs.size());
+}
+
+int main(int argc, char* argv[]) {
+    uncounted = true;
+    int port = 9700;
+    size_t requests = 20000;
+    int threads = 2;
+    size_t window = 32;
+    string journal_dir;
+
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"requests", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 't'},
+        {"window", required_argument, 0, 'w'},
+        {"journal", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "p:n:t:w:j:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'n':
+                requests = strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'w':
+                window = strtoul(optarg, nullptr, 10);
+                break;
+            case 'j':
+                journal_dir = optarg;
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    if (requests < 1) requests = 1;
+    if (threads < 1) threads = 1;
+    if (window < 2) window = 2;
+
+    try {
+        FinanceService::Options options;
+        options.journal_dir = journal_dir;
+        FinanceService finance(options);
+
+        NetworkRequestChannel listener("", port, NetworkRequestChannel::SERVER_SIDE);
+        ThreadPool pool(threads);
+        Reactor reactor("Finance server", listener, pool, [&finance](const Request& r, const string& peer, Response& resp) {
+            finance.handle(r, peer, resp);
+        });
+
+        atomic<bool> stop(false);
+        thread server([&reactor, &stop]() { reactor.run(stop); });
+
+        NetworkRequestChannel channel("localhost", port, NetworkRequestChannel::CLIENT_SIDE);
+        Request transfer(TRANSFER, 1, money_from_units(1), "", "2");
+        channel.send_request(Request(DEPOSIT, 1, money_from_units(1000000)));
+
+        struct Row { const char* name; Request req; };
+        vector<Row> rows = {
+            {"DEPOSIT", Request(DEPOSIT, 1, money_from_units(1))},
+            {"WITHDRAW", Request(WITHDRAW, 1, money_from_units(1))},
+            {"BALANCE", Request(BALANCE, 1)},
+            {"TRANSFER", transfer},
+        };
+
+        cout << left << setw(12) << "request" << right << setw(16) << "allocs/request"
+             << setw(22) << "allocs/request (x" + to_string(window) + ")" << endl;
+        for (const Row& row : rows) {
+            double single = run_workload(channel, row.req, requests, 1);
+            double pipelined = run_workload(channel, row.req, requests, window);
+            cout << left << setw(12) << row.name << right << fixed << setprecision(3)
+                 << setw(16) << single << setw(22) << pipelined << endl;
+        }
+
+        channel.send_request(Request(QUIT));
+        stop = true;
+        server.join();
+    } catch (const exception& e) {
+        cerr << "alloc_bench failed: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "audit_queue.h"
+#include "wire.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    // Pause before retrying after the logging server failed or went away
+    const int RETRY_DELAY_MS = 1000;
+}
+
+AuditQueue::AuditQueue(const string& _host, int _port, int _max_delay_ms)
+    : host(_host), port(_port), max_delay_ms(_max_delay_ms),
+      next_sequence(1), acked(0), stopping(false) {
+    sender = thread([this] { sender_loop(); });
+}
+
+AuditQueue::~AuditQueue() {
+    close(0);
+}
+
+void AuditQueue::submit(const Request& audit) {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        unacked.push_back(audit);
+        unacked.back().request_id = next_sequence++;
+    }
+    work_ready.notify_one();
+}
+
+size_t AuditQueue::pending() {
+    lock_guard<std::mutex> lock(mutex);
+    return unacked.size();
+}
+
+uint32_t AuditQueue::acked_sequence() {
+    lock_guard<std::mutex> lock(mutex);
+    return acked;
+}
+
+size_t AuditQueue::flush(int timeout_ms) {
+    unique_lock<std::mutex> lock(mutex);
+    drained.wait_for(lock, chrono::milliseconds(timeout_ms), [this] { return unacked.empty(); });
+    return unacked.size();
+}
+
+size_t AuditQueue::close(int timeout_ms) {
+    size_t left = flush(timeout_ms);
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    if (sender.joinable()) sender.join();
+
+    // Say goodbye on the sender's own connection
+    if (channel) {
+        try {
+            channel->send_request(Request(QUIT));
+        } catch (const exception&) {
+        }
+        channel.reset();
+    }
+    return left;
+}
+
+void AuditQueue::sender_loop() {
+    unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_ready.wait(lock, [this] { return stopping || !unacked.empty(); });
+        if (stopping) break;
+
+        // Give the menu a moment to queue more records for the same batch
+        if (unacked.size() < MAX_BATCH) {
+            work_ready.wait_for(lock, chrono::milliseconds(max_delay_ms),
+                                [this] { return stopping || unacked.size() >= MAX_BATCH; });
+        }
+        size_t count = min(unacked.size(), (size_t)MAX_BATCH);
+
+        lock.unlock();
+        bool complete = send_batch(count);
+        lock.lock();
+
+        if (!complete && !stopping) {
+            work_ready.wait_for(lock, chrono::milliseconds(RETRY_DELAY_MS), [this] { return stopping; });
+        }
+    }
+}
+
+// Sends the first count unacknowledged records and drops the acknowledged
+// prefix from the queue; returns false if any of them must be resent
+bool AuditQueue::send_batch(size_t count) {
+    vector<Request> records;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        records.assign(unacked.begin(), unacked.begin() + count);
+    }
+
+    size_t acked_count = 0;
+    try {
+        if (!channel) {
+            channel.reset(new NetworkRequestChannel(host, port, NetworkRequestChannel::CLIENT_SIDE));
+            channel->set_encoding(Wire::BINARY);
+        }
+        Response resp = channel->send_request(Request(BATCH, 0, 0, "", Wire::encode_batch(records)));
+        vector<Response> results = Wire::decode_batch_responses(resp.data);
+        while (acked_count < results.size() && acked_count < records.size()
+               && results[acked_count].success
+               && results[acked_count].request_id == records[acked_count].request_id) {
+            acked_count++;
+        }
+    } catch (const exception& e) {
+        // Reconnect on the next attempt; everything unacknowledged is resent
+        channel.reset();
+    }
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < acked_count; i++) unacked.pop_front();
+        if (acked_count > 0) acked = records[acked_count - 1].request_id;
+    }
+    drained.notify_all();
+    return acked_count == records.size();
+}
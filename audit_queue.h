@@ -0,0 +1,72 @@
+#ifndef _AUDIT_QUEUE_H_
+#define _AUDIT_QUEUE_H_
+
+#include "common.h"
+#include "network_channel.h"
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+/*
+ * AuditQueue class
+ *
+ * Client-side asynchronous audit sender. The menu loop queues audit records
+ * and returns immediately; a background thread with its own connection to
+ * the logging server streams them as BATCH requests.
+ *
+ * Each record gets a sequence number, sent as its request_id. The logging
+ * server echoes it in every nested response, and the queue treats the
+ * longest run of successful sequence numbers from the front as acknowledged.
+ * Unacknowledged records, including those sent when the connection dropped,
+ * are sent again (at-least-once delivery), so the log may hold a duplicate
+ * after a failure but never misses a record while the client runs.
+ */
+class AuditQueue {
+public:
+    static const size_t MAX_BATCH = 64;
+
+    AuditQueue(const std::string& host, int port, int max_delay_ms = 20);
+    ~AuditQueue();
+
+    AuditQueue(const AuditQueue&) = delete;
+    AuditQueue& operator=(const AuditQueue&) = delete;
+
+    // Queues one record; never blocks on the network
+    void submit(const Request& audit);
+
+    // Records queued but not yet acknowledged
+    size_t pending();
+    uint32_t acked_sequence();
+
+    // Waits up to timeout_ms for every queued record to be acknowledged;
+    // returns the number still outstanding
+    size_t flush(int timeout_ms);
+
+    // Like flush, then stops the sender
+    size_t close(int timeout_ms);
+
+private:
+    void sender_loop();
+    bool send_batch(size_t count);
+
+    std::string host;
+    int port;
+    int max_delay_ms;
+    std::unique_ptr<NetworkRequestChannel> channel;  // sender thread only
+
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable drained;
+    std::deque<Request> unacked;  // in sequence order
+    uint32_t next_sequence;
+    uint32_t acked;
+    bool stopping;
+
+    std::thread sender;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "common.h"
+#include "network_channel.h"
+#include "thread_pool.h"
+#include "signals.h"
+#include "finance_service.h"
+#include "file_service.h"
+#include "logging_service.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+using namespace std;
+
+// Single-process deployment: the finance, file and logging services share
+// one reactor and one thread pool, each on its own port so existing
+// clients work unchanged. Finance audit records go straight to the logging
+// service instead of making a round trip from the client.
+
+void print_usage() {
+    cout << "Usage: ./bank [-t THREAD_COUNT] [--finance=OPTIONS] [--file=OPTIONS] [--logging=OPTIONS]" << endl;
+    cout << "  -t, --threads      Threads in the pool shared by all services (default: 8)" << endl;
+    cout << "      --finance      Finance server options, e.g. \"-p 8000 -j journal\" (see ./finance -h)" << endl;
+    cout << "      --file         File server options, e.g. \"-c 128 .txt .pdf\" (see ./file -h)" << endl;
+    cout << "      --logging      Logging server options, e.g. \"-b audit -C\" (see ./logging -h)" << endl;
+    cout << "  -h, --help         Show this help message" << endl;
+    cout << "Each service's own -t is ignored." << endl;
+}
+
+// Runs a service's option parser on a whitespace-separated argument string
+template<typename Service>
+int parse_service_options(const string& program, const string& args, typename Service::Options& options) {
+    vector<string> words(1, program);
+    istringstream in(args);
+    string word;
+    while (in >> word) words.push_back(word);
+
+    vector<char*> argv;
+    for (string& w : words) argv.push_back(&w[0]);
+    argv.push_back(nullptr);
+
+    optind = 0; // restart getopt from scratch
+    return Service::parse_options((int)words.size(), argv.data(), options);
+}
+
+int main(int argc, char* argv[]) {
+    int thread_count = 8;
+    string finance_args, file_args, logging_args;
+
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 't'},
+        {"finance", required_argument, 0, 0},
+        {"file", required_argument, 0, 0},
+        {"logging", required_argument, 0, 0},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "t:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            case 0:
+                if (string(long_options[option_index].name) == "finance") {
+                    finance_args = optarg;
+                } else if (string(long_options[option_index].name) == "file") {
+                    file_args = optarg;
+                } else if (string(long_options[option_index].name) == "logging") {
+                    logging_args = optarg;
+                }
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    if (thread_count < 1) thread_count = 1;
+
+    FinanceService::Options finance_options;
+    FileService::Options file_options;
+    LoggingService::Options logging_options;
+    int status = parse_service_options<FinanceService>("finance", finance_args, finance_options);
+    if (status < 0) status = parse_service_options<FileService>("file", file_args, file_options);
+    if (status < 0) status = parse_service_options<LoggingService>("logging", logging_args, logging_options);
+    if (status >= 0) return status;
+
+    // Setup signal handlers
+    SignalHandling::setup_handlers();
+    SignalHandling::log_signal_event("Bank server started on ports " + to_string(finance_options.port) + ", "
+        + to_string(file_options.port) + " and " + to_string(logging_options.port));
+
+    try {
+        // Declared before the reactor, so they outlive its pending work
+        LoggingService logging(logging_options);
+        FinanceService finance(finance_options);
+        FileService files(file_options);
+
+        // In-process handoff to the log writer's queue
+        finance.set_audit_sink([&logging](const Request& audit, const string& peer) {
+            Response resp = logging.handle(audit, peer);
+            if (!resp.success) cerr << "Audit record not logged: " << resp.message << endl;
+        });
+
+        NetworkRequestChannel finance_channel("", finance_options.port, NetworkRequestChannel::SERVER_SIDE,
+            finance_options.admission.backlog);
+        NetworkRequestChannel file_channel("", file_options.port, NetworkRequestChannel::SERVER_SIDE,
+            file_options.admission.backlog);
+        NetworkRequestChannel logging_channel("", logging_options.port, NetworkRequestChannel::SERVER_SIDE,
+            logging_options.admission.backlog);
+        ThreadPool threads(thread_count);
+
+        Reactor reactor("Finance server", finance_channel, threads,
+            [&finance](const Request& r, const string& peer, Response& resp) {
+                finance.handle(r, peer, resp);
+            }, finance_options.admission);
+        files.add_gauges(reactor.add_service("File server", file_channel,
+            [&files](const Request& r, const string& peer, Response& resp) {
+                resp = files.handle(r, peer);
+            }, file_options.admission));
+        reactor.add_service("Logging server", logging_channel,
+            [&logging](const Request& r, const string& peer, Response& resp) {
+                resp = logging.handle(r, peer);
+            }, logging_options.admission);
+        cout << "Bank server listening on ports " << finance_options.port << " (finance), "
+             << file_options.port << " (file) and " << logging_options.port << " (logging) with "
+             << thread_count << " threads" << endl;
+
+        // Serve all connections until shutdown is requested
+        reactor.run(SignalHandling::shutdown_requested);
+
+        cout << "Bank server shutting down..." << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Error starting bank server: " << e.what() << endl;
+        return 1;
+    }
+
+    SignalHandling::log_signal_event("Bank server shutdown complete");
+    return 0;
+}
@@ -0,0 +1,347 @@
+#include "binary_log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+    const uint32_t SEGMENT_MAGIC = 0x42414c47; // "BALG"
+    const uint32_t SEGMENT_VERSION = 1;
+
+    // First 64 bytes of every segment file
+    struct SegmentHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;      // records the file has room for
+        uint64_t count;         // records written
+        int64_t first_timestamp;
+        int64_t last_timestamp;
+        uint32_t sealed;
+        char padding[20];
+    };
+
+    int64_t now_us() {
+        return chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    bool write_file(const string& path, const void* data, size_t len) {
+        string temp = path + ".tmp";
+        int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t n = write(fd, p, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                close(fd);
+                return false;
+            }
+            p += n;
+            len -= n;
+        }
+        fsync(fd);
+        close(fd);
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+}
+
+struct BinaryLog::Segment {
+    uint64_t number;
+    void* map;
+    size_t map_len;
+    SegmentHeader* header;
+    Entry* records;
+
+    // Sealed segments only
+    void* index_map;
+    size_t index_len;
+    const IndexEntry* index;
+    size_t index_entries;
+
+    Segment() : number(0), map(nullptr), map_len(0), header(nullptr), records(nullptr),
+                index_map(nullptr), index_len(0), index(nullptr), index_entries(0) {}
+    ~Segment() {
+        if (map) {
+            msync(map, map_len, MS_ASYNC);
+            munmap(map, map_len);
+        }
+        if (index_map) munmap(index_map, index_len);
+    }
+};
+
+BinaryLog::BinaryLog(const string& _directory, size_t segment_bytes)
+    : directory(_directory), next_sequence(0), last_timestamp(0) {
+    static_assert(sizeof(Entry) == 32, "binary log records must be 32 bytes");
+    static_assert(sizeof(SegmentHeader) == 64, "segment header must be 64 bytes");
+
+    segment_records = segment_bytes > sizeof(SegmentHeader) ? (segment_bytes - sizeof(SegmentHeader)) / sizeof(Entry) : 0;
+    if (segment_records < 1024) segment_records = 1024;
+
+    if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        throw runtime_error("Binary log directory creation failed!");
+    }
+
+    // Existing segments, oldest first
+    vector<uint64_t> numbers;
+    DIR* dir = opendir(directory.c_str());
+    if (dir) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            unsigned long long n;
+            char suffix[8];
+            if (sscanf(entry->d_name, "seg.%llu.%7s", &n, suffix) == 2 && strcmp(suffix, "log") == 0) {
+                numbers.push_back(n);
+            }
+        }
+        closedir(dir);
+    }
+    sort(numbers.begin(), numbers.end());
+
+    for (size_t i = 0; i < numbers.size(); i++) {
+        SegmentPtr segment = open_segment(numbers[i], false);
+        segments.push_back(segment);
+        if (i + 1 < numbers.size() || segment->header->sealed) {
+            load_index(*segment);
+        }
+    }
+
+    if (segments.empty() || segments.back()->header->sealed) {
+        uint64_t number = segments.empty() ? 1 : segments.back()->number + 1;
+        segments.push_back(open_segment(number, true));
+    }
+    scan_active();
+
+    // Continue the sequence and the clock from the newest record
+    for (size_t i = segments.size(); i-- > 0;) {
+        const Segment& s = *segments[i];
+        if (s.header->count > 0) {
+            next_sequence = s.records[s.header->count - 1].sequence + 1;
+            last_timestamp = s.header->last_timestamp;
+            break;
+        }
+    }
+}
+
+BinaryLog::~BinaryLog() {
+}
+
+string BinaryLog::segment_path(uint64_t number, const char* suffix) const {
+    char name[64];
+    snprintf(name, sizeof(name), "/seg.%06llu.%s", (unsigned long long)number, suffix);
+    return directory + name;
+}
+
+BinaryLog::SegmentPtr BinaryLog::open_segment(uint64_t number, bool create) {
+    string path = segment_path(number, "log");
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        throw runtime_error("Binary log segment open failed!");
+    }
+
+    size_t len;
+    if (create) {
+        len = sizeof(SegmentHeader) + segment_records * sizeof(Entry);
+        if (ftruncate(fd, len) < 0) {
+            close(fd);
+            throw runtime_error("Binary log segment allocation failed!");
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SegmentHeader)) {
+            close(fd);
+            throw runtime_error("Binary log segment is truncated!");
+        }
+        len = st.st_size;
+    }
+
+    void* map = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw runtime_error("Binary log segment mmap failed!");
+    }
+
+    SegmentPtr segment = make_shared<Segment>();
+    segment->number = number;
+    segment->map = map;
+    segment->map_len = len;
+    segment->header = static_cast<SegmentHeader*>(map);
+    segment->records = reinterpret_cast<Entry*>(static_cast<char*>(map) + sizeof(SegmentHeader));
+
+    SegmentHeader& header = *segment->header;
+    if (create) {
+        header.magic = SEGMENT_MAGIC;
+        header.version = SEGMENT_VERSION;
+        header.capacity = segment_records;
+    } else if (header.magic != SEGMENT_MAGIC || header.version != SEGMENT_VERSION
+               || sizeof(SegmentHeader) + header.capacity * sizeof(Entry) > len) {
+        throw runtime_error("Binary log segment header is invalid!");
+    }
+    if (header.count > header.capacity) header.count = header.capacity;
+    return segment;
+}
+
+// Rebuilds the in-memory index of the active segment. Records written after
+// the header count was last updated (a crash between the two) are kept:
+// unused slots are still zero.
+void BinaryLog::scan_active() {
+    Segment& segment = *segments.back();
+    SegmentHeader& header = *segment.header;
+    while (header.count < header.capacity && segment.records[header.count].timestamp_us != 0) {
+        header.last_timestamp = segment.records[header.count].timestamp_us;
+        if (header.count == 0) header.first_timestamp = header.last_timestamp;
+        header.count++;
+    }
+
+    active_index.clear();
+    for (uint32_t i = 0; i < header.count; i++) {
+        active_index[segment.records[i].user_id].push_back(i);
+    }
+}
+
+// Maps the segment's index file, writing it first if it is missing
+void BinaryLog::load_index(Segment& segment) {
+    string path = segment_path(segment.number, "idx");
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        vector<IndexEntry> entries(segment.header->count);
+        for (uint32_t i = 0; i < segment.header->count; i++) {
+            entries[i].user_id = segment.records[i].user_id;
+            entries[i].record = i;
+        }
+        stable_sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) {
+            return a.user_id < b.user_id;
+        });
+        if (!write_file(path, entries.data(), entries.size() * sizeof(IndexEntry))) {
+            throw runtime_error("Binary log index write failed!");
+        }
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw runtime_error("Binary log index open failed!");
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            segment.index_map = map;
+            segment.index_len = st.st_size;
+            segment.index = static_cast<const IndexEntry*>(map);
+            segment.index_entries = st.st_size / sizeof(IndexEntry);
+        }
+    }
+    close(fd);
+}
+
+// Writes the active index out next to the segment; called with mutex held
+void BinaryLog::seal(Segment& segment) {
+    vector<IndexEntry> entries;
+    entries.reserve(segment.header->count);
+    vector<int32_t> users;
+    users.reserve(active_index.size());
+    for (const auto& kv : active_index) users.push_back(kv.first);
+    sort(users.begin(), users.end());
+    for (int32_t user : users) {
+        for (uint32_t record : active_index[user]) {
+            IndexEntry e;
+            e.user_id = user;
+            e.record = record;
+            entries.push_back(e);
+        }
+    }
+
+    if (!write_file(segment_path(segment.number, "idx"), entries.data(), entries.size() * sizeof(IndexEntry))) {
+        throw runtime_error("Binary log index write failed!");
+    }
+    segment.header->sealed = 1;
+    msync(segment.map, segment.map_len, MS_ASYNC);
+    load_index(segment);
+}
+
+void BinaryLog::append(int user_id, RequestType type, Money amount) {
+    lock_guard<std::mutex> lock(mutex);
+
+    Segment* segment = segments.back().get();
+    if (segment->header->count >= segment->header->capacity) {
+        seal(*segment);
+        segments.push_back(open_segment(segment->number + 1, true));
+        segment = segments.back().get();
+        active_index.clear();
+    }
+
+    // Keep timestamps non-decreasing even if the wall clock steps back
+    int64_t timestamp = now_us();
+    if (timestamp < last_timestamp) timestamp = last_timestamp;
+    last_timestamp = timestamp;
+
+    SegmentHeader& header = *segment->header;
+    uint32_t slot = (uint32_t)header.count;
+    Entry& entry = segment->records[slot];
+    entry.amount = amount;
+    entry.user_id = user_id;
+    entry.type = (uint16_t)type;
+    entry.reserved = 0;
+    entry.sequence = next_sequence++;
+    entry.timestamp_us = timestamp;
+
+    if (slot == 0) header.first_timestamp = timestamp;
+    header.last_timestamp = timestamp;
+    header.count = slot + 1;
+    active_index[user_id].push_back(slot);
+}
+
+vector<BinaryLog::Entry> BinaryLog::query(int user_id, int64_t from_us, int64_t to_us, size_t limit) {
+    vector<SegmentPtr> snapshot;
+    vector<uint32_t> active_hits;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        snapshot = segments;
+        unordered_map<int32_t, vector<uint32_t> >::const_iterator it = active_index.find(user_id);
+        if (it != active_index.end()) active_hits = it->second;
+    }
+
+    // Newest segments first, so the limit can stop the walk early
+    vector<Entry> results;
+    for (size_t i = snapshot.size(); i-- > 0 && results.size() < limit;) {
+        const Segment& segment = *snapshot[i];
+        bool active = i + 1 == snapshot.size();
+        if (!active && (segment.header->count == 0 || segment.header->last_timestamp < from_us
+                        || segment.header->first_timestamp >= to_us)) {
+            continue;
+        }
+
+        vector<uint32_t> hits;
+        if (active) {
+            hits.swap(active_hits);
+        } else if (segment.index) {
+            IndexEntry key;
+            key.user_id = user_id;
+            key.record = 0;
+            pair<const IndexEntry*, const IndexEntry*> range = equal_range(
+                segment.index, segment.index + segment.index_entries, key,
+                [](const IndexEntry& a, const IndexEntry& b) { return a.user_id < b.user_id; });
+            for (const IndexEntry* e = range.first; e != range.second; e++) hits.push_back(e->record);
+        }
+
+        for (size_t h = hits.size(); h-- > 0 && results.size() < limit;) {
+            const Entry& entry = segment.records[hits[h]];
+            if (entry.timestamp_us >= from_us && entry.timestamp_us < to_us) {
+                results.push_back(entry);
+            }
+        }
+    }
+
+    reverse(results.begin(), results.end());
+    return results;
+}
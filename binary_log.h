@@ -0,0 +1,81 @@
+#ifndef _BINARY_LOG_H_
+#define _BINARY_LOG_H_
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * BinaryLog class
+ *
+ * Structured audit log for the logging server, kept next to the text log
+ * so user history can be answered without scanning it.
+ *
+ * Records are fixed 32-byte entries (timestamp, user ID, type, amount)
+ * stored in segments: seg.<N>.log files preallocated to the size threshold
+ * and written through a shared memory mapping. When a segment fills up it
+ * is sealed and the next one is started. Sealing writes seg.<N>.idx, which
+ * holds the segment's (user_id, record number) pairs sorted by user, so a
+ * lookup is a binary search over the mapped index. The active segment's
+ * index lives in memory. Records are appended in time order, and every
+ * segment header holds its first and last timestamp, so queries skip
+ * segments outside the requested window.
+ *
+ * On startup, existing segments are mapped again. The active segment is
+ * rescanned, and a sealed segment whose index file is missing gets its
+ * index rebuilt.
+ */
+class BinaryLog {
+public:
+    struct Entry {
+        int64_t timestamp_us;   // microseconds since the Unix epoch
+        Money amount;
+        int32_t user_id;
+        uint16_t type;          // RequestType
+        uint16_t reserved;
+        uint64_t sequence;      // position in the whole log
+    };
+
+    BinaryLog(const std::string& directory, size_t segment_bytes);
+    ~BinaryLog();
+
+    BinaryLog(const BinaryLog&) = delete;
+    BinaryLog& operator=(const BinaryLog&) = delete;
+
+    void append(int user_id, RequestType type, Money amount);
+
+    // Entries of user_id with from_us <= timestamp < to_us, oldest first,
+    // at most limit of them (the newest ones if there are more)
+    std::vector<Entry> query(int user_id, int64_t from_us, int64_t to_us, size_t limit);
+
+private:
+    struct IndexEntry {
+        int32_t user_id;
+        uint32_t record;
+    };
+
+    struct Segment;
+    typedef std::shared_ptr<Segment> SegmentPtr;
+
+    SegmentPtr open_segment(uint64_t number, bool create);
+    void seal(Segment& segment);
+    void load_index(Segment& segment);
+    void scan_active();
+    std::string segment_path(uint64_t number, const char* suffix) const;
+
+    std::string directory;
+    size_t segment_records;
+
+    std::mutex mutex;                      // guards everything below
+    std::vector<SegmentPtr> segments;      // oldest first; the last one is active
+    std::unordered_map<int32_t, std::vector<uint32_t> > active_index;
+    uint64_t next_sequence;
+    int64_t last_timestamp;
+};
+
+#endif
@@ -1,6 +1,11 @@
 #include "common.h"
 #include "network_channel.h"
 #include "signals.h"
+#include "audit_queue.h"
+#include "file_transfer.h"
+#include "connection_pool.h"
+#include "replay.h"
+#include "finance_cluster.h"
 #include <iostream>
 #include <unistd.h>
 #include <fstream>
@@ -8,7 +13,12 @@
 #include <limits>
 #include <getopt.h>
 #include <memory>
+#include <algorithm>
 #include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <cerrno>
+#include <fcntl.h>
 
 using namespace std;
 using namespace SignalHandling;
@@ -24,6 +34,9 @@ void print_menu() {
          << "7. Logout\n"
          << "8. Server Status\n"
          << "9. Update Interest for All Accounts\n"
+         << "10. Bulk Deposit/Withdraw/Transfer\n"
+         << "11. View Audit History\n"
+         << "12. Transfer\n"
          << "0. Exit\n"
          << "Enter choice: ";
 }
@@ -38,6 +51,36 @@ void clear_input() {
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 }
 
+// Reads a decimal amount such as 12.34; false if the input is not one
+bool read_amount(Money& amount) {
+    string text;
+    cin >> text;
+    clear_input();
+    return parse_money(text, amount);
+}
+
+// Sends one audit record to the logging server: queued for the background
+// sender in async mode, otherwise synchronously on the logging channel
+void send_audit(const Request& audit, AuditQueue* audit_queue,
+                NetworkRequestChannel* logging_channel, const string& failure) {
+    if (audit_queue) {
+        audit_queue->submit(audit);
+    } else if (logging_channel) {
+        Response log_resp = logging_channel->send_request(audit);
+        if (!log_resp.success) {
+            cout << "Warning: " << failure << endl;
+        }
+    } else {
+        cout << "Warning: Not connected to logging server" << endl;
+    }
+}
+
+// True if the server already logged the request (a single-process bank
+// server audits finance requests itself)
+bool audited_by_server(const Response& resp) {
+    return (resp.flags & AUDITED) != 0;
+}
+
 // Retry mechanism for failed operations
 template<typename Func>
 void retry_operation(const string& operation_name, Func operation, int max_retries = 3) {
@@ -70,16 +113,111 @@ void retry_operation(const string& operation_name, Func operation, int max_retri
     }
 }
 
+// Non-interactive mode: replays an operations file through connection
+// pools and prints what happened. Finance operations go to the shards of
+// shard_map when one is given.
+int run_replay(const string& path, const string hosts[Replay::NUM_SERVERS], const int ports[Replay::NUM_SERVERS],
+               const string& shard_map, size_t connections, ConnectionPool::Policy policy,
+               int timeout_ms, double rate, size_t window, size_t repeat) {
+    vector<Replay::Operation> ops;
+    try {
+        ops = Replay::load(path);
+    } catch (const exception& e) {
+        cerr << "Replay failed: " << e.what() << endl;
+        return 1;
+    }
+
+    static const char* names[Replay::NUM_SERVERS] = {"finance", "file", "logging"};
+    vector<unique_ptr<ConnectionPool> > owned;
+    unique_ptr<FinanceCluster> cluster;
+    Replay::Target targets[Replay::NUM_SERVERS];
+    for (const Replay::Operation& op : ops) {
+        if (targets[op.server]) continue;
+        try {
+            if (op.server == Replay::FINANCE && !shard_map.empty()) {
+                cluster.reset(new FinanceCluster(shard_map, connections, policy, timeout_ms));
+                FinanceCluster* shards = cluster.get();
+                targets[op.server] = [shards](const Request& r) { return shards->submit(r); };
+                continue;
+            }
+            owned.push_back(unique_ptr<ConnectionPool>(
+                new ConnectionPool(hosts[op.server], ports[op.server], connections, policy, timeout_ms)));
+        } catch (const exception& e) {
+            cerr << "Failed to connect to " << names[op.server] << " server: " << e.what() << endl;
+            return 1;
+        }
+        ConnectionPool* pool = owned.back().get();
+        targets[op.server] = [pool](const Request& r) { return pool->submit(r); };
+    }
+
+    cout << "Replaying " << ops.size() << " operations " << repeat << " time(s) over "
+         << connections << " connection(s) per server";
+    if (cluster) cout << ", " << cluster->shard_count() << " finance shards";
+    if (rate > 0) cout << " at " << rate << " ops/s";
+    cout << endl;
+
+    Replay::Stats stats = Replay::run(ops, targets, rate, window, repeat, shutdown_requested);
+    owned.clear();
+    cluster.reset();
+
+    cout << stats.sent << " sent, " << stats.succeeded << " succeeded, " << stats.refused << " refused, "
+         << stats.failed << " failed in " << stats.seconds << " s ("
+         << (stats.seconds > 0 ? stats.sent / stats.seconds : 0) << " ops/s)" << endl;
+    return stats.failed == 0 ? 0 : 1;
+}
+
+// Non-interactive mode: prints one server's metrics, for scrapers
+int run_stats(const string& server, const string& host, int port, int timeout_ms) {
+    try {
+        // Keep stdout to the report itself
+        streambuf* saved = cout.rdbuf(cerr.rdbuf());
+        unique_ptr<NetworkRequestChannel> channel;
+        try {
+            channel.reset(new NetworkRequestChannel(host, port, NetworkRequestChannel::CLIENT_SIDE));
+        } catch (...) {
+            cout.rdbuf(saved);
+            throw;
+        }
+        cout.rdbuf(saved);
+        channel->set_timeout(timeout_ms);
+
+        Response resp = channel->send_request(Request(STATS));
+        channel->send_request(Request(QUIT));
+        if (!resp.success) {
+            cerr << "Stats request failed: " << resp.message << endl;
+            return 1;
+        }
+        cout << resp.data;
+        return 0;
+    } catch (const exception& e) {
+        cerr << "Failed to read " << server << " server metrics: " << e.what() << endl;
+        return 1;
+    }
+}
+
 void print_usage() {
     cout << "Usage: ./network_client [OPTIONS]" << endl;
     cout << "  -h, --help                      Show this help message" << endl;
     cout << "  --finance-host=HOST             Finance server hostname/IP (default: localhost)" << endl;
     cout << "  --finance-port=PORT             Finance server port (default: 8000)" << endl;
+    cout << "  --shard-map=FILE                Spread accounts over the finance shards in FILE (see shard_map.h)" << endl;
     cout << "  --logging-host=HOST             Logging server hostname/IP (default: localhost)" << endl;
     cout << "  --logging-port=PORT             Logging server port (default: 8002)" << endl;
     cout << "  --file-host=HOST                File server hostname/IP (default: localhost)" << endl;
     cout << "  --file-port=PORT                File server port (default: 8001)" << endl;
     cout << "  -r, --retries=N                 Max connection retries (default: 3)" << endl;
+    cout << "  --text-protocol                 Use the legacy text wire format (for old servers)" << endl;
+    cout << "  --async-audit                   Send audit records in the background, in batches" << endl;
+    cout << "  --durable-uploads               Wait until uploads are on the server's disk" << endl;
+    cout << "  --quick-ack                     Acknowledge server replies at once (TCP_QUICKACK)" << endl;
+    cout << "  --timeout=MS                    Give up on a server reply after MS milliseconds (default: 0, never)" << endl;
+    cout << "  --replay=FILE                   Run the operations in FILE instead of the menu (see replay.h)" << endl;
+    cout << "  --rate=N                        Replay: operations started per second (default: 0, unpaced)" << endl;
+    cout << "  --connections=N                 Replay: connections per server (default: 4)" << endl;
+    cout << "  --window=N                      Replay: most operations outstanding (default: 256)" << endl;
+    cout << "  --repeat=N                      Replay: times to run the file (default: 1)" << endl;
+    cout << "  --round-robin                   Replay: rotate over connections instead of picking the least loaded" << endl;
+    cout << "  --stats=SERVER                  Print the metrics of SERVER (finance, file or logging) and exit" << endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -90,6 +228,19 @@ int main(int argc, char* argv[]) {
     string file_host = "localhost";
     int file_port = 8001;
     int max_retries = 3;
+    bool text_protocol = false;
+    bool async_audit = false;
+    uint32_t upload_flags = 0;
+    bool quick_ack = false;
+    int timeout_ms = 0;
+    string replay_file;
+    double replay_rate = 0;
+    size_t replay_connections = 4;
+    size_t replay_window = 256;
+    size_t replay_repeat = 1;
+    ConnectionPool::Policy replay_policy = ConnectionPool::LEAST_LOADED;
+    string shard_map;
+    string stats_server;
     
     // Parse command line arguments
     static struct option long_options[] = {
@@ -101,6 +252,19 @@ int main(int argc, char* argv[]) {
         {"file-host", required_argument, 0, 0},
         {"file-port", required_argument, 0, 0},
         {"retries", required_argument, 0, 'r'},
+        {"text-protocol", no_argument, 0, 0},
+        {"async-audit", no_argument, 0, 0},
+        {"durable-uploads", no_argument, 0, 0},
+        {"quick-ack", no_argument, 0, 0},
+        {"timeout", required_argument, 0, 0},
+        {"replay", required_argument, 0, 0},
+        {"rate", required_argument, 0, 0},
+        {"connections", required_argument, 0, 0},
+        {"window", required_argument, 0, 0},
+        {"repeat", required_argument, 0, 0},
+        {"round-robin", no_argument, 0, 0},
+        {"stats", required_argument, 0, 0},
+        {"shard-map", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
     
@@ -122,6 +286,32 @@ int main(int argc, char* argv[]) {
                     file_host = optarg;
                 } else if (string(long_options[option_index].name) == "file-port") {
                     file_port = atoi(optarg);
+                } else if (string(long_options[option_index].name) == "text-protocol") {
+                    text_protocol = true;
+                } else if (string(long_options[option_index].name) == "async-audit") {
+                    async_audit = true;
+                } else if (string(long_options[option_index].name) == "quick-ack") {
+                    quick_ack = true;
+                } else if (string(long_options[option_index].name) == "timeout") {
+                    timeout_ms = atoi(optarg);
+                } else if (string(long_options[option_index].name) == "durable-uploads") {
+                    upload_flags |= DURABLE;
+                } else if (string(long_options[option_index].name) == "replay") {
+                    replay_file = optarg;
+                } else if (string(long_options[option_index].name) == "rate") {
+                    replay_rate = max(atof(optarg), 0.0);
+                } else if (string(long_options[option_index].name) == "connections") {
+                    replay_connections = max(atoi(optarg), 1);
+                } else if (string(long_options[option_index].name) == "window") {
+                    replay_window = max(atoi(optarg), 1);
+                } else if (string(long_options[option_index].name) == "repeat") {
+                    replay_repeat = max(atoi(optarg), 0);
+                } else if (string(long_options[option_index].name) == "round-robin") {
+                    replay_policy = ConnectionPool::ROUND_ROBIN;
+                } else if (string(long_options[option_index].name) == "stats") {
+                    stats_server = optarg;
+                } else if (string(long_options[option_index].name) == "shard-map") {
+                    shard_map = optarg;
                 }
                 break;
             case 'r':
@@ -138,36 +328,92 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    if (stats_server == "finance") {
+        return run_stats(stats_server, finance_host, finance_port, timeout_ms);
+    } else if (stats_server == "file") {
+        return run_stats(stats_server, file_host, file_port, timeout_ms);
+    } else if (stats_server == "logging") {
+        return run_stats(stats_server, logging_host, logging_port, timeout_ms);
+    } else if (!stats_server.empty()) {
+        cerr << "Unknown server " << stats_server << " (expected finance, file or logging)" << endl;
+        return 1;
+    }
+    
     // Initialize signal handling
     SignalHandling::setup_handlers();
     SignalHandling::log_signal_event("Network client started");
     
+    if (!replay_file.empty()) {
+        const string hosts[Replay::NUM_SERVERS] = {finance_host, file_host, logging_host};
+        const int ports[Replay::NUM_SERVERS] = {finance_port, file_port, logging_port};
+        return run_replay(replay_file, hosts, ports, shard_map, replay_connections, replay_policy,
+                          timeout_ms, replay_rate, replay_window, replay_repeat);
+    }
+    
     cout << "Connecting to servers..." << endl;
     
     // Connection pointers - using raw pointers instead of unique_ptr with make_unique
     NetworkRequestChannel* finance_channel = nullptr;
     NetworkRequestChannel* logging_channel = nullptr;
     NetworkRequestChannel* file_channel = nullptr;
+    FinanceCluster* finance_cluster = nullptr;
     
+    Wire::Encoding encoding = text_protocol ? Wire::TEXT : Wire::BINARY;
+
     // Try to connect to servers
-    try {
-        cout << "Connected to finance server at " << finance_host << ":" << finance_port << endl;
-    } catch (const exception& e) {
-        cerr << "Failed to connect to finance server: " << e.what() << endl;
+    if (!shard_map.empty()) {
+        try {
+            finance_cluster = new FinanceCluster(shard_map, 1, ConnectionPool::LEAST_LOADED, timeout_ms);
+            cout << "Connected to " << finance_cluster->shard_count() << " finance shards from " << shard_map << endl;
+        } catch (const exception& e) {
+            cerr << "Failed to connect to finance shards: " << e.what() << endl;
+        }
+    } else {
+        try {
+            finance_channel = new NetworkRequestChannel(finance_host, finance_port, NetworkRequestChannel::CLIENT_SIDE);
+            finance_channel->set_encoding(encoding);
+            if (quick_ack) finance_channel->set_quick_ack(true);
+            finance_channel->set_timeout(timeout_ms);
+            cout << "Connected to finance server at " << finance_host << ":" << finance_port << endl;
+        } catch (const exception& e) {
+            cerr << "Failed to connect to finance server: " << e.what() << endl;
+        }
     }
+
+    // Finance requests go to the one finance server, or to the user's shard
+    auto send_finance = [&](const Request& r) {
+        return finance_cluster ? finance_cluster->send_request(r) : finance_channel->send_request(r);
+    };
     
     try {
+        logging_channel = new NetworkRequestChannel(logging_host, logging_port, NetworkRequestChannel::CLIENT_SIDE);
+        logging_channel->set_encoding(encoding);
+        if (quick_ack) logging_channel->set_quick_ack(true);
+        logging_channel->set_timeout(timeout_ms);
         cout << "Connected to logging server at " << logging_host << ":" << logging_port << endl;
     } catch (const exception& e) {
         cerr << "Failed to connect to logging server: " << e.what() << endl;
     }
     
     try {
+        file_channel = new NetworkRequestChannel(file_host, file_port, NetworkRequestChannel::CLIENT_SIDE);
+        file_channel->set_encoding(encoding);
+        if (quick_ack) file_channel->set_quick_ack(true);
+        file_channel->set_timeout(timeout_ms);
         cout << "Connected to file server at " << file_host << ":" << file_port << endl;
     } catch (const exception& e) {
         cerr << "Failed to connect to file server: " << e.what() << endl;
     }
     
+    // Background audit sender; batches need the binary protocol
+    AuditQueue* audit_queue = nullptr;
+    if (async_audit && text_protocol) {
+        cerr << "Async audit needs the binary protocol; sending audit records synchronously" << endl;
+    } else if (async_audit) {
+        audit_queue = new AuditQueue(logging_host, logging_port);
+        cout << "Audit records are sent in the background" << endl;
+    }
+    
     int current_user = -1;  // -1 means no user logged in
     bool running = true;
     
@@ -252,14 +498,16 @@ int main(int argc, char* argv[]) {
                         break;
                     }
                     
-                    double amount;
+                    Money amount;
                     cout << "Enter amount to deposit: ";
-                    cin >> amount;
-                    clear_input();
+                    if (!read_amount(amount)) {
+                        cout << "Invalid amount\n";
+                        break;
+                    }
                     
                     // Deposit operation
                     auto deposit_operation = [&]() {
-                        if (!finance_channel) {
+                        if (!finance_channel && !finance_cluster) {
                             cout << "Not connected to finance server!" << endl;
                             return false;
                         }
@@ -268,25 +516,17 @@ int main(int argc, char* argv[]) {
                         Response resp;
                         
                         try {
-                            resp = finance_channel->send_request(txn);
+                            resp = send_finance(txn);
                         } catch (const exception& e) {
                             cout << "Deposit failed: " << e.what() << endl;
                             return false;
                         }
                         
                         if (resp.success) {
-                            cout << "Deposit successful. New balance: " << resp.balance << endl;
+                            cout << "Deposit successful. New balance: " << format_money(resp.balance) << endl;
                             
                             // Log the deposit
-                            if (logging_channel) {
-                                Request audit(DEPOSIT, current_user, amount);
-                                Response log_resp = logging_channel->send_request(audit);
-                                if (!log_resp.success) {
-                                    cout << "Warning: Failed to log transaction" << endl;
-                                }
-                            } else {
-                                cout << "Warning: Not connected to logging server" << endl;
-                            }
+                            if (!audited_by_server(resp)) send_audit(Request(DEPOSIT, current_user, amount), audit_queue, logging_channel, "Failed to log transaction");
                             return true;
                         } else {
                             cout << "Deposit failed: " << resp.message << endl;
@@ -311,14 +551,16 @@ int main(int argc, char* argv[]) {
                         break;
                     }
                     
-                    double amount;
+                    Money amount;
                     cout << "Enter amount to withdraw: ";
-                    cin >> amount;
-                    clear_input();
+                    if (!read_amount(amount)) {
+                        cout << "Invalid amount\n";
+                        break;
+                    }
                     
                     // Withdraw operation
                     auto withdraw_operation = [&]() {
-                        if (!finance_channel) {
+                        if (!finance_channel && !finance_cluster) {
                             cout << "Not connected to finance server!" << endl;
                             return false;
                         }
@@ -327,25 +569,17 @@ int main(int argc, char* argv[]) {
                         Response resp;
                         
                         try {
-                            resp = finance_channel->send_request(txn);
+                            resp = send_finance(txn);
                         } catch (const exception& e) {
                             cout << "Withdrawal failed: " << e.what() << endl;
                             return false;
                         }
                         
                         if (resp.success) {
-                            cout << "Withdrawal successful. New balance: " << resp.balance << endl;
+                            cout << "Withdrawal successful. New balance: " << format_money(resp.balance) << endl;
                             
                             // Log the withdrawal
-                            if (logging_channel) {
-                                Request audit(WITHDRAW, current_user, amount);
-                                Response log_resp = logging_channel->send_request(audit);
-                                if (!log_resp.success) {
-                                    cout << "Warning: Failed to log transaction" << endl;
-                                }
-                            } else {
-                                cout << "Warning: Not connected to logging server" << endl;
-                            }
+                            if (!audited_by_server(resp)) send_audit(Request(WITHDRAW, current_user, amount), audit_queue, logging_channel, "Failed to log transaction");
                             return true;
                         } else {
                             cout << "Withdrawal failed: " << resp.message << endl;
@@ -372,7 +606,7 @@ int main(int argc, char* argv[]) {
                     
                     // View balance operation
                     auto balance_operation = [&]() {
-                        if (!finance_channel) {
+                        if (!finance_channel && !finance_cluster) {
                             cout << "Not connected to finance server!" << endl;
                             return false;
                         }
@@ -381,25 +615,17 @@ int main(int argc, char* argv[]) {
                         Response resp;
 
                         try {
-                            resp = finance_channel->send_request(txn);
+                            resp = send_finance(txn);
                         } catch (const exception& e) {
                             cout << "Balance request failed: " << e.what() << endl;
                             return false;
                         }
                         
                         if (resp.success) {
-                            cout << "Current balance: " << resp.balance << endl;
+                            cout << "Current balance: " << format_money(resp.balance) << endl;
                             
                             // Log the balance view
-                            if (logging_channel) {
-                                Request audit(BALANCE, current_user, resp.balance);
-                                Response log_resp = logging_channel->send_request(audit);
-                                if (!log_resp.success) {
-                                    cout << "Warning: Failed to log transaction" << endl;
-                                }
-                            } else {
-                                cout << "Warning: Not connected to logging server" << endl;
-                            }
+                            if (!audited_by_server(resp)) send_audit(Request(BALANCE, current_user, resp.balance), audit_queue, logging_channel, "Failed to log transaction");
                             return true;
                         } else {
                             cout << "Failed to get balance: " << resp.message << endl;
@@ -433,8 +659,6 @@ int main(int argc, char* argv[]) {
                         cout << "Error: Could not open file\n";
                         break;
                     }
-                    
-                    string content((istreambuf_iterator<char>(infile)), {});
                     infile.close();
 
                     // Upload file operation
@@ -444,32 +668,32 @@ int main(int argc, char* argv[]) {
                             return false;
                         }
                         
-                        Request upload(UPLOAD_FILE, current_user, 0, filename, content);
-                        Response resp;
-                        
+                        bool uploaded;
+                        string error;
                         try {
-                            resp = file_channel->send_request(upload);
+                            if (text_protocol) {
+                                // Text servers only take the whole file in one message
+                                ifstream whole(filename);
+                                string content((istreambuf_iterator<char>(whole)), {});
+                                Response resp = file_channel->send_request(Request(UPLOAD_FILE, current_user, 0, filename, content));
+                                uploaded = resp.success;
+                                error = resp.message;
+                            } else {
+                                uploaded = upload_chunked(*file_channel, current_user, filename, upload_flags, error);
+                            }
                         } catch (const exception& e) {
                             cout << "File upload failed: " << e.what() << endl;
                             return false;
                         }
                         
-                        if (resp.success) {
+                        if (uploaded) {
                             cout << "File upload successful\n";
                             
                             // Log the file upload
-                            if (logging_channel) {
-                                Request audit(UPLOAD_FILE, current_user, 0, filename);
-                                Response log_resp = logging_channel->send_request(audit);
-                                if (!log_resp.success) {
-                                    cout << "Warning: Failed to log file upload" << endl;
-                                }
-                            } else {
-                                cout << "Warning: Not connected to logging server" << endl;
-                            }
+                            send_audit(Request(UPLOAD_FILE, current_user, 0, filename), audit_queue, logging_channel, "Failed to log file upload");
                             return true;
                         } else {
-                            cout << "File upload failed: " << resp.message << endl;
+                            cout << "File upload failed: " << error << endl;
                             return false;
                         }
                     };
@@ -502,39 +726,37 @@ int main(int argc, char* argv[]) {
                             return false;
                         }
                         
-                        Request download(DOWNLOAD_FILE, current_user, 0, filename);
-                        Response resp;
-                        
+                        bool downloaded;
+                        string error;
                         try {
-                            resp = file_channel->send_request(download);
+                            if (text_protocol) {
+                                Response resp = file_channel->send_request(Request(DOWNLOAD_FILE, current_user, 0, filename));
+                                downloaded = resp.success;
+                                error = resp.message;
+                                if (downloaded) {
+                                    ofstream outfile(filename);
+                                    if (!outfile) {
+                                        cout << "Error: Could not create output file\n";
+                                        return false;
+                                    }
+                                    outfile << resp.data;
+                                }
+                            } else {
+                                downloaded = download_chunked(*file_channel, current_user, filename, error);
+                            }
                         } catch (const exception& e) {
                             cout << "File download failed: " << e.what() << endl;
                             return false;
                         }
                         
-                        if (resp.success) {
-                            ofstream outfile(filename);
-                            if (!outfile) {
-                                cout << "Error: Could not create output file\n";
-                                return false;
-                            }
-                            outfile << resp.data;
-                            outfile.close();
+                        if (downloaded) {
                             cout << "File downloaded successfully\n";
                             
                             // Log the file download
-                            if (logging_channel) {
-                                Request audit(DOWNLOAD_FILE, current_user, 0, filename);
-                                Response log_resp = logging_channel->send_request(audit);
-                                if (!log_resp.success) {
-                                    cout << "Warning: Failed to log file download" << endl;
-                                }
-                            } else {
-                                cout << "Warning: Not connected to logging server" << endl;
-                            }
+                            send_audit(Request(DOWNLOAD_FILE, current_user, 0, filename), audit_queue, logging_channel, "Failed to log file download");
                             return true;
                         } else {
-                            cout << "File download failed: " << resp.message << endl;
+                            cout << "File download failed: " << error << endl;
                             return false;
                         }
                     };
@@ -566,6 +788,9 @@ int main(int argc, char* argv[]) {
                             return true;
                         }
                         
+                        // Keep the session's queued records ahead of its logout
+                        if (audit_queue) audit_queue->flush(2000);
+
                         Request logout(LOGOUT, current_user);
                         Response resp;
                         
@@ -596,7 +821,21 @@ int main(int argc, char* argv[]) {
                 }
                 
                 case 8: { 
-                    SignalHandling::print_server_status();
+                    cout << "\n=== Server Status ===\n";
+                    if (finance_cluster) {
+                        cout << "Finance: " << finance_cluster->shard_count() << " shards\n";
+                    } else {
+                        cout << "Finance (" << finance_host << ":" << finance_port << "): "
+                             << (finance_channel ? "connected" : "not connected") << "\n";
+                    }
+                    cout << "File (" << file_host << ":" << file_port << "): "
+                         << (file_channel ? "connected" : "not connected") << "\n";
+                    cout << "Logging (" << logging_host << ":" << logging_port << "): "
+                         << (logging_channel ? "connected" : "not connected") << "\n";
+                    cout << "====================\n";
+                    if (audit_queue) {
+                        cout << "Audit records awaiting acknowledgement: " << audit_queue->pending() << endl;
+                    }
                     break;
                 }
                 
@@ -606,22 +845,17 @@ int main(int argc, char* argv[]) {
                         break;
                     }
 
-                    int numThreads = 2;
-                    cout << "Input a number of threads to use: ";
-                    cin >> numThreads;
-                    clear_input();
-
                     auto interest_operation = [&]() {
-                        if (!finance_channel) {
+                        if (!finance_channel && !finance_cluster) {
                             cout << "Not connected to finance server!" << endl;
                             return false;
                         }
                         
-                        Request request(EARN_INTEREST, current_user, numThreads);
+                        Request request(EARN_INTEREST, current_user);
                         Response resp;
                         
                         try {
-                            resp = finance_channel->send_request(request);
+                            resp = send_finance(request);
                         } catch (const exception& e) {
                             cout << "Interest update failed: " << e.what() << endl;
                             return false;
@@ -633,22 +867,204 @@ int main(int argc, char* argv[]) {
                         } else {
                             cout << "Interest update successful!" << endl;
                                 
-                            if (logging_channel) {
-                                Response log_resp = logging_channel->send_request(request);
-                                if (!log_resp.success) {
-                                    cout << "Warning: Failed to log transaction" << endl;
-                                }
+                            if (!audited_by_server(resp)) send_audit(request, audit_queue, logging_channel, "Failed to log transaction");
+                            return true;
+                        }
+                    };
+
+                    // Block signals during transaction
+                    block_signals();
+
+                    retry_operation("interest update", interest_operation, max_retries);
+
+                    // Unblock signals after transaction
+                    unblock_signals();
+
+                    break;
+                }
+                
+                case 10: {  // Bulk Deposit/Withdraw/Transfer
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    // Collect the transactions, one per line
+                    vector<Request> txns;
+                    cout << "Enter transactions as 'd AMOUNT', 'w AMOUNT' or 't AMOUNT TO_ID', blank line to finish:\n";
+                    string line;
+                    while (getline(cin, line) && !line.empty()) {
+                        char kind;
+                        char amount_text[64];
+                        int to = -1;
+                        Money amount;
+                        int fields = sscanf(line.c_str(), " %c %63s %d", &kind, amount_text, &to);
+                        kind = tolower(kind);
+                        if (fields < 2 || (kind != 'd' && kind != 'w' && kind != 't') || (kind == 't' && (fields != 3 || to < 0))
+                            || !parse_money(amount_text, amount)) {
+                            cout << "Skipping invalid line: " << line << endl;
+                            continue;
+                        }
+                        if (kind == 't') txns.push_back(Request(TRANSFER, current_user, amount, "", to_string(to)));
+                        else txns.push_back(Request(kind == 'd' ? DEPOSIT : WITHDRAW, current_user, amount));
+                    }
+
+                    if (txns.empty()) {
+                        cout << "No transactions entered\n";
+                        break;
+                    }
+
+                    // Bulk operation: all transactions go out in one BATCH frame
+                    auto bulk_operation = [&]() {
+                        if (!finance_channel && !finance_cluster) {
+                            cout << "Not connected to finance server!" << endl;
+                            return false;
+                        }
+
+                        Request batch(BATCH, current_user, 0, "", Wire::encode_batch(txns));
+                        Response resp;
+
+                        try {
+                            resp = send_finance(batch);
+                        } catch (const exception& e) {
+                            cout << "Bulk transaction failed: " << e.what() << endl;
+                            return false;
+                        }
+
+                        vector<Response> results = Wire::decode_batch_responses(resp.data);
+                        vector<Request> audits;
+                        for (size_t i = 0; i < results.size() && i < txns.size(); i++) {
+                            const char* what = txns[i].type == DEPOSIT ? "Deposit" : txns[i].type == WITHDRAW ? "Withdrawal" : "Transfer";
+                            if (results[i].success) {
+                                cout << what << " of " << format_money(txns[i].amount) << " successful. New balance: " << format_money(results[i].balance) << endl;
+                                if (!audited_by_server(results[i])) audits.push_back(txns[i]);
                             } else {
-                                cout << "Warning: Not connected to logging server" << endl;
+                                cout << what << " of " << format_money(txns[i].amount) << " failed: " << results[i].message << endl;
                             }
+                        }
+                        cout << resp.message << endl;
+
+                        // Log the successful transactions in one frame as well; the
+                        // async sender batches them by itself
+                        if (audit_queue) {
+                            for (const Request& audit : audits) audit_queue->submit(audit);
+                        } else if (!audits.empty()) {
+                            send_audit(Request(BATCH, current_user, 0, "", Wire::encode_batch(audits)),
+                                       nullptr, logging_channel, "Failed to log transactions");
+                        }
+
+                        // A partially failed batch is not retried, it would repeat the successful ones
+                        return true;
+                    };
+
+                    // Block signals during transaction
+                    block_signals();
+
+                    retry_operation("bulk transaction", bulk_operation, max_retries);
+
+                    // Unblock signals after transaction
+                    unblock_signals();
+
+                    break;
+                }
+                
+                case 11: {  // View Audit History
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    int days = 0;
+                    cout << "Show how many days back (0 for all): ";
+                    cin >> days;
+                    clear_input();
+
+                    auto history_operation = [&]() {
+                        if (!logging_channel) {
+                            cout << "Not connected to logging server!" << endl;
+                            return false;
+                        }
+
+                        // Let queued records reach the server first
+                        if (audit_queue) audit_queue->flush(2000);
+
+                        string range;
+                        if (days > 0) range = to_string((long long)time(nullptr) - days * 86400LL);
+                        Request query(QUERY_LOG, current_user, 0, "", range);
+                        Response resp;
+
+                        try {
+                            resp = logging_channel->send_request(query);
+                        } catch (const exception& e) {
+                            cout << "History request failed: " << e.what() << endl;
+                            return false;
+                        }
+
+                        if (!resp.success) {
+                            cout << "History request failed: " << resp.message << endl;
+                            return true;
+                        }
+                        cout << resp.data << resp.message << endl;
+                        return true;
+                    };
+
+                    retry_operation("history query", history_operation, max_retries);
+                    break;
+                }
+
+                case 12: {  // Transfer
+                    if (current_user == -1) {
+                        cout << "Please login first!\n";
+                        break;
+                    }
+
+                    int to_user;
+                    cout << "Enter the account ID to transfer to: ";
+                    if (!(cin >> to_user) || to_user < 0) {
+                        clear_input();
+                        cout << "Invalid account ID\n";
+                        break;
+                    }
+                    clear_input();
+
+                    Money amount;
+                    cout << "Enter amount to transfer: ";
+                    if (!read_amount(amount)) {
+                        cout << "Invalid amount\n";
+                        break;
+                    }
+
+                    // One request moves the money out of one account and into the other
+                    auto transfer_operation = [&]() {
+                        if (!finance_channel && !finance_cluster) {
+                            cout << "Not connected to finance server!" << endl;
+                            return false;
+                        }
+
+                        Request txn(TRANSFER, current_user, amount, "", to_string(to_user));
+                        Response resp;
+
+                        try {
+                            resp = send_finance(txn);
+                        } catch (const exception& e) {
+                            cout << "Transfer failed: " << e.what() << endl;
+                            return false;
+                        }
+
+                        if (resp.success) {
+                            cout << "Transfer successful. New balance: " << format_money(resp.balance) << endl;
+                            if (!audited_by_server(resp)) send_audit(txn, audit_queue, logging_channel, "Failed to log transaction");
                             return true;
+                        } else {
+                            cout << "Transfer failed: " << resp.message << endl;
+                            return false;
                         }
                     };
 
                     // Block signals during transaction
                     block_signals();
 
-                    retry_operation("interest update", interest_operation, max_retries);
+                    retry_operation("transfer", transfer_operation, max_retries);
 
                     // Unblock signals after transaction
                     unblock_signals();
@@ -674,6 +1090,15 @@ int main(int argc, char* argv[]) {
         log_signal_event("Normal exit requested");
     }
 
+    // Deliver queued audit records before leaving
+    if (audit_queue) {
+        size_t unsent = audit_queue->close(5000);
+        if (unsent > 0) {
+            cerr << "Warning: " << unsent << " audit records could not be delivered" << endl;
+        }
+        delete audit_queue;
+    }
+    
     // Send QUIT to all connected servers
     cout << "Sending shutdown signals to connected servers..." << endl;
     
@@ -706,7 +1131,8 @@ int main(int argc, char* argv[]) {
         }
     }
     
-    // Clean up resources
+    // Clean up resources; the shards' pools say QUIT as they close
+    delete finance_cluster;
     delete finance_channel;
     delete logging_channel;
     delete file_channel;
@@ -1,31 +1,154 @@
 #include "common.h"
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+
+FileBody::~FileBody() {
+    if (fd >= 0) close(fd);
+}
+
+int FileBody::descriptor() {
+    if (fd < 0 && !path.empty()) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd;
+}
+
+bool FileBody::read(char* out) {
+    if (contents) {
+        if (offset + length > contents->size()) return false;
+        memcpy(out, contents->data() + offset, length);
+        return true;
+    }
+
+    int in = descriptor();
+    if (in < 0) return false;
+    uint64_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(in, out + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+const char* request_type_name(RequestType type) {
+    static const char* const names[NUM_REQUEST_TYPES] = {
+        "QUIT", "DEPOSIT", "WITHDRAW", "BALANCE", "UPLOAD_FILE", "DOWNLOAD_FILE", "LOGIN", "LOGOUT",
+        "EARN_INTEREST", "BATCH", "QUERY_LOG", "UPLOAD_CHUNK", "UPLOAD_COMMIT", "DOWNLOAD_CHUNK", "STATS",
+        "TRANSFER"
+    };
+    if (type < 0 || type >= NUM_REQUEST_TYPES) return "UNKNOWN";
+    return names[type];
+}
 
 Request Request::parseRequest(const std::string& buffer) {
-    std::vector<std::string> parts;
-    size_t pos = 0;
-    std::string str = buffer;
-    const std::string delimiter = "|";
-    
-    while ((pos = str.find(delimiter)) != std::string::npos) {
-        parts.push_back(str.substr(0, pos));
-        str.erase(0, pos + delimiter.length());
-    }
-    parts.push_back(str);
-
-    if (parts.size() < 5) {
-        return Request(QUIT); // Return a default QUIT request if parsing fails
+    // Only the first four fields are delimited; DATA is everything after the
+    // fourth '|' so file contents containing '|' survive intact. Fields are
+    // cut straight out of buffer: only the filename and data are copied.
+    size_t ends[4];
+    size_t start = 0;
+    const char delimiter = '|';
+
+    for (size_t i = 0; i < 4; i++) {
+        ends[i] = buffer.find(delimiter, start);
+        if (ends[i] == std::string::npos) {
+            return Request(QUIT); // Return a default QUIT request if parsing fails
+        }
+        start = ends[i] + 1;
     }
 
-    int type = std::stoi(parts[0]);
+    int type = std::stoi(buffer.substr(0, ends[0]));
+
+    if (type < 0 || type >= NUM_REQUEST_TYPES) {
+        return Request(QUIT); // Return a default QUIT request if parsing fails
+    }
 
-    if (type < 0 || type > 8) {
+    int user_id = std::stoi(buffer.substr(ends[0] + 1, ends[1] - ends[0] - 1));
+    Money amount;
+    if (!parse_money(buffer.substr(ends[1] + 1, ends[2] - ends[1] - 1), amount)) {
         return Request(QUIT); // Return a default QUIT request if parsing fails
     }
-    
-    int user_id = std::stoi(parts[1]);
-    double amount = std::stod(parts[2]);
-    
-    return Request(static_cast<RequestType>(type), user_id, amount, parts[3], parts[4]);
-}
\ No newline at end of file
+
+    return Request(static_cast<RequestType>(type), user_id, amount,
+                   buffer.substr(ends[2] + 1, ends[3] - ends[2] - 1), buffer.substr(ends[3] + 1));
+}
+
+bool Request::transfer_destination(int& to) const {
+    if (data.empty() || data.size() > 10) return false;
+    int64_t id = 0;
+    for (char c : data) {
+        if (c < '0' || c > '9') return false;
+        id = id * 10 + (c - '0');
+    }
+    if (id > INT_MAX) return false;
+    to = (int)id;
+    return true;
+}
+
+bool parse_money(const std::string& text, Money& out) {
+    const char* p = text.c_str();
+    bool negative = false;
+    if (*p == '-' || *p == '+') negative = (*p++ == '-');
+
+    // Plain decimal: exact
+    uint64_t units = 0;
+    int digits = 0;
+    while (*p >= '0' && *p <= '9') {
+        if (units > (uint64_t)(INT64_MAX / MONEY_SCALE) / 10) return false;
+        units = units * 10 + (*p++ - '0');
+        digits++;
+    }
+    int64_t micros = 0;
+    int frac_digits = 0;
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9' && frac_digits < 6) {
+            micros = micros * 10 + (*p++ - '0');
+            frac_digits++;
+            digits++;
+        }
+    }
+
+    if (*p == '\0' && digits > 0) {
+        while (frac_digits++ < 6) micros *= 10;
+        if (units > (uint64_t)(INT64_MAX / MONEY_SCALE)) return false;
+        if (units == (uint64_t)(INT64_MAX / MONEY_SCALE) && micros > INT64_MAX % MONEY_SCALE) return false;
+        int64_t value = (int64_t)units * MONEY_SCALE + micros;
+        out = negative ? -value : value;
+        return true;
+    }
+
+    // Long fractions or exponent notation: round through double
+    char* end;
+    double v = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || *end != '\0' || !std::isfinite(v)) return false;
+    double scaled = std::round(v * MONEY_SCALE);
+    if (std::fabs(scaled) >= 9.2e18) return false;
+    out = (Money)scaled;
+    return true;
+}
+
+std::string format_money(Money amount) {
+    uint64_t magnitude = amount < 0 ? -(uint64_t)amount : (uint64_t)amount;
+    std::string text = (amount < 0 ? "-" : "") + std::to_string(magnitude / MONEY_SCALE);
+
+    uint64_t micros = magnitude % MONEY_SCALE;
+    if (micros != 0) {
+        char frac[8];
+        int len = 6;
+        for (int i = 5; i >= 0; i--) {
+            frac[i] = '0' + micros % 10;
+            micros /= 10;
+        }
+        while (frac[len - 1] == '0') len--;
+        text.push_back('.');
+        text.append(frac, len);
+    }
+    return text;
+}
@@ -3,6 +3,28 @@
 
 #include <string>
 #include <chrono>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+// Fixed-point money: a signed 64-bit count of micro-units (1e-6 of a
+// currency unit). Used for every amount and balance, on the wire and in the
+// account store, so arithmetic is exact and deterministic.
+typedef int64_t Money;
+const Money MONEY_SCALE = 1000000;
+
+// Whole currency units to Money, e.g. money_from_units(5) is 5.000000
+inline Money money_from_units(int64_t units) { return units * MONEY_SCALE; }
+
+// Decimal text such as "-12.34" to Money. Accepts at most 6 fractional
+// digits exactly; longer fractions and exponent forms (as sent by old text
+// clients) are rounded to the nearest micro-unit. Returns false on garbage
+// or overflow.
+bool parse_money(const std::string& text, Money& out);
+
+// Money to the shortest exact decimal text, e.g. 12340000 -> "12.34"
+std::string format_money(Money amount);
 
 enum RequestType {
     QUIT,
@@ -13,33 +35,108 @@ enum RequestType {
     DOWNLOAD_FILE,
     LOGIN,
     LOGOUT,
-    EARN_INTEREST
+    EARN_INTEREST,
+    BATCH,          // data carries encoded sub-requests, see wire.h
+    QUERY_LOG,      // data is "FROM TO" in Unix seconds (optional); logging server only
+    UPLOAD_CHUNK,   // data is written at offset into a temporary file
+    UPLOAD_COMMIT,  // offset is the total size; moves the temporary file into place
+    DOWNLOAD_CHUNK, // returns up to Wire::FILE_CHUNK_SIZE bytes from offset; balance is the file's version token
+    STATS,          // data returns the server's metrics, see server_metrics.h
+    TRANSFER,       // moves amount from user_id to the account whose decimal ID is data
+    NUM_REQUEST_TYPES  // not a request type, keep last
+};
+
+// Upper-case name of a request type, e.g. "DEPOSIT"; "UNKNOWN" if out of range
+const char* request_type_name(RequestType type);
+
+// Request::flags bits
+enum RequestFlags {
+    DURABLE = 1 << 0  // UPLOAD_FILE, UPLOAD_COMMIT: the file is on disk before the reply
 };
 
 struct Request {
     RequestType type;
     int user_id;
-    double amount;
+    Money amount;
     std::string filename;
     std::string data;
+    uint32_t request_id; // echoed in the response, used to match pipelined replies
+    uint64_t offset;     // chunked file transfers: position of data in the file
+    uint32_t flags;      // RequestFlags bits; binary encoding only
 
-    Request(RequestType t, int uid = 0, double amt = 0.0, 
+    Request(RequestType t, int uid = 0, Money amt = 0, 
             std::string fname = "", std::string d = "") : 
             type(t), user_id(uid), amount(amt), 
-            filename(fname), data(d) {}
+            filename(std::move(fname)), data(std::move(d)), request_id(0), offset(0), flags(0) {}
 
     static Request parseRequest(const std::string& buffer);
+
+    // Destination account of a TRANSFER; false unless data is a plain decimal ID
+    bool transfer_destination(int& to) const;
+};
+
+// Response payload taken straight from an open file. Servers send it with
+// sendfile() in place of Response::data; the descriptor is closed when the
+// last reference goes away. A body can instead point into a shared in-memory
+// copy of the file (fd is -1), which is sent without copying it either, or
+// name a file that is only opened once sending reaches it, so a response
+// made of many files does not hold a descriptor for each.
+struct FileBody {
+    int fd;
+    std::shared_ptr<const std::string> contents;
+    std::string path;
+    uint64_t offset;
+    uint64_t length;
+
+    FileBody(int _fd, uint64_t _offset, uint64_t _length) : fd(_fd), offset(_offset), length(_length) {}
+    FileBody(const std::shared_ptr<const std::string>& _contents, uint64_t _offset, uint64_t _length)
+        : fd(-1), contents(_contents), offset(_offset), length(_length) {}
+    FileBody(const std::string& _path, uint64_t _offset, uint64_t _length)
+        : fd(-1), path(_path), offset(_offset), length(_length) {}
+    ~FileBody();
+
+    // The open descriptor, opening path first if needed; -1 on failure
+    int descriptor();
+
+    // Copies the body's length bytes to out; false if the file is short
+    bool read(char* out);
+
+    FileBody(const FileBody&) = delete;
+    FileBody& operator=(const FileBody&) = delete;
+};
+
+// Response::flags bits
+enum ResponseFlags {
+    AUDITED = 1 << 0, // the server handed the audit record to its in-process logging service
+    BUSY = 1 << 1     // refused by admission control without being run; safe to retry
 };
 
 struct Response {
     bool success;
-    double balance;
+    Money balance;
     std::string data;
     std::string message;
+    uint32_t request_id;
+    uint64_t offset;     // chunked file transfers: file size, or bytes stored so far
+    uint8_t flags;       // ResponseFlags bits; binary encoding only
+    std::vector<std::shared_ptr<FileBody> > file_bodies; // if any, sent in order as the data field
 
-    Response(bool s = false, double b = 0.0, 
+    Response(bool s = false, Money b = 0, 
             std::string d = "", std::string m = "") :
-            success(s), balance(b), data(d), message(m) {}
+            success(s), balance(b), data(std::move(d)), message(std::move(m)), request_id(0), offset(0), flags(0) {}
+
+    // Back to a default Response, but the strings keep their buffers, so
+    // filling in a reused Response does not allocate
+    void reset() {
+        success = false;
+        balance = 0;
+        data.clear();
+        message.clear();
+        request_id = 0;
+        offset = 0;
+        flags = 0;
+        file_bodies.clear();
+    }
 };
 
 #endif
\ No newline at end of file
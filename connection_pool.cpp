@@ -0,0 +1,163 @@
+#include "connection_pool.h"
+#include <stdexcept>
+#include <chrono>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace {
+    // How long close() waits for each server to acknowledge QUIT
+    const int QUIT_TIMEOUT_MS = 1000;
+}
+
+ConnectionPool::ConnectionPool(const string& _host, int _port, size_t count, Policy _policy, int _request_timeout_ms)
+    : host(_host), port(_port), policy(_policy), request_timeout_ms(_request_timeout_ms), cursor(0), closed(false) {
+    if (count == 0) count = 1;
+    try {
+        if (request_timeout_ms > 0) {
+            timers.reset(new TimerWheel);
+            timers->start();
+        }
+        for (size_t i = 0; i < count; i++) {
+            connections.push_back(unique_ptr<Connection>(new Connection));
+            lock_guard<mutex> lock(connections.back()->mutex);
+            connect_locked(*connections.back());
+        }
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+ConnectionPool::~ConnectionPool() {
+    close();
+}
+
+// Replaces a failed connection; the old reader has already finished
+void ConnectionPool::connect_locked(Connection& conn) {
+    if (conn.reader.joinable()) conn.reader.join();
+    conn.channel.reset(new NetworkRequestChannel(host, port, NetworkRequestChannel::CLIENT_SIDE));
+    conn.broken = false;
+    conn.reader = thread(&ConnectionPool::reader_loop, this, &conn);
+}
+
+ConnectionPool::Connection& ConnectionPool::pick() {
+    size_t start = cursor++ % connections.size();
+    if (policy == ROUND_ROBIN) return *connections[start];
+
+    size_t best = start;
+    for (size_t i = 1; i < connections.size(); i++) {
+        size_t index = (start + i) % connections.size();
+        if (connections[index]->in_flight.load() < connections[best]->in_flight.load()) best = index;
+    }
+    return *connections[best];
+}
+
+future<Response> ConnectionPool::submit(const Request& req) {
+    Connection& conn = pick();
+    lock_guard<mutex> lock(conn.mutex);
+    if (closed) {
+        throw runtime_error("connection pool closed!");
+    }
+    if (conn.broken) connect_locked(conn);
+
+    uint32_t id = conn.next_id++;
+    Pending& pending = conn.pending[id];
+    future<Response> reply = pending.reply.get_future();
+    conn.in_flight++;
+    if (timers) {
+        Connection* target = &conn;
+        pending.timer = timers->schedule(request_timeout_ms, [this, target, id](TimerWheel::TimerId) {
+            expire_request(target, id);
+        });
+    }
+    try {
+        conn.channel->send_tagged(req, id);
+    } catch (...) {
+        if (pending.timer) timers->cancel(pending.timer);
+        conn.pending.erase(id);
+        conn.in_flight--;
+        throw;
+    }
+    return reply;
+}
+
+Response ConnectionPool::send_request(const Request& req) {
+    return submit(req).get();
+}
+
+size_t ConnectionPool::in_flight() const {
+    size_t total = 0;
+    for (const unique_ptr<Connection>& conn : connections) total += conn->in_flight.load();
+    return total;
+}
+
+void ConnectionPool::reader_loop(Connection* conn) {
+    // The channel is only replaced after this thread is joined
+    NetworkRequestChannel* channel = conn->channel.get();
+    try {
+        while (true) {
+            Response resp = channel->receive_tagged();
+            lock_guard<mutex> lock(conn->mutex);
+            map<uint32_t, Pending>::iterator it = conn->pending.find(resp.request_id);
+            if (it == conn->pending.end()) continue; // timed out already
+            if (it->second.timer) timers->cancel(it->second.timer);
+            it->second.reply.set_value(resp);
+            conn->pending.erase(it);
+            conn->in_flight--;
+        }
+    } catch (const exception& e) {
+        lock_guard<mutex> lock(conn->mutex);
+        conn->broken = true;
+        for (auto& entry : conn->pending) {
+            if (entry.second.timer) timers->cancel(entry.second.timer);
+            entry.second.reply.set_exception(make_exception_ptr(runtime_error(string("connection lost: ") + e.what())));
+        }
+        conn->pending.clear();
+        conn->in_flight = 0;
+    }
+}
+
+// Fails a request whose deadline passed (timer thread)
+void ConnectionPool::expire_request(Connection* conn, uint32_t id) {
+    lock_guard<mutex> lock(conn->mutex);
+    map<uint32_t, Pending>::iterator it = conn->pending.find(id);
+    if (it == conn->pending.end()) return;
+    it->second.reply.set_exception(make_exception_ptr(runtime_error(
+        "no reply within " + to_string(request_timeout_ms) + " ms!")));
+    conn->pending.erase(it);
+    conn->in_flight--;
+}
+
+void ConnectionPool::close() {
+    // Later submits fail; taking each lock below waits out those in progress
+    closed = true;
+
+    for (const unique_ptr<Connection>& conn : connections) {
+        future<Response> reply;
+        {
+            lock_guard<mutex> lock(conn->mutex);
+            if (!conn->broken) {
+                uint32_t id = conn->next_id++;
+                reply = conn->pending[id].reply.get_future();
+                conn->in_flight++;
+                try {
+                    conn->channel->send_tagged(Request(QUIT), id);
+                } catch (const exception&) {
+                    conn->pending.erase(id);
+                    conn->in_flight--;
+                    reply = future<Response>();
+                }
+            }
+        }
+        if (reply.valid()) reply.wait_for(chrono::milliseconds(QUIT_TIMEOUT_MS));
+
+        // Wakes the reader if the server did not close the connection
+        {
+            lock_guard<mutex> lock(conn->mutex);
+            if (conn->channel) shutdown(conn->channel->get_socket_fd(), SHUT_RDWR);
+        }
+        if (conn->reader.joinable()) conn->reader.join();
+        conn->channel.reset();
+    }
+}
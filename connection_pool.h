@@ -0,0 +1,103 @@
+#ifndef _CONNECTION_POOL_H_
+#define _CONNECTION_POOL_H_
+
+#include "common.h"
+#include "network_channel.h"
+#include "timer_wheel.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * ConnectionPool class
+ *
+ * A fixed set of persistent binary connections to one server, shared by
+ * any number of threads. submit() picks a connection, sends the request
+ * and returns a future for its response without waiting; a reader thread
+ * per connection fulfils the futures as replies arrive, so every
+ * connection carries many requests in flight.
+ *
+ * ROUND_ROBIN spreads requests evenly. LEAST_LOADED picks the connection
+ * with the fewest requests outstanding, which keeps a slow request (a
+ * large download, an interest run) from holding up the requests queued
+ * behind it on the same connection.
+ *
+ * When a connection fails, its outstanding futures receive the error and
+ * the next request routed to it reconnects first. Requests are never
+ * resent by the pool: whether a failed deposit happened is for the caller
+ * to decide.
+ *
+ * With a request timeout, every request gets its own deadline on a
+ * TimerWheel; a future whose reply has not arrived by then throws, and
+ * the reply is dropped if it comes later. The connection stays up for the
+ * other requests in flight on it.
+ */
+class ConnectionPool {
+public:
+    enum Policy { ROUND_ROBIN, LEAST_LOADED };
+
+    // Connects all connections up front; throws runtime_error if the server
+    // cannot be reached. request_timeout_ms 0 waits for replies forever.
+    ConnectionPool(const std::string& host, int port, size_t connections, Policy policy = LEAST_LOADED,
+                   int request_timeout_ms = 0);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Sends req on one of the connections; the future throws if the
+    // connection fails or the deadline passes before the reply arrives
+    std::future<Response> submit(const Request& req);
+
+    // submit() and wait
+    Response send_request(const Request& req);
+
+    size_t size() const { return connections.size(); }
+    size_t in_flight() const;
+
+    // Says QUIT on every connection and stops the readers
+    void close();
+
+private:
+    struct Pending {
+        std::promise<Response> reply;
+        TimerWheel::TimerId timer; // 0 without a deadline
+
+        Pending() : timer(0) {}
+    };
+
+    struct Connection {
+        std::mutex mutex; // guards everything below, and sending on channel
+        std::unique_ptr<NetworkRequestChannel> channel;
+        std::map<uint32_t, Pending> pending;
+        uint32_t next_id;
+        bool broken;
+        std::thread reader;
+        std::atomic<size_t> in_flight;
+
+        Connection() : next_id(1), broken(true), in_flight(0) {}
+    };
+
+    Connection& pick();
+    void connect_locked(Connection& conn);
+    void reader_loop(Connection* conn);
+    void expire_request(Connection* conn, uint32_t id);
+
+    std::string host;
+    int port;
+    Policy policy;
+    int request_timeout_ms;
+    std::vector<std::unique_ptr<Connection> > connections;
+    std::unique_ptr<TimerWheel> timers; // with a request timeout; stopped before connections go
+    std::atomic<size_t> cursor;
+    std::atomic<bool> closed;
+};
+
+#endif
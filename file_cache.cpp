@@ -0,0 +1,110 @@
+#include "file_cache.h"
+#include <algorithm>
+
+using namespace std;
+
+FileCache::FileCache(size_t _capacity_bytes, size_t _max_file_bytes)
+    : capacity_bytes(_capacity_bytes), max_file_bytes(min(_max_file_bytes, _capacity_bytes)),
+      hand(0), bytes(0), hits(0), misses(0), evictions(0), invalidations(0) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+FileCache::~FileCache() {
+    pthread_rwlock_destroy(&lock);
+}
+
+bool FileCache::matches(const Entry& entry, const struct stat& st) {
+    return entry.inode == st.st_ino && entry.size == st.st_size
+        && entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+shared_ptr<const string> FileCache::lookup(const string& name, const struct stat& st) {
+    shared_ptr<const string> contents;
+    pthread_rwlock_rdlock(&lock);
+    unordered_map<string, size_t>::const_iterator it = slots.find(name);
+    if (it != slots.end()) {
+        Entry& entry = *ring[it->second];
+        if (matches(entry, st)) {
+            entry.referenced.store(true, memory_order_relaxed);
+            contents = entry.contents;
+        }
+    }
+    pthread_rwlock_unlock(&lock);
+
+    if (contents) hits++;
+    else misses++;
+    return contents;
+}
+
+void FileCache::insert(const string& name, const struct stat& st, const shared_ptr<const string>& contents) {
+    if (contents->size() > max_file_bytes) return;
+
+    pthread_rwlock_wrlock(&lock);
+
+    // A newer version replaces the old entry
+    unordered_map<string, size_t>::iterator it = slots.find(name);
+    if (it != slots.end()) remove_locked(it->second);
+
+    while (!ring.empty() && bytes + contents->size() > capacity_bytes) {
+        if (hand >= ring.size()) hand = 0;
+        Entry& entry = *ring[hand];
+        if (entry.referenced.load(memory_order_relaxed)) {
+            entry.referenced.store(false, memory_order_relaxed);
+            hand++;
+        } else {
+            remove_locked(hand);
+            evictions++;
+        }
+    }
+
+    unique_ptr<Entry> entry(new Entry);
+    entry->name = name;
+    entry->contents = contents;
+    entry->inode = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->referenced.store(false, memory_order_relaxed);
+    slots[name] = ring.size();
+    ring.push_back(std::move(entry));
+    bytes += contents->size();
+
+    pthread_rwlock_unlock(&lock);
+}
+
+void FileCache::invalidate(const string& name) {
+    pthread_rwlock_wrlock(&lock);
+    unordered_map<string, size_t>::iterator it = slots.find(name);
+    if (it != slots.end()) {
+        remove_locked(it->second);
+        invalidations++;
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+// Moves the last entry into the freed slot; caller holds the lock exclusively
+void FileCache::remove_locked(size_t slot) {
+    bytes -= ring[slot]->contents->size();
+    slots.erase(ring[slot]->name);
+    if (slot != ring.size() - 1) {
+        ring[slot] = std::move(ring.back());
+        slots[ring[slot]->name] = slot;
+    }
+    ring.pop_back();
+}
+
+FileCache::Stats FileCache::stats() {
+    Stats s;
+    s.hits = hits.load();
+    s.misses = misses.load();
+    s.evictions = evictions.load();
+    s.invalidations = invalidations.load();
+    pthread_rwlock_rdlock(&lock);
+    s.entries = ring.size();
+    s.bytes = bytes;
+    pthread_rwlock_unlock(&lock);
+    return s;
+}
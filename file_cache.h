@@ -0,0 +1,92 @@
+#ifndef _FILE_CACHE_H_
+#define _FILE_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*
+ * FileCache class
+ *
+ * Bounded in-memory copy of the file server's hot files, shared by all
+ * worker threads. Entries are keyed by filename and remember the inode,
+ * size and modification time they were read at; a lookup passes the file's
+ * current stat() and stale entries count as misses, so files changed
+ * behind the server's back are never served from memory.
+ *
+ * Lookups take a shared lock and only set the entry's reference bit, so
+ * concurrent downloads of one hot file do not serialize. Inserts take the
+ * lock exclusively and evict with the CLOCK algorithm: the hand clears
+ * reference bits until it finds an entry not used since its last pass.
+ * Contents are handed out as shared pointers, so an evicted entry stays
+ * valid for responses still being sent.
+ *
+ * Files larger than max_file_bytes are not cached; they are better served
+ * from the page cache by sendfile().
+ */
+class FileCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;
+        size_t entries;
+        size_t bytes;
+    };
+
+    FileCache(size_t capacity_bytes, size_t max_file_bytes);
+    ~FileCache();
+
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    size_t max_file_size() const { return max_file_bytes; }
+
+    // Contents of name if cached and still matching st, otherwise null
+    std::shared_ptr<const std::string> lookup(const std::string& name, const struct stat& st);
+
+    // Caches contents read from the file described by st
+    void insert(const std::string& name, const struct stat& st,
+                const std::shared_ptr<const std::string>& contents);
+
+    // Drops name; called when it is uploaded again
+    void invalidate(const std::string& name);
+
+    Stats stats();
+
+private:
+    struct Entry {
+        std::string name;
+        std::shared_ptr<const std::string> contents;
+        ino_t inode;
+        off_t size;
+        struct timespec mtime;
+        std::atomic<bool> referenced;
+    };
+
+    static bool matches(const Entry& entry, const struct stat& st);
+    void remove_locked(size_t slot);
+
+    size_t capacity_bytes;
+    size_t max_file_bytes;
+
+    pthread_rwlock_t lock;                        // shared: lookups, exclusive: changes
+    std::vector<std::unique_ptr<Entry> > ring;    // CLOCK order
+    std::unordered_map<std::string, size_t> slots; // name -> position in ring
+    size_t hand;
+    size_t bytes;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+    std::atomic<uint64_t> invalidations;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "file_service.h"
+#include "wire.h"
+#include "signals.h"
+#include <iostream>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+    // A name must stay a plain file in storage: no directories, and no dot
+    // files, which would reach .chunks, .manifests or .pending
+    bool name_valid(const string& filename, Response& resp) {
+        if (!filename.empty() && filename[0] != '.' && filename.find('/') == string::npos
+            && filename.find('\0') == string::npos) {
+            return true;
+        }
+        resp.success = false;
+        resp.message = "Invalid file name";
+        return false;
+    }
+
+    // Checks the filename's extension against the allowlist (empty allows all)
+    bool extension_allowed(const string& filename, const vector<string>& allowed_extensions, Response& resp) {
+        if (allowed_extensions.empty()) return true;
+
+        size_t dot_pos = filename.find_last_of(".");
+        if (dot_pos == string::npos) {
+            resp.success = false;
+            resp.message = "File has no extension";
+            return false;
+        }
+
+        string ext = filename.substr(dot_pos);
+        for (const string& allowed_ext : allowed_extensions) {
+            if (ext == allowed_ext) return true;
+        }
+        resp.success = false;
+        resp.message = "File extension not allowed";
+        return false;
+    }
+
+    // Stores one chunk of an upload; offset in the reply is the bytes stored so far
+    Response upload_chunk(const Request& r, FileStorage& storage) {
+        Response resp;
+        if (!storage.write_chunk(r.filename, r.user_id, r.offset, r.data, resp.message)) {
+            return resp;
+        }
+
+        resp.success = true;
+        resp.offset = r.offset + r.data.size();
+        resp.message = "Chunk stored";
+        return resp;
+    }
+
+    // Replaces the file with a complete upload in one step; a DURABLE commit
+    // returns once the file is on disk
+    Response upload_commit(const Request& r, FileStorage& storage) {
+        Response resp;
+        if (!storage.commit(r.filename, r.user_id, r.offset, (r.flags & DURABLE) != 0, resp.message)) {
+            return resp;
+        }
+
+        resp.success = true;
+        resp.offset = r.offset;
+        resp.message = "File uploaded successfully";
+        return resp;
+    }
+
+    // Reads file bodies into one buffer of size bytes; null if they fall short
+    shared_ptr<const string> read_contents(const vector<shared_ptr<FileBody> >& bodies, uint64_t size) {
+        shared_ptr<string> contents = make_shared<string>(size, '\0');
+        uint64_t done = 0;
+        for (const shared_ptr<FileBody>& body : bodies) {
+            if (done + body->length > size || !body->read(&(*contents)[done])) return nullptr;
+            done += body->length;
+        }
+        if (done != size) return nullptr;
+        return contents;
+    }
+
+    // Sets resp.file_bodies to up to max_length bytes of the file from offset and
+    // resp.offset to the file's size. Small files come from the cache (read
+    // into it on a miss); others are sent from storage with sendfile().
+    bool open_file_body(const string& filename, uint64_t offset, uint64_t max_length,
+                        FileStorage& storage, FileCache* cache, Response& resp) {
+        struct stat st;
+        if (!storage.stat(filename, st)) {
+            resp.message = "File not found";
+            return false;
+        }
+
+        shared_ptr<const string> contents;
+        bool cacheable = cache && (uint64_t)st.st_size <= cache->max_file_size();
+        if (cacheable) contents = cache->lookup(filename, st);
+
+        if (!contents && cacheable) {
+            vector<shared_ptr<FileBody> > whole;
+            uint64_t size;
+            if (storage.read(filename, 0, UINT64_MAX, whole, size, resp.message) && size == (uint64_t)st.st_size) {
+                contents = read_contents(whole, size);
+                if (contents) cache->insert(filename, st, contents);
+            }
+        }
+
+        if (!contents) {
+            return storage.read(filename, offset, max_length, resp.file_bodies, resp.offset, resp.message);
+        }
+
+        if (contents->size() < offset) {
+            resp.message = "Offset past end of file";
+            return false;
+        }
+        uint64_t len = min(max_length, (uint64_t)contents->size() - offset);
+        resp.file_bodies.push_back(make_shared<FileBody>(contents, offset, len));
+        resp.offset = contents->size();
+        return true;
+    }
+
+    // Sends up to FILE_CHUNK_SIZE bytes from offset; offset in the reply is the
+    // file's size, so the client knows when it is done, and balance is the
+    // version token of the file the bytes came from, so it can tell if the
+    // file was replaced in between. The file is stat()ed on both sides of
+    // opening it, so the token matches the bytes.
+    Response download_chunk(const Request& r, FileStorage& storage, FileCache* cache) {
+        Response resp;
+        struct stat before, after;
+        if (!storage.stat(r.filename, before)) {
+            resp.message = "File not found";
+            return resp;
+        }
+        if (!open_file_body(r.filename, r.offset, Wire::FILE_CHUNK_SIZE, storage, cache, resp)) {
+            return resp;
+        }
+        if (!storage.stat(r.filename, after)
+            || FileStorage::version_token(after) != FileStorage::version_token(before)) {
+            resp.file_bodies.clear();
+            resp.message = "File changed during download";
+            return resp;
+        }
+        resp.success = true;
+        resp.balance = (Money)FileStorage::version_token(before);
+        resp.message = "Chunk downloaded";
+        return resp;
+    }
+}
+
+FileService::Options::Options()
+    : port(8001), thread_count(4), cache_mb(64), cache_file_mb(4), dedup(false), uncached_mb(0) {}
+
+FileService::FileService(const Options& options)
+    : allowed_extensions(options.allowed_extensions), dedup_storage(nullptr) {
+    // Create storage directory if it doesn't exist
+    if (mkdir("storage", 0755) != 0 && errno != EEXIST) {
+        throw runtime_error(string("Error creating storage directory: ") + strerror(errno));
+    }
+
+    // Shared by all workers; outlives the reactor and its pending responses
+    if (options.cache_mb > 0) {
+        cache.reset(new FileCache((size_t)options.cache_mb << 20, (size_t)options.cache_file_mb << 20));
+        cout << "Caching files up to " << options.cache_file_mb << " MB in " << options.cache_mb << " MB of memory" << endl;
+    }
+
+    if (options.dedup) {
+        dedup_storage = new DedupStorage("storage", (uint64_t)options.uncached_mb << 20);
+        storage.reset(dedup_storage);
+        cout << "Storing deduplicated chunks in storage/.chunks" << endl;
+    } else {
+        storage.reset(new FlatStorage("storage", (uint64_t)options.uncached_mb << 20));
+    }
+    if (options.uncached_mb > 0) {
+        cout << "Uploads of " << options.uncached_mb << " MB and more bypass the page cache" << endl;
+    }
+
+    // Print allowed extensions
+    if (allowed_extensions.empty()) {
+        cout << "All file extensions are allowed" << endl;
+    } else {
+        cout << "Allowed file extensions:";
+        for (const string& ext : allowed_extensions) {
+            cout << " " << ext;
+        }
+        cout << endl;
+    }
+}
+
+FileService::~FileService() {
+    if (cache) {
+        FileCache::Stats stats = cache->stats();
+        string summary = "File cache: " + to_string(stats.hits) + " hits, " + to_string(stats.misses) + " misses, "
+            + to_string(stats.evictions) + " evictions, " + to_string(stats.invalidations) + " invalidations, "
+            + to_string(stats.entries) + " files (" + to_string(stats.bytes) + " bytes) cached";
+        cout << summary << endl;
+        SignalHandling::log_signal_event(summary);
+    }
+
+    if (dedup_storage) {
+        DedupStorage::Stats stats = dedup_storage->stats();
+        string summary = "Dedup storage: " + to_string(stats.chunks_written) + " chunks (" + to_string(stats.bytes_written)
+            + " bytes) written, " + to_string(stats.chunks_reused) + " chunks (" + to_string(stats.bytes_reused)
+            + " bytes) already stored";
+        cout << summary << endl;
+        SignalHandling::log_signal_event(summary);
+    }
+}
+
+void FileService::add_gauges(ServerMetrics& metrics) {
+    FileCache* cache_ptr = cache.get();
+    if (cache_ptr) {
+        metrics.add_gauge("file_cache_hits_total", [cache_ptr]() { return cache_ptr->stats().hits; });
+        metrics.add_gauge("file_cache_misses_total", [cache_ptr]() { return cache_ptr->stats().misses; });
+        metrics.add_gauge("file_cache_bytes", [cache_ptr]() { return (uint64_t)cache_ptr->stats().bytes; });
+    }
+    DedupStorage* dedup = dedup_storage;
+    if (dedup) {
+        metrics.add_gauge("dedup_bytes_written_total", [dedup]() { return dedup->stats().bytes_written; });
+        metrics.add_gauge("dedup_bytes_reused_total", [dedup]() { return dedup->stats().bytes_reused; });
+    }
+}
+
+// Executes a single file request against the storage backend
+Response FileService::handle(const Request& r, const string& peer) {
+    if (r.type == BATCH) {
+        return Wire::execute_batch(r, [this, &peer](const Request& sub) {
+            return handle(sub, peer);
+        });
+    }
+
+    Response resp;
+    if ((r.type == UPLOAD_FILE || r.type == UPLOAD_CHUNK || r.type == UPLOAD_COMMIT
+         || r.type == DOWNLOAD_FILE || r.type == DOWNLOAD_CHUNK) && !name_valid(r.filename, resp)) {
+        return resp;
+    }
+    resp.success = true;
+    
+    if (r.type == UPLOAD_FILE) {
+        // Check file extension if extensions were provided
+        if (!extension_allowed(r.filename, allowed_extensions, resp)) {
+            return resp;
+        }
+        
+        resp.success = storage->write_file(r.filename, r.data, (r.flags & DURABLE) != 0, resp.message);
+        if (cache) cache->invalidate(r.filename);
+        if (resp.success) resp.message = "File uploaded successfully";
+    }
+    else if (r.type == UPLOAD_CHUNK || r.type == UPLOAD_COMMIT) {
+        if (!extension_allowed(r.filename, allowed_extensions, resp)) {
+            return resp;
+        }
+        if (r.type == UPLOAD_CHUNK) return upload_chunk(r, *storage);
+        Response committed = upload_commit(r, *storage);
+        if (committed.success && cache) cache->invalidate(r.filename);
+        return committed;
+    }
+    else if (r.type == DOWNLOAD_CHUNK) {
+        return download_chunk(r, *storage, cache.get());
+    }
+    else if (r.type == DOWNLOAD_FILE) {
+        // The reactor sends the body from the cache or with sendfile()
+        if (!open_file_body(r.filename, 0, UINT64_MAX, *storage, cache.get(), resp)) {
+            resp.success = false;
+        } else if (resp.offset > UINT32_MAX - 1024) {
+            resp.file_bodies.clear();
+            resp.success = false;
+            resp.message = "File too large for one message, use a chunked download";
+        } else {
+            resp.message = "File downloaded successfully";
+        }
+    }
+    else {
+        resp.success = false;
+        resp.message = "Unknown RequestType";
+    }
+
+    return resp;
+}
+
+void FileService::print_usage() {
+    cout << "Usage: ./file_server [-p PORT] [-t THREAD_COUNT] [-c MB] [-C MB] [-d] [-u MB] [ALLOWED_EXTENSIONS...]" << endl;
+    cout << "  -p, --port         Port number to listen on (default: 8001)" << endl;
+    cout << "  -t, --threads      Number of threads in the thread pool (default: 4)" << endl;
+    cout << "  -c, --cache-size   Memory for hot files in MB, 0 to disable (default: 64)" << endl;
+    cout << "  -C, --cache-file-limit Largest file cached, in MB (default: 4)" << endl;
+    cout << "  -d, --dedup        Store files as deduplicated, content-addressed chunks" << endl;
+    cout << "  -u, --uncached-uploads Write uploads from this many MB around the page cache (default: 0, off)" << endl;
+    Reactor::print_admission_usage();
+    cout << "  -h, --help         Show this help message" << endl;
+    cout << "  ALLOWED_EXTENSIONS List of allowed file extensions (e.g., .txt .pdf)" << endl;
+}
+
+int FileService::parse_options(int argc, char* argv[], Options& options) {
+    // Parse command line arguments
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"threads", required_argument, 0, 't'},
+        {"cache-size", required_argument, 0, 'c'},
+        {"cache-file-limit", required_argument, 0, 'C'},
+        {"dedup", no_argument, 0, 'd'},
+        {"uncached-uploads", required_argument, 0, 'u'},
+        {"backlog", required_argument, 0, 0},
+        {"max-frame", required_argument, 0, 0},
+        {"max-queue", required_argument, 0, 0},
+        {"max-delay", required_argument, 0, 0},
+        {"rate-limit", required_argument, 0, 0},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int option_index = 0;
+    int c;
+    
+    while ((c = getopt_long(argc, argv, "p:t:c:C:du:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p':
+                options.port = atoi(optarg);
+                break;
+            case 't':
+                options.thread_count = atoi(optarg);
+                break;
+            case 'c':
+                options.cache_mb = max(atol(optarg), 0L);
+                break;
+            case 'C':
+                options.cache_file_mb = max(atol(optarg), 0L);
+                break;
+            case 'd':
+                options.dedup = true;
+                break;
+            case 'u':
+                options.uncached_mb = max(atol(optarg), 0L);
+                break;
+            case 0:
+                Reactor::parse_admission_option(long_options[option_index].name, optarg, options.admission);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            case '?':
+                print_usage();
+                return 1;
+            default:
+                abort();
+        }
+    }
+    
+    // Collect allowed extensions from remaining arguments
+    for (int i = optind; i < argc; i++) {
+        options.allowed_extensions.push_back(argv[i]);
+    }
+
+    return -1;
+}
@@ -0,0 +1,66 @@
+#ifndef _FILE_SERVICE_H_
+#define _FILE_SERVICE_H_
+
+#include "common.h"
+#include "network_channel.h"
+#include "file_cache.h"
+#include "file_storage.h"
+#include "server_metrics.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+/*
+ * FileService class
+ *
+ * The file server's storage, cache and request handling, independent of
+ * how requests arrive: the file binary serves it on its own reactor, the
+ * bank binary next to the other services in one process.
+ *
+ * Files live in the storage/ directory under the working directory, flat
+ * or deduplicated; small ones are also kept in a FileCache. Responses may
+ * carry file bodies for the reactor to send, which stay valid after the
+ * service is destroyed. Safe to call from any number of threads.
+ */
+class FileService {
+public:
+    struct Options {
+        int port;
+        int thread_count;
+        long cache_mb;          // 0 disables the cache
+        long cache_file_mb;
+        bool dedup;
+        long uncached_mb;       // 0: every upload goes through the page cache
+        std::vector<std::string> allowed_extensions; // empty allows all
+        Reactor::Admission admission; // listen backlog and overload limits
+
+        Options();
+    };
+
+    static void print_usage();
+
+    // Parses the file server's command line; returns -1 to go on, or the
+    // exit status after printing the usage
+    static int parse_options(int argc, char* argv[], Options& options);
+
+    // Creates storage/ and the storage backend; throws runtime_error
+    explicit FileService(const Options& options);
+    // Prints the cache and dedup counters
+    ~FileService();
+
+    FileService(const FileService&) = delete;
+    FileService& operator=(const FileService&) = delete;
+
+    // Cache and dedup counters for the STATS report
+    void add_gauges(ServerMetrics& metrics);
+
+    Response handle(const Request& r, const std::string& peer);
+
+private:
+    std::vector<std::string> allowed_extensions;
+    std::unique_ptr<FileCache> cache;
+    std::unique_ptr<FileStorage> storage;
+    DedupStorage* dedup_storage;    // storage, if deduplicating
+};
+
+#endif
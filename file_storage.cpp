@@ -0,0 +1,449 @@
+#include "file_storage.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <openssl/evp.h>
+
+using namespace std;
+
+namespace {
+    // pwrite()s all of data, straight from the request buffer
+    bool write_at(int fd, const char* data, size_t len, uint64_t offset) {
+        off_t pos = offset;
+        while (len > 0) {
+            ssize_t n = pwrite(fd, data, len, pos);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= n;
+            pos += n;
+        }
+        return true;
+    }
+
+    // Above the uncached threshold, data is written in pieces of this size,
+    // each flushed and dropped from the page cache before the next
+    const size_t UNCACHED_PIECE = 8 << 20;
+
+    // Writes data at offset; uncached writes leave none of it in the page
+    // cache, so bulk uploads do not evict the files being downloaded
+    bool write_data(int fd, const char* data, size_t len, uint64_t offset, bool uncached) {
+        if (!uncached) return write_at(fd, data, len, offset);
+
+        for (size_t done = 0; done < len; done += UNCACHED_PIECE) {
+            size_t n = min(len - done, UNCACHED_PIECE);
+            if (!write_at(fd, data + done, n, offset + done)) return false;
+            if (sync_file_range(fd, offset + done, n, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                                | SYNC_FILE_RANGE_WAIT_AFTER) < 0) return false;
+            posix_fadvise(fd, offset + done, n, POSIX_FADV_DONTNEED);
+        }
+        return true;
+    }
+
+    // fsync()s a file or directory by name
+    bool sync_path(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool synced = fsync(fd) == 0;
+        close(fd);
+        return synced;
+    }
+
+    string parent_directory(const string& path) {
+        size_t slash = path.find_last_of('/');
+        return slash == string::npos ? "." : path.substr(0, slash);
+    }
+
+    // Writes data to a fresh file next to path and renames it over path, so
+    // readers see the old file or the new one, never a partial one. Durable
+    // writes sync the data before the rename and the directory after it.
+    bool replace_file(const string& path, const char* data, size_t len, bool durable, bool uncached) {
+        string temp = path + ".tmp-XXXXXX";
+        int fd = mkostemp(&temp[0], O_CLOEXEC);
+        if (fd < 0) return false;
+
+        bool written = fchmod(fd, 0644) == 0 && write_data(fd, data, len, 0, uncached)
+            && (!durable || fdatasync(fd) == 0);
+        close(fd);
+        if (!written || rename(temp.c_str(), path.c_str()) < 0) {
+            unlink(temp.c_str());
+            return false;
+        }
+        return !durable || sync_path(parent_directory(path));
+    }
+
+    string sha256_hex(const char* data, size_t len) {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len = 0;
+        if (!EVP_Digest(data, len, digest, &digest_len, EVP_sha256(), NULL)) {
+            throw runtime_error("sha256 failed!");
+        }
+
+        static const char hex[] = "0123456789abcdef";
+        string out(digest_len * 2, '0');
+        for (unsigned int i = 0; i < digest_len; i++) {
+            out[2 * i] = hex[digest[i] >> 4];
+            out[2 * i + 1] = hex[digest[i] & 0xf];
+        }
+        return out;
+    }
+
+    void make_directory(const string& path) {
+        if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw runtime_error("mkdir " + path + " failed!");
+        }
+    }
+
+    // Chunked uploads in progress, out of reach of any valid file name
+    const char* const PENDING_DIRECTORY = ".pending";
+
+    // Removes dir and everything in it, descending depth more levels
+    void remove_tree(const string& dir, int depth) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) return;
+        struct dirent* entry;
+        while ((entry = readdir(d)) != nullptr) {
+            string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+            string path = dir + "/" + name;
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                if (depth > 0) remove_tree(path, depth - 1);
+            } else {
+                unlink(path.c_str());
+            }
+        }
+        closedir(d);
+        rmdir(dir.c_str());
+    }
+
+    // Uploads a previous run left unfinished are dropped: their clients
+    // restart from offset 0 after the server goes away
+    string reset_pending(const string& root) {
+        string pending = root + "/" + PENDING_DIRECTORY;
+        remove_tree(pending, 1);
+        make_directory(pending);
+        return pending;
+    }
+
+    // root/.pending/<user>/<name>, creating the user's directory
+    string pending_file(const string& pending, const string& name, int user_id, bool create) {
+        string dir = pending + "/" + to_string(user_id);
+        if (create && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return "";
+        return dir + "/" + name;
+    }
+}
+
+bool FileStorage::uncached(uint64_t end) const {
+    return uncached_bytes > 0 && end >= uncached_bytes;
+}
+
+FlatStorage::FlatStorage(const string& _root, uint64_t _uncached_bytes)
+    : FileStorage(_uncached_bytes), root(_root), pending_root(reset_pending(root)) {}
+
+bool FlatStorage::write_file(const string& name, const string& data, bool durable, string& error) {
+    if (!replace_file(root + "/" + name, data.data(), data.size(), durable, uncached(data.size()))) {
+        error = "Failed to write file";
+        return false;
+    }
+    return true;
+}
+
+bool FlatStorage::write_chunk(const string& name, int user_id, uint64_t offset,
+                              const string& data, string& error) {
+    // One temporary file per user and file, so concurrent uploads never see
+    // each other's partial data
+    string temp = pending_file(pending_root, name, user_id, true);
+    int fd = temp.empty() ? -1 : open(temp.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        error = "Failed to create file";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < offset) {
+        close(fd);
+        error = "Upload chunk out of sequence";
+        return false;
+    }
+
+    bool written = write_data(fd, data.data(), data.size(), offset, uncached(offset + data.size()));
+    close(fd);
+    if (!written) error = "Failed to write file";
+    return written;
+}
+
+bool FlatStorage::commit(const string& name, int user_id, uint64_t size, bool durable, string& error) {
+    string temp = pending_file(pending_root, name, user_id, false);
+    struct stat st;
+    if (::stat(temp.c_str(), &st) < 0) {
+        error = "No upload in progress";
+        return false;
+    }
+    if ((uint64_t)st.st_size != size) {
+        error = "Upload incomplete";
+        return false;
+    }
+    string path = root + "/" + name;
+    if ((durable && !sync_path(temp)) || rename(temp.c_str(), path.c_str()) < 0
+        || (durable && !sync_path(parent_directory(path)))) {
+        error = "Failed to store file";
+        return false;
+    }
+    return true;
+}
+
+uint64_t FileStorage::version_token(const struct stat& st) {
+    uint64_t mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    return ((uint64_t)st.st_ino * 0x9E3779B97F4A7C15ULL) ^ mtime_ns;
+}
+
+bool FlatStorage::stat(const string& name, struct stat& st) {
+    return ::stat((root + "/" + name).c_str(), &st) == 0;
+}
+
+bool FlatStorage::read(const string& name, uint64_t offset, uint64_t max_length,
+                       vector<shared_ptr<FileBody> >& bodies, uint64_t& size, string& error) {
+    int fd = open((root + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        error = "File not found";
+        return false;
+    }
+
+    size = st.st_size;
+    if (size < offset) {
+        close(fd);
+        error = "Offset past end of file";
+        return false;
+    }
+    bodies.push_back(make_shared<FileBody>(fd, offset, min(max_length, size - offset)));
+    return true;
+}
+
+DedupStorage::DedupStorage(const string& _root, uint64_t _uncached_bytes)
+    : FileStorage(_uncached_bytes), root(_root), pending_root(reset_pending(root)),
+      chunks_written(0), chunks_reused(0), bytes_written(0), bytes_reused(0) {
+    make_directory(root + "/.chunks");
+    make_directory(root + "/.manifests");
+}
+
+string DedupStorage::manifest_path(const string& name) const {
+    return root + "/.manifests/" + name;
+}
+
+string DedupStorage::pending_path(const string& name, int user_id, bool create) const {
+    return pending_file(pending_root, name, user_id, create);
+}
+
+string DedupStorage::chunk_path(const string& hash) const {
+    return root + "/.chunks/" + hash.substr(0, 2) + "/" + hash;
+}
+
+bool DedupStorage::put_chunk(const char* data, size_t len, const WriteMode& mode, Chunk& chunk) {
+    chunk.hash = sha256_hex(data, len);
+    chunk.length = len;
+
+    // A stored chunk may come from an upload that was not durable
+    string path = chunk_path(chunk.hash);
+    if (access(path.c_str(), F_OK) == 0) {
+        chunks_reused++;
+        bytes_reused += len;
+        return !mode.durable || sync_path(path);
+    }
+
+    string dir = parent_directory(path);
+    if (mkdir(dir.c_str(), 0755) == 0) {
+        if (mode.durable && !sync_path(root + "/.chunks")) return false;
+    } else if (errno != EEXIST) {
+        return false;
+    }
+    if (!replace_file(path, data, len, mode.durable, mode.uncached)) return false;
+    chunks_written++;
+    bytes_written += len;
+    return true;
+}
+
+bool DedupStorage::put_chunks(const string& data, const WriteMode& mode, Manifest& manifest) {
+    for (size_t pos = 0; pos < data.size(); pos += CHUNK_SIZE) {
+        Chunk chunk;
+        if (!put_chunk(data.data() + pos, min(data.size() - pos, (size_t)CHUNK_SIZE), mode, chunk)) return false;
+        manifest.size += chunk.length;
+        manifest.chunks.push_back(chunk);
+    }
+    return true;
+}
+
+bool DedupStorage::load_manifest(const string& path, Manifest& manifest) {
+    FILE* in = fopen(path.c_str(), "re");
+    if (!in) return false;
+
+    unsigned long long size, length;
+    char hash[65];
+    bool ok = fscanf(in, "dedup 1 %llu\n", &size) == 1;
+    manifest.size = 0;
+    manifest.chunks.clear();
+    while (ok && fscanf(in, "%64s %llu\n", hash, &length) == 2) {
+        Chunk chunk;
+        chunk.hash = hash;
+        chunk.length = length;
+        manifest.size += length;
+        manifest.chunks.push_back(chunk);
+    }
+    fclose(in);
+    return ok && manifest.size == size;
+}
+
+bool DedupStorage::save_manifest(const string& path, const Manifest& manifest, bool durable) {
+    string text = "dedup 1 " + to_string(manifest.size) + "\n";
+    for (const Chunk& chunk : manifest.chunks) {
+        text += chunk.hash + " " + to_string(chunk.length) + "\n";
+    }
+    return replace_file(path, text.data(), text.size(), durable, false);
+}
+
+bool DedupStorage::write_file(const string& name, const string& data, bool durable, string& error) {
+    WriteMode mode;
+    mode.durable = durable;
+    mode.uncached = uncached(data.size());
+    Manifest manifest;
+    if (!put_chunks(data, mode, manifest)) {
+        error = "Failed to write file";
+        return false;
+    }
+    if (!save_manifest(manifest_path(name), manifest, durable)) {
+        error = "Failed to store file";
+        return false;
+    }
+    return true;
+}
+
+bool DedupStorage::write_chunk(const string& name, int user_id, uint64_t offset,
+                               const string& data, string& error) {
+    string path = pending_path(name, user_id, true);
+    Manifest pending;
+    if (path.empty() || (offset > 0 && !load_manifest(path, pending))) {
+        error = "Upload chunk out of sequence";
+        return false;
+    }
+
+    // A retried chunk replaces what was stored from its offset on
+    while (pending.size > offset && !pending.chunks.empty()) {
+        pending.size -= pending.chunks.back().length;
+        pending.chunks.pop_back();
+    }
+    if (pending.size != offset) {
+        error = "Upload chunk out of sequence";
+        return false;
+    }
+
+    WriteMode mode;
+    mode.durable = false;
+    mode.uncached = uncached(offset + data.size());
+    if (!put_chunks(data, mode, pending) || !save_manifest(path, pending, false)) {
+        error = "Failed to write file";
+        return false;
+    }
+    return true;
+}
+
+bool DedupStorage::commit(const string& name, int user_id, uint64_t size, bool durable, string& error) {
+    string path = pending_path(name, user_id);
+    Manifest pending;
+    if (!load_manifest(path, pending)) {
+        error = "No upload in progress";
+        return false;
+    }
+    if (pending.size != size) {
+        error = "Upload incomplete";
+        return false;
+    }
+
+    // Chunks were stored without syncing; sync each one and its directory
+    // before the manifest that makes them part of the file
+    if (durable) {
+        set<string> directories;
+        for (const Chunk& chunk : pending.chunks) {
+            string chunk_file = chunk_path(chunk.hash);
+            if (!sync_path(chunk_file)) {
+                error = "Failed to store file";
+                return false;
+            }
+            directories.insert(parent_directory(chunk_file));
+        }
+        directories.insert(root + "/.chunks");
+        for (const string& dir : directories) {
+            if (!sync_path(dir)) {
+                error = "Failed to store file";
+                return false;
+            }
+        }
+    }
+
+    string target = manifest_path(name);
+    if ((durable && !sync_path(path)) || rename(path.c_str(), target.c_str()) < 0
+        || (durable && !sync_path(parent_directory(target)))) {
+        error = "Failed to store file";
+        return false;
+    }
+    return true;
+}
+
+bool DedupStorage::stat(const string& name, struct stat& st) {
+    // Manifests are replaced, never rewritten, so their inode and mtime
+    // identify the version; the size is the file's, not the manifest's
+    Manifest manifest;
+    string path = manifest_path(name);
+    if (::stat(path.c_str(), &st) < 0 || !load_manifest(path, manifest)) return false;
+    st.st_size = manifest.size;
+    return true;
+}
+
+bool DedupStorage::read(const string& name, uint64_t offset, uint64_t max_length,
+                        vector<shared_ptr<FileBody> >& bodies, uint64_t& size, string& error) {
+    Manifest manifest;
+    if (!load_manifest(manifest_path(name), manifest)) {
+        error = "File not found";
+        return false;
+    }
+
+    size = manifest.size;
+    if (size < offset) {
+        error = "Offset past end of file";
+        return false;
+    }
+
+    // Chunk files are opened as the reactor reaches them
+    uint64_t end = offset + min(max_length, size - offset);
+    uint64_t chunk_start = 0;
+    for (const Chunk& chunk : manifest.chunks) {
+        uint64_t chunk_end = chunk_start + chunk.length;
+        if (chunk_end > offset && chunk_start < end) {
+            uint64_t from = max(offset, chunk_start);
+            uint64_t to = min(end, chunk_end);
+            bodies.push_back(make_shared<FileBody>(chunk_path(chunk.hash), from - chunk_start, to - from));
+        }
+        if (chunk_end >= end) break;
+        chunk_start = chunk_end;
+    }
+    return true;
+}
+
+DedupStorage::Stats DedupStorage::stats() const {
+    Stats s;
+    s.chunks_written = chunks_written.load();
+    s.chunks_reused = chunks_reused.load();
+    s.bytes_written = bytes_written.load();
+    s.bytes_reused = bytes_reused.load();
+    return s;
+}
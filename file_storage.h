@@ -0,0 +1,186 @@
+#ifndef _FILE_STORAGE_H_
+#define _FILE_STORAGE_H_
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <sys/stat.h>
+
+/*
+ * FileStorage class
+ *
+ * Where the file server keeps uploaded files. Reads hand back FileBody
+ * pieces rather than bytes, so downloads stay zero-copy whatever the
+ * backend. Operations fill in error with a message for the client and
+ * return false on failure.
+ *
+ * Files are replaced atomically: new contents go to a temporary file that
+ * is renamed over the old one, so a download in progress keeps reading the
+ * version it opened and never sees a partial upload. A durable write has
+ * been fsync()ed, together with the directory entries naming it, before it
+ * returns; other writes reach the disk when the kernel flushes them.
+ *
+ * Uploads reaching uncached_bytes (0: never) are written around the page
+ * cache: each piece is flushed and dropped from the cache right away, so a
+ * bulk upload does not evict the hot files that downloads read from it.
+ *
+ * A stat() result identifies one version of a file: its inode and mtime
+ * change whenever the file is replaced and st_size is the file's length,
+ * so FileCache entries can be validated against any backend.
+ */
+class FileStorage {
+public:
+    explicit FileStorage(uint64_t _uncached_bytes) : uncached_bytes(_uncached_bytes) {}
+    virtual ~FileStorage() {}
+
+    // Replaces name with data
+    virtual bool write_file(const std::string& name, const std::string& data, bool durable,
+                            std::string& error) = 0;
+
+    // Chunked uploads: stores data at offset of user's pending copy of name.
+    // A chunk may repeat the previous one after a retry, but may not leave a
+    // gap. commit() replaces name with the pending copy once it is size bytes.
+    virtual bool write_chunk(const std::string& name, int user_id, uint64_t offset,
+                             const std::string& data, std::string& error) = 0;
+    virtual bool commit(const std::string& name, int user_id, uint64_t size, bool durable,
+                        std::string& error) = 0;
+
+    virtual bool stat(const std::string& name, struct stat& st) = 0;
+
+    // A token that changes whenever a stat() result names another version
+    static uint64_t version_token(const struct stat& st);
+
+    // Appends bodies covering up to max_length bytes of name from offset and
+    // sets size to the file's length
+    virtual bool read(const std::string& name, uint64_t offset, uint64_t max_length,
+                      std::vector<std::shared_ptr<FileBody> >& bodies, uint64_t& size,
+                      std::string& error) = 0;
+
+protected:
+    // Whether a write ending at end bytes into the file skips the page cache
+    bool uncached(uint64_t end) const;
+
+    uint64_t uncached_bytes;
+};
+
+/*
+ * FlatStorage class
+ *
+ * One regular file per name under root. Chunked uploads collect in
+ * root/.pending/<user>/<name> and are renamed into place on commit; the
+ * pending directory is emptied at startup, dropping abandoned uploads.
+ * Names are never empty and contain no '/' and no leading '.', which
+ * FileService checks, so no name reaches another user's pending data.
+ */
+class FlatStorage : public FileStorage {
+public:
+    FlatStorage(const std::string& root, uint64_t uncached_bytes);
+
+    bool write_file(const std::string& name, const std::string& data, bool durable, std::string& error);
+    bool write_chunk(const std::string& name, int user_id, uint64_t offset,
+                     const std::string& data, std::string& error);
+    bool commit(const std::string& name, int user_id, uint64_t size, bool durable, std::string& error);
+    bool stat(const std::string& name, struct stat& st);
+    bool read(const std::string& name, uint64_t offset, uint64_t max_length,
+              std::vector<std::shared_ptr<FileBody> >& bodies, uint64_t& size, std::string& error);
+
+private:
+    std::string root;
+    std::string pending_root;   // root/.pending
+};
+
+/*
+ * DedupStorage class
+ *
+ * Content-addressed storage. Files are cut into chunks of at most
+ * CHUNK_SIZE bytes, each stored once as root/.chunks/<ab>/<sha256> where
+ * ab are the first two hex digits of its hash. A file is a manifest,
+ * root/.manifests/<name>, listing its size and its chunks' hashes and
+ * lengths in order:
+ *
+ *   dedup 1 <size>
+ *   <sha256> <length>
+ *   ...
+ *
+ * Uploading content the server already has costs hashing it and writing
+ * the manifest; only chunks not seen before reach the disk. Chunk files
+ * are written to a temporary name and renamed, so a chunk file is always
+ * complete, and manifests are replaced the same way, so a reader sees
+ * either the old file or the new one.
+ *
+ * CHUNK_SIZE matches Wire::FILE_CHUNK_SIZE: every UPLOAD_CHUNK frame from
+ * the client is one chunk, and a DOWNLOAD_CHUNK at a chunk boundary is
+ * sent from a single chunk file with sendfile(). Chunk boundaries are
+ * fixed offsets, so an edit that shifts later data makes everything after
+ * it new chunks. Chunks no manifest references any more are not removed.
+ *
+ * A chunked upload's manifest grows in root/.pending/<user>/<name>, as in
+ * FlatStorage, and is renamed into root/.manifests on commit.
+ */
+class DedupStorage : public FileStorage {
+public:
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    struct Stats {
+        uint64_t chunks_written;
+        uint64_t chunks_reused;
+        uint64_t bytes_written;
+        uint64_t bytes_reused;
+    };
+
+    DedupStorage(const std::string& root, uint64_t uncached_bytes);
+
+    bool write_file(const std::string& name, const std::string& data, bool durable, std::string& error);
+    bool write_chunk(const std::string& name, int user_id, uint64_t offset,
+                     const std::string& data, std::string& error);
+    bool commit(const std::string& name, int user_id, uint64_t size, bool durable, std::string& error);
+    bool stat(const std::string& name, struct stat& st);
+    bool read(const std::string& name, uint64_t offset, uint64_t max_length,
+              std::vector<std::shared_ptr<FileBody> >& bodies, uint64_t& size, std::string& error);
+
+    Stats stats() const;
+
+private:
+    struct Chunk {
+        std::string hash; // hex SHA-256
+        uint64_t length;
+    };
+
+    struct WriteMode {
+        bool durable;
+        bool uncached;
+    };
+
+    struct Manifest {
+        uint64_t size;
+        std::vector<Chunk> chunks;
+
+        Manifest() : size(0) {}
+    };
+
+    std::string manifest_path(const std::string& name) const;
+    // Empty if the user's directory cannot be created
+    std::string pending_path(const std::string& name, int user_id, bool create = false) const;
+    std::string chunk_path(const std::string& hash) const;
+
+    // Stores data as chunks and appends them to manifest
+    bool put_chunks(const std::string& data, const WriteMode& mode, Manifest& manifest);
+    bool put_chunk(const char* data, size_t len, const WriteMode& mode, Chunk& chunk);
+
+    static bool load_manifest(const std::string& path, Manifest& manifest);
+    static bool save_manifest(const std::string& path, const Manifest& manifest, bool durable);
+
+    std::string root;
+    std::string pending_root;   // root/.pending
+
+    std::atomic<uint64_t> chunks_written;
+    std::atomic<uint64_t> chunks_reused;
+    std::atomic<uint64_t> bytes_written;
+    std::atomic<uint64_t> bytes_reused;
+};
+
+#endif
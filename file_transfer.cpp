@@ -0,0 +1,158 @@
+#include "file_transfer.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+    bool write_all(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+}
+
+// Streams a local file to the file server as UPLOAD_CHUNK frames with a few
+// in flight, then commits it with flags. Memory use does not depend on the
+// file size.
+bool upload_chunked(NetworkRequestChannel& channel, int user_id, const string& filename,
+                    uint32_t flags, string& error) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "Could not open file";
+        return false;
+    }
+
+    Request chunk(UPLOAD_CHUNK, user_id, 0, filename);
+    uint64_t offset = 0;
+    bool ok = true;
+    bool reading = true;
+    try {
+        while (ok && (reading || channel.in_flight() > 0)) {
+            if (reading && channel.in_flight() < TRANSFER_WINDOW) {
+                chunk.data.resize(Wire::FILE_CHUNK_SIZE);
+                size_t len = 0;
+                while (len < chunk.data.size()) {
+                    ssize_t n = read(fd, &chunk.data[len], chunk.data.size() - len);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n < 0) {
+                        error = "Could not read file";
+                        ok = false;
+                    }
+                    if (n <= 0) break;
+                    len += n;
+                }
+                if (!ok) break;
+                chunk.data.resize(len);
+
+                // An empty file still sends one chunk to create it
+                if (len > 0 || offset == 0) {
+                    chunk.offset = offset;
+                    channel.submit(chunk);
+                    offset += len;
+                }
+                reading = len == Wire::FILE_CHUNK_SIZE;
+                continue;
+            }
+
+            Response resp = channel.receive_response();
+            if (!resp.success) {
+                error = resp.message;
+                ok = false;
+            }
+        }
+    } catch (const exception&) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    // Collect replies still in flight so the channel stays in step
+    while (channel.in_flight() > 0) channel.receive_response();
+    if (!ok) return false;
+
+    Request commit(UPLOAD_COMMIT, user_id, 0, filename);
+    commit.offset = offset;
+    commit.flags = flags;
+    Response resp = channel.send_request(commit);
+    if (!resp.success) {
+        error = resp.message;
+        return false;
+    }
+    return true;
+}
+
+// Fetches a file as DOWNLOAD_CHUNK frames with a few in flight. The chunks
+// go to <filename>.part, which replaces filename once it is complete.
+bool download_chunked(NetworkRequestChannel& channel, int user_id, const string& filename, string& error) {
+    string temp = filename + ".part";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = "Could not create output file";
+        return false;
+    }
+
+    Request chunk(DOWNLOAD_CHUNK, user_id, 0, filename);
+    uint64_t next = Wire::FILE_CHUNK_SIZE;
+    uint64_t received = 0;
+    uint64_t size = 0;
+    Money version = 0;  // stays 0 against servers that send no token
+    bool ok = true;
+    try {
+        // The first reply tells the file size; then the rest is pipelined
+        channel.submit(chunk);
+        while (channel.in_flight() > 0) {
+            Response resp = channel.receive_response();
+            if (!ok) continue;
+            if (!resp.success) {
+                error = resp.message;
+                ok = false;
+                continue;
+            }
+            if (received > 0 && (resp.offset != size || resp.balance != version)) {
+                error = "File changed during download";
+                ok = false;
+                continue;
+            }
+            size = resp.offset;
+            version = resp.balance;
+            if (!write_all(fd, resp.data.data(), resp.data.size())) {
+                error = "Could not write output file";
+                ok = false;
+                continue;
+            }
+            received += resp.data.size();
+
+            while (next < size && channel.in_flight() < TRANSFER_WINDOW) {
+                chunk.offset = next;
+                channel.submit(chunk);
+                next += Wire::FILE_CHUNK_SIZE;
+            }
+        }
+    } catch (const exception&) {
+        close(fd);
+        unlink(temp.c_str());
+        throw;
+    }
+    close(fd);
+
+    if (ok && received != size) {
+        error = "File changed during download";
+        ok = false;
+    }
+    if (ok && rename(temp.c_str(), filename.c_str()) < 0) {
+        error = "Could not create output file";
+        ok = false;
+    }
+    if (!ok) unlink(temp.c_str());
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef _FILE_TRANSFER_H_
+#define _FILE_TRANSFER_H_
+
+#include "common.h"
+#include "network_channel.h"
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Chunked file transfers
+ *
+ * Client-side helpers that move files of any size as UPLOAD_CHUNK /
+ * DOWNLOAD_CHUNK frames (see wire.h) with TRANSFER_WINDOW requests in
+ * flight on one channel. They return false with error set when the server
+ * refuses or local I/O fails, and throw runtime_error when the connection
+ * does.
+ */
+
+// Requests kept in flight by a chunked file transfer
+const size_t TRANSFER_WINDOW = 4;
+
+// Uploads local file filename under the same name; flags (RequestFlags) go
+// with the commit
+bool upload_chunked(NetworkRequestChannel& channel, int user_id, const std::string& filename,
+                    uint32_t flags, std::string& error);
+
+// Downloads filename into a local file of the same name; fails if the file
+// is replaced on the server meanwhile, even by one of the same size
+bool download_chunked(NetworkRequestChannel& channel, int user_id, const std::string& filename,
+                      std::string& error);
+
+#endif
@@ -0,0 +1,187 @@
+#include "finance_cluster.h"
+#include "wire.h"
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include <map>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+    int64_t now_ms() {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct timespec modification_time(const string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) throw runtime_error("cannot stat shard map " + path + "!");
+        return st.st_mtim;
+    }
+
+    bool same_time(const struct timespec& a, const struct timespec& b) {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    string endpoint(const ShardMap::Shard& shard) {
+        return shard.host + ":" + to_string(shard.port);
+    }
+
+    // Why req cannot run on the shard of its user_id, or "" if it can:
+    // a transfer, or anything inside a batch, must stay on that shard
+    string cross_shard(const ShardMap& map, const Request& req) {
+        size_t home = map.shard_for(req.user_id);
+        int to;
+        if (req.type == TRANSFER && req.transfer_destination(to) && map.shard_for(to) != home) {
+            return "Transfer between accounts on different shards (" + map.shards()[home].name + " and "
+                   + map.shards()[map.shard_for(to)].name + ") is not supported";
+        }
+        if (req.type == BATCH) {
+            for (const Request& sub : Wire::decode_batch(req.data)) {
+                if (map.shard_for(sub.user_id) != home) return "Batch spans several shards";
+                string problem = cross_shard(map, sub);
+                if (!problem.empty()) return problem;
+            }
+        }
+        return "";
+    }
+
+    future<Response> refused(const string& message) {
+        promise<Response> reply;
+        reply.set_value(Response(false, 0, "", message));
+        return reply.get_future();
+    }
+
+    // Waits for every shard's interest reply and folds them into one
+    Response combine_interest(const vector<string>& names, vector<future<Response> > replies) {
+        string failures;
+        size_t failed = 0;
+        for (size_t i = 0; i < replies.size(); i++) {
+            string problem;
+            try {
+                Response resp = replies[i].get();
+                if (!resp.success) problem = resp.message;
+            } catch (const exception& e) {
+                problem = e.what();
+            }
+            if (problem.empty()) continue;
+            failed++;
+            if (!failures.empty()) failures += "; ";
+            failures += names[i] + ": " + problem;
+        }
+
+        if (failed == 0) {
+            return Response(true, 0, "", "Interest accrual successful on " + to_string(replies.size()) + " shards");
+        }
+        return Response(false, 0, "", "Interest accrual failed on " + to_string(failed) + " of "
+                        + to_string(replies.size()) + " shards (" + failures + ")");
+    }
+}
+
+FinanceCluster::FinanceCluster(const string& map_path, size_t connections_per_shard, ConnectionPool::Policy _policy,
+                               int _request_timeout_ms)
+    : path(map_path), connections(connections_per_shard), policy(_policy), request_timeout_ms(_request_timeout_ms),
+      next_check_ms(now_ms() + RELOAD_CHECK_MS) {
+    if (pthread_rwlock_init(&lock, NULL) != 0) {
+        throw runtime_error("pthread_rwlock_init() failed!");
+    }
+    loaded_mtime.tv_sec = 0;
+    loaded_mtime.tv_nsec = 0;
+    try {
+        reload();
+    } catch (...) {
+        pthread_rwlock_destroy(&lock);
+        throw;
+    }
+}
+
+FinanceCluster::~FinanceCluster() {
+    state.reset();
+    pthread_rwlock_destroy(&lock);
+}
+
+bool FinanceCluster::reload() {
+    lock_guard<mutex> guard(reload_mutex);
+    struct timespec mtime = modification_time(path);
+    if (state && same_time(mtime, loaded_mtime)) return false;
+
+    shared_ptr<State> next(new State(ShardMap::load(path)));
+
+    // Keep the pools of shards that stay where they were
+    map<string, shared_ptr<ConnectionPool> > existing;
+    pthread_rwlock_rdlock(&lock);
+    shared_ptr<State> current = state;
+    pthread_rwlock_unlock(&lock);
+    if (current) {
+        for (size_t i = 0; i < current->pools.size(); i++) {
+            existing[endpoint(current->map.shards()[i])] = current->pools[i];
+        }
+    }
+    for (const ShardMap::Shard& shard : next->map.shards()) {
+        shared_ptr<ConnectionPool>& pool = existing[endpoint(shard)];
+        if (!pool) pool.reset(new ConnectionPool(shard.host, shard.port, connections, policy, request_timeout_ms));
+        next->pools.push_back(pool);
+    }
+
+    pthread_rwlock_wrlock(&lock);
+    state.swap(next);
+    pthread_rwlock_unlock(&lock);
+    loaded_mtime = mtime;
+
+    // Pools of removed shards close here, outside the lock
+    return true;
+}
+
+void FinanceCluster::reload_if_due() {
+    int64_t due = next_check_ms.load();
+    int64_t now = now_ms();
+    if (now < due || !next_check_ms.compare_exchange_strong(due, now + RELOAD_CHECK_MS)) return;
+
+    try {
+        if (reload()) cerr << "Reloaded shard map " << path << endl;
+    } catch (const exception& e) {
+        cerr << "Shard map reload failed, keeping the old map: " << e.what() << endl;
+    }
+}
+
+future<Response> FinanceCluster::submit(const Request& req) {
+    reload_if_due();
+
+    pthread_rwlock_rdlock(&lock);
+    shared_ptr<State> current = state;
+    pthread_rwlock_unlock(&lock);
+
+    if (req.type == EARN_INTEREST) return earn_interest(current, req);
+    if (req.type == TRANSFER || req.type == BATCH) {
+        string problem = cross_shard(current->map, req);
+        if (!problem.empty()) return refused(problem);
+    }
+    return current->pools[current->map.shard_for(req.user_id)]->submit(req);
+}
+
+future<Response> FinanceCluster::earn_interest(const shared_ptr<State>& current, const Request& req) {
+    vector<string> names;
+    vector<future<Response> > replies;
+    for (size_t i = 0; i < current->pools.size(); i++) {
+        names.push_back(current->map.shards()[i].name);
+        try {
+            replies.push_back(current->pools[i]->submit(req));
+        } catch (...) {
+            promise<Response> failed;
+            failed.set_exception(current_exception());
+            replies.push_back(failed.get_future());
+        }
+    }
+    return async(launch::deferred, combine_interest, names, std::move(replies));
+}
+
+Response FinanceCluster::send_request(const Request& req) {
+    return submit(req).get();
+}
+
+size_t FinanceCluster::shard_count() const {
+    pthread_rwlock_rdlock(&lock);
+    size_t count = state->pools.size();
+    pthread_rwlock_unlock(&lock);
+    return count;
+}
@@ -0,0 +1,90 @@
+#ifndef _FINANCE_CLUSTER_H_
+#define _FINANCE_CLUSTER_H_
+
+#include "common.h"
+#include "connection_pool.h"
+#include "shard_map.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * FinanceCluster class
+ *
+ * Client side of a sharded finance service: one ConnectionPool per shard
+ * of a ShardMap, with every request sent to the shard that owns its
+ * user_id. A BATCH goes to the shard of its own user_id, so its
+ * sub-requests must be for users of that shard (the client only batches
+ * one user's transactions). Transfers are atomic only within a shard, so
+ * a TRANSFER, or a BATCH containing one, whose accounts live on
+ * different shards is refused without being sent. EARN_INTEREST is sent
+ * to every shard at once and its future yields one combined response,
+ * successful only if every shard accrued interest; the message names the
+ * shards that did not.
+ *
+ * The shard map file is checked for changes at most once per
+ * RELOAD_CHECK_MS and reloaded in place: pools of shards still listed are
+ * kept and new shards are connected before the new map takes effect. A
+ * map that does not parse or a shard that cannot be reached leaves the
+ * old map in use. Accounts are not moved between shards; the operator
+ * moves them when a change in the map reassigns users.
+ *
+ * Safe to call from any number of threads.
+ */
+class FinanceCluster {
+public:
+    static const int RELOAD_CHECK_MS = 1000;
+
+    // Loads the map and connects every shard; throws runtime_error if the
+    // map is invalid or a shard cannot be reached. request_timeout_ms is
+    // passed to every shard's pool.
+    FinanceCluster(const std::string& map_path, size_t connections_per_shard,
+                   ConnectionPool::Policy policy = ConnectionPool::LEAST_LOADED, int request_timeout_ms = 0);
+    ~FinanceCluster();
+
+    FinanceCluster(const FinanceCluster&) = delete;
+    FinanceCluster& operator=(const FinanceCluster&) = delete;
+
+    std::future<Response> submit(const Request& req);
+
+    // submit() and wait
+    Response send_request(const Request& req);
+
+    // Rereads the map now; returns false if the file is unchanged. Throws
+    // runtime_error, keeping the old map, if the new one cannot be used.
+    bool reload();
+
+    size_t shard_count() const;
+
+private:
+    struct State {
+        ShardMap map;
+        std::vector<std::shared_ptr<ConnectionPool> > pools; // by shard index
+
+        explicit State(const ShardMap& m) : map(m) {}
+    };
+
+    void reload_if_due();
+    std::future<Response> earn_interest(const std::shared_ptr<State>& state, const Request& req);
+
+    std::string path;
+    size_t connections;
+    ConnectionPool::Policy policy;
+    int request_timeout_ms;
+
+    mutable pthread_rwlock_t lock; // guards state
+    std::shared_ptr<State> state;
+
+    std::mutex reload_mutex; // one reload at a time; guards loaded_mtime
+    struct timespec loaded_mtime;
+    std::atomic<int64_t> next_check_ms;
+};
+
+#endif
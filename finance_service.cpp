@@ -0,0 +1,217 @@
+#include "finance_service.h"
+#include "wire.h"
+#include <iostream>
+#include <getopt.h>
+#include <cstdlib>
+
+using namespace std;
+
+// Interest accrued per EARN_INTEREST: balance / INTEREST_DIVISOR (1%),
+// truncated to a whole micro-unit, applied to positive balances lazily
+const Money INTEREST_DIVISOR = 100;
+
+FinanceService::Options::Options()
+    : port(8000), max_accounts(101), thread_count(4), lock_free(false),
+      commit_delay_us(1000), snapshot_interval(60) {}
+
+FinanceService::FinanceService(const Options& options)
+    : accounts(options.max_accounts, options.lock_free ? AccountStore::LOCK_FREE : AccountStore::LOCKED),
+      journal(options.journal_dir, accounts, options.commit_delay_us, options.snapshot_interval) {
+    if (journal.enabled()) {
+        Journal::RecoveryStats stats = journal.recover();
+        cout << "Recovered from " << options.journal_dir << ": snapshot LSN " << stats.snapshot_lsn
+             << " (" << stats.snapshot_seconds * 1000 << " ms), replayed "
+             << stats.records_replayed << " records (" << stats.replay_seconds * 1000
+             << " ms), " << accounts.page_count() << " account pages" << endl;
+    }
+}
+
+void FinanceService::set_audit_sink(AuditSink sink) {
+    audit_sink = sink;
+}
+
+void FinanceService::handle(const Request& r, const string& peer, Response& resp) {
+    uint64_t lsn = 0;
+    vector<Request> audits;
+    process_request(r, lsn, audits, resp);
+    journal.wait_durable(lsn);
+
+    // Only what is durable is audited
+    for (const Request& audit : audits) {
+        audit_sink(audit, peer);
+    }
+}
+
+// Executes a single request against the account table. Mutations are
+// journaled; lsn is raised to the last record written, and the caller must
+// wait for it to be durable before replying. Audit records for successful
+// requests are collected in audits if there is a sink. resp is reset.
+void FinanceService::process_request(const Request& r, uint64_t& lsn, vector<Request>& audits, Response& resp) {
+    if (r.type == BATCH) {
+        resp = Wire::execute_batch(r, [&](const Request& sub) {
+            Response sub_resp;
+            process_request(sub, lsn, audits, sub_resp);
+            return sub_resp;
+        });
+        return;
+    }
+
+    resp.success = true;
+
+    if (!accounts.contains(r.user_id)) {
+        resp.success = false;
+        resp.message = "Invalid account ID";
+        return;
+    }
+
+    if (r.type == DEPOSIT) {
+        Journal::Mutation mutation(journal);
+        resp.balance = accounts.deposit(r.user_id, r.amount);
+        lsn = mutation.log(DEPOSIT, r.user_id, r.amount);
+        resp.message = "Deposit successful";
+    } 
+    else if (r.type == WITHDRAW) {
+        Journal::Mutation mutation(journal);
+        if (accounts.withdraw(r.user_id, r.amount, resp.balance)) {
+            lsn = mutation.log(WITHDRAW, r.user_id, r.amount);
+            resp.message = "Withdrawal successful";
+        } else {
+            resp.success = false;
+            resp.message = "Insufficient funds";
+        }
+    }
+    else if (r.type == TRANSFER) {
+        // Both accounts move under one journal record, in one round trip
+        int to;
+        Money to_balance;
+        if (!r.transfer_destination(to) || !accounts.contains(to)) {
+            resp.success = false;
+            resp.message = "Invalid destination account ID";
+        } else if (to == r.user_id) {
+            resp.success = false;
+            resp.message = "Cannot transfer to the same account";
+        } else if (r.amount <= 0) {
+            resp.success = false;
+            resp.message = "Transfer amount must be positive";
+        } else {
+            Journal::Mutation mutation(journal);
+            if (accounts.transfer(r.user_id, to, r.amount, resp.balance, to_balance)) {
+                lsn = mutation.log(TRANSFER, r.user_id, r.amount, to);
+                resp.message = "Transfer successful";
+            } else {
+                resp.success = false;
+                resp.message = "Insufficient funds";
+            }
+        }
+    }
+    else if (r.type == BALANCE) {
+        // Settling pending interest writes the balance and then its epoch,
+        // so a snapshot fork must not land in between; nothing is logged
+        Journal::Mutation mutation(journal);
+        resp.balance = accounts.balance(r.user_id);
+        resp.message = "View balance successful";
+    }
+    else if (r.type == EARN_INTEREST) {
+        try {
+            // Accounts settle the new epoch when next touched, or when the
+            // accrual's sweep reaches their page. Interest
+            // does not commute with deposits, so it is logged exclusively.
+            // The amount field (a thread count for older servers) is ignored.
+            Journal::Mutation mutation(journal, true);
+            accounts.apply_interest(INTEREST_DIVISOR);
+            lsn = mutation.log(EARN_INTEREST, 0, INTEREST_DIVISOR);
+            resp.message = "Interest accrual successful";
+        } catch (const std::exception& e) {
+            std::cerr << "Exception in EARN_INTEREST: " << e.what() << std::endl;
+            resp.success = false;
+            resp.message = std::string("Interest accrual failed: ") + e.what();
+        }
+    }
+    else {
+        resp.success = false;
+        resp.message = "Unknown RequestType";
+    }
+
+    if (resp.success && audit_sink) {
+        audits.push_back(Request(r.type, r.user_id, r.type == BALANCE ? resp.balance : r.amount, "", r.data));
+        resp.flags |= AUDITED;
+    }
+}
+
+void FinanceService::print_usage() {
+    cout << "Usage: ./finance_server [-p PORT] [-m MAX_ACCOUNTS] [-t THREAD_COUNT] [-l] [-j DIR [-c USEC] [-s SECONDS]]" << endl;
+    cout << "  -p, --port         Port number to listen on (default: 8000)" << endl;
+    cout << "  -m, --max-accounts Highest account ID; storage is allocated on first use (default: 100)" << endl;
+    cout << "  -t, --threads      Number of threads in the thread pool (default: 4)" << endl;
+    cout << "  -l, --lock-free    Update balances with atomic CAS instead of page locks" << endl;
+    cout << "  -j, --journal      Directory for the write-ahead log and snapshots; balances" << endl;
+    cout << "                     are recovered from it at startup (default: off)" << endl;
+    cout << "  -c, --commit-delay Group commit latency budget in microseconds (default: 1000)" << endl;
+    cout << "  -s, --snapshot-interval Seconds between snapshots, 0 to disable (default: 60)" << endl;
+    Reactor::print_admission_usage();
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+int FinanceService::parse_options(int argc, char* argv[], Options& options) {
+    // Parse command line arguments
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"max-accounts", required_argument, 0, 'm'},
+        {"threads", required_argument, 0, 't'},
+        {"lock-free", no_argument, 0, 'l'},
+        {"journal", required_argument, 0, 'j'},
+        {"commit-delay", required_argument, 0, 'c'},
+        {"snapshot-interval", required_argument, 0, 's'},
+        {"backlog", required_argument, 0, 0},
+        {"max-frame", required_argument, 0, 0},
+        {"max-queue", required_argument, 0, 0},
+        {"max-delay", required_argument, 0, 0},
+        {"rate-limit", required_argument, 0, 0},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int option_index = 0;
+    int c;
+    
+    while ((c = getopt_long(argc, argv, "p:m:t:lj:c:s:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p':
+                options.port = atoi(optarg);
+                break;
+            case 'm':
+                options.max_accounts = atol(optarg) + 1;
+                if (options.max_accounts < 1) options.max_accounts = 1;
+                break;
+            case 't':
+                options.thread_count = atoi(optarg);
+                break;
+            case 'l':
+                options.lock_free = true;
+                break;
+            case 'j':
+                options.journal_dir = optarg;
+                break;
+            case 'c':
+                options.commit_delay_us = atoi(optarg);
+                break;
+            case 's':
+                options.snapshot_interval = atoi(optarg);
+                break;
+            case 0:
+                Reactor::parse_admission_option(long_options[option_index].name, optarg, options.admission);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            case '?':
+                print_usage();
+                return 1;
+            default:
+                abort();
+        }
+    }
+
+    if (options.thread_count < 1) options.thread_count = 1;
+    return -1;
+}
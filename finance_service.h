@@ -0,0 +1,70 @@
+#ifndef _FINANCE_SERVICE_H_
+#define _FINANCE_SERVICE_H_
+
+#include "common.h"
+#include "network_channel.h"
+#include "account_store.h"
+#include "journal.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+/*
+ * FinanceService class
+ *
+ * The finance server's accounts and request handling, independent of how
+ * requests arrive: the finance binary serves it on its own reactor, the
+ * bank binary next to the other services in one process.
+ *
+ * Mutations are journaled and handle() returns once they are durable. If
+ * an audit sink is set, every successful deposit, withdrawal, transfer,
+ * balance check and interest accrual (also inside a BATCH) is handed to it
+ * after that, and its response carries the AUDITED flag so the client does
+ * not send the record to the logging server again.
+ */
+class FinanceService {
+public:
+    struct Options {
+        int port;
+        long max_accounts;      // account IDs are [0, max_accounts)
+        int thread_count;
+        bool lock_free;
+        std::string journal_dir;
+        int commit_delay_us;
+        int snapshot_interval;
+        Reactor::Admission admission; // listen backlog and overload limits
+
+        Options();
+    };
+
+    // Receives one audit record in the wording the client would have sent
+    typedef std::function<void(const Request& audit, const std::string& peer)> AuditSink;
+
+    static void print_usage();
+
+    // Parses the finance server's command line; returns -1 to go on, or
+    // the exit status after printing the usage
+    static int parse_options(int argc, char* argv[], Options& options);
+
+    // Allocates the account table and recovers it from the journal
+    explicit FinanceService(const Options& options);
+
+    FinanceService(const FinanceService&) = delete;
+    FinanceService& operator=(const FinanceService&) = delete;
+
+    // Set before serving
+    void set_audit_sink(AuditSink sink);
+
+    // Fills in resp, which must be reset (a Reactor handler)
+    void handle(const Request& r, const std::string& peer, Response& resp);
+
+private:
+    void process_request(const Request& r, uint64_t& lsn, std::vector<Request>& audits, Response& resp);
+
+    AccountStore accounts;
+    Journal journal;
+    AuditSink audit_sink;
+};
+
+#endif
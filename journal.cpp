@@ -0,0 +1,515 @@
+#include "journal.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+namespace {
+    // Upper bound on records in one group commit
+    const size_t MAX_COMMIT_RECORDS = 4096;
+
+    const uint32_t SNAPSHOT_MAGIC = 0x42534e50; // "BSNP"
+
+    struct SnapshotHeader {
+        uint32_t magic;
+        uint32_t page_size;
+        uint64_t lsn;
+        uint64_t page_count;
+    };
+
+    // One page of balances: first account ID, then PAGE_SIZE balances
+    const size_t SNAPSHOT_RECORD_SIZE = sizeof(int64_t) * (1 + AccountStore::PAGE_SIZE);
+
+    string numbered_path(const string& dir, const char* prefix, uint64_t n) {
+        char name[64];
+        snprintf(name, sizeof(name), "/%s.%020llu", prefix, (unsigned long long)n);
+        return dir + name;
+    }
+
+    void sync_directory(const string& dir) {
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+
+    double seconds_since(chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    // Only async-signal-safe calls: this runs in a forked child
+    bool write_fully(int fd, const char* buf, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, buf, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    [[noreturn]] void fatal(const char* what) {
+        perror(what);
+        abort();
+    }
+}
+
+Journal::Mutation::Mutation(Journal& _journal, bool exclusive) : journal(_journal) {
+    if (!journal.enabled()) return;
+    if (exclusive) pthread_rwlock_wrlock(&journal.state_lock);
+    else pthread_rwlock_rdlock(&journal.state_lock);
+}
+
+Journal::Mutation::~Mutation() {
+    if (journal.enabled()) pthread_rwlock_unlock(&journal.state_lock);
+}
+
+uint64_t Journal::Mutation::log(RequestType type, int user_id, Money amount, int counterpart) {
+    if (!journal.enabled()) return 0;
+    return journal.append(type, user_id, amount, counterpart);
+}
+
+Journal::Journal(const string& _directory, AccountStore& _accounts,
+                 int _commit_delay_us, int _snapshot_interval_s)
+    : directory(_directory), accounts(_accounts), commit_delay_us(_commit_delay_us),
+      snapshot_interval_s(_snapshot_interval_s), next_lsn(1), synced_lsn(0), rotate_lsn(0),
+      stopping(false), syncs(0), segment_fd(-1), last_snapshot_lsn(0), snapshot_stopping(false) {
+    static_assert(sizeof(Record) == 32, "journal records must be 32 bytes");
+
+    // Prefer writers so interest and snapshots are not starved by deposits
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&state_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    if (enabled() && mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        throw runtime_error("Journal directory creation failed!");
+    }
+}
+
+Journal::~Journal() {
+    if (snapshotter.joinable()) {
+        {
+            lock_guard<std::mutex> lock(snapshot_wait_mutex);
+            snapshot_stopping = true;
+        }
+        snapshot_wakeup.notify_all();
+        snapshotter.join();
+    }
+    if (writer.joinable()) {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        writer.join();
+    }
+    if (segment_fd >= 0) close(segment_fd);
+    pthread_rwlock_destroy(&state_lock);
+}
+
+bool Journal::enabled() const {
+    return !directory.empty();
+}
+
+uint64_t Journal::sync_count() const {
+    return syncs.load();
+}
+
+uint64_t Journal::durable_lsn() {
+    lock_guard<std::mutex> lock(mutex);
+    return synced_lsn;
+}
+
+uint32_t Journal::compute_checksum(const Record& rec) {
+    // FNV-1a over everything but the checksum field. Records older than
+    // TRANSFER have a zero counterpart that was never summed, so it is
+    // only covered where it matters.
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(&rec);
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < offsetof(Record, checksum); i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    if (rec.type == TRANSFER) {
+        for (size_t i = offsetof(Record, counterpart); i < sizeof(Record); i++) {
+            h = (h ^ p[i]) * 16777619u;
+        }
+    }
+    return h;
+}
+
+uint64_t Journal::append(RequestType type, int user_id, Money amount, int counterpart) {
+    Record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.amount = amount;
+    rec.user_id = user_id;
+    rec.type = (uint16_t)type;
+    rec.counterpart = counterpart;
+
+    size_t queued;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        rec.lsn = next_lsn++;
+        rec.checksum = compute_checksum(rec);
+        pending.push_back(rec);
+        queued = pending.size();
+    }
+    // Wake the writer for the first record of a commit and when it is full
+    if (queued == 1 || queued == MAX_COMMIT_RECORDS) work_ready.notify_one();
+    return rec.lsn;
+}
+
+void Journal::wait_durable(uint64_t lsn) {
+    if (!enabled() || lsn == 0) return;
+    unique_lock<std::mutex> lock(mutex);
+    durable.wait(lock, [this, lsn] { return synced_lsn >= lsn; });
+}
+
+void Journal::open_segment(uint64_t first_lsn) {
+    string path = numbered_path(directory, "wal", first_lsn);
+    segment_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (segment_fd < 0) {
+        throw runtime_error("Journal segment open failed!");
+    }
+    sync_directory(directory);
+}
+
+void Journal::write_records(const vector<Record>& records, size_t first, size_t last) {
+    if (first >= last) return;
+    if (!write_fully(segment_fd, reinterpret_cast<const char*>(&records[first]),
+                     (last - first) * sizeof(Record))) {
+        fatal("Journal write failed");
+    }
+}
+
+void Journal::writer_loop() {
+    vector<Record> batch;
+    while (true) {
+        uint64_t rotate;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [this] { return stopping || !pending.empty() || rotate_lsn != 0; });
+            if (stopping && pending.empty() && rotate_lsn == 0) break;
+
+            // Let concurrent appends join this commit, up to the latency budget
+            if (commit_delay_us > 0 && !pending.empty() && pending.size() < MAX_COMMIT_RECORDS) {
+                work_ready.wait_for(lock, chrono::microseconds(commit_delay_us),
+                    [this] { return stopping || pending.size() >= MAX_COMMIT_RECORDS; });
+            }
+            batch.swap(pending);
+            rotate = rotate_lsn;
+            rotate_lsn = 0;
+        }
+
+        size_t split = batch.size();
+        if (rotate != 0) {
+            split = 0;
+            while (split < batch.size() && batch[split].lsn < rotate) split++;
+        }
+
+        write_records(batch, 0, split);
+        if (rotate != 0) {
+            if (fdatasync(segment_fd) < 0) fatal("Journal sync failed");
+            close(segment_fd);
+            open_segment(rotate);
+        }
+        write_records(batch, split, batch.size());
+
+        if (!batch.empty()) {
+            if (fdatasync(segment_fd) < 0) fatal("Journal sync failed");
+            syncs++;
+            {
+                lock_guard<std::mutex> lock(mutex);
+                synced_lsn = batch.back().lsn;
+            }
+            durable.notify_all();
+        }
+        batch.clear();
+    }
+}
+
+void Journal::snapshot_loop() {
+    unique_lock<std::mutex> lock(snapshot_wait_mutex);
+    while (!snapshot_wakeup.wait_for(lock, chrono::seconds(snapshot_interval_s),
+                                     [this] { return snapshot_stopping; })) {
+        lock.unlock();
+        if (!snapshot()) {
+            cerr << "Journal snapshot failed" << endl;
+        }
+        lock.lock();
+    }
+}
+
+bool Journal::snapshot() {
+    if (!enabled()) return false;
+    lock_guard<std::mutex> serial(snapshot_mutex);
+
+    pthread_rwlock_wrlock(&state_lock);
+
+    uint64_t lsn;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        lsn = next_lsn - 1;
+    }
+    if (lsn == last_snapshot_lsn) {
+        pthread_rwlock_unlock(&state_lock);
+        return true;
+    }
+
+    // Everything the child needs is prepared before fork, so the child
+    // never allocates or takes a lock
+    string final_path = numbered_path(directory, "snapshot", lsn);
+    string temp_path = final_path + ".tmp";
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.page_size = AccountStore::PAGE_SIZE;
+    header.lsn = lsn;
+    header.page_count = accounts.page_count();
+
+    int status_pipe[2];
+    if (pipe2(status_pipe, O_CLOEXEC) < 0) {
+        pthread_rwlock_unlock(&state_lock);
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_IGN);
+        close(status_pipe[0]);
+
+        char buf[64 * 1024];
+        size_t used = 0;
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+
+        memcpy(buf, &header, sizeof(header));
+        used = sizeof(header);
+        accounts.visit_pages_unlocked([&](int first_id, const Money* balances) {
+            if (used + SNAPSHOT_RECORD_SIZE > sizeof(buf)) {
+                ok = ok && write_fully(fd, buf, used);
+                used = 0;
+            }
+            int64_t id = first_id;
+            memcpy(buf + used, &id, sizeof(id));
+            used += sizeof(id);
+            for (size_t i = 0; i < AccountStore::PAGE_SIZE; i++) {
+                memcpy(buf + used, &balances[i], sizeof(Money));
+                used += sizeof(Money);
+            }
+        });
+        ok = ok && write_fully(fd, buf, used);
+        ok = ok && fsync(fd) == 0;
+        if (fd >= 0) close(fd);
+        ok = ok && rename(temp_path.c_str(), final_path.c_str()) == 0;
+
+        char result = ok ? 1 : 0;
+        write_fully(status_pipe[1], &result, 1);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(status_pipe[1]);
+    bool started = pid > 0;
+    if (started) {
+        // New records go to a fresh segment so older ones can be pruned
+        lock_guard<std::mutex> lock(mutex);
+        rotate_lsn = lsn + 1;
+    }
+    pthread_rwlock_unlock(&state_lock);
+    if (!started) {
+        close(status_pipe[0]);
+        return false;
+    }
+    work_ready.notify_one();
+
+    char result = 0;
+    ssize_t n;
+    do {
+        n = read(status_pipe[0], &result, 1);
+    } while (n < 0 && errno == EINTR);
+    close(status_pipe[0]);
+    waitpid(pid, nullptr, 0);
+
+    if (n != 1 || result != 1) return false;
+
+    sync_directory(directory);
+    last_snapshot_lsn = lsn;
+    prune(lsn);
+    return true;
+}
+
+// Drops snapshots older than snapshot_lsn and segments that only hold
+// records it already covers
+void Journal::prune(uint64_t snapshot_lsn) {
+    vector<pair<uint64_t, string> > snapshots = list_files("snapshot");
+    for (size_t i = 0; i < snapshots.size(); i++) {
+        if (snapshots[i].first < snapshot_lsn) unlink(snapshots[i].second.c_str());
+    }
+    vector<pair<uint64_t, string> > segments = list_files("wal");
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (segments[i].first <= snapshot_lsn) unlink(segments[i].second.c_str());
+    }
+}
+
+vector<pair<uint64_t, string> > Journal::list_files(const string& prefix) {
+    vector<pair<uint64_t, string> > files;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return files;
+
+    string lead = prefix + ".";
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        string name = entry->d_name;
+        if (name.compare(0, lead.size(), lead) != 0) continue;
+        string number = name.substr(lead.size());
+        if (number.empty() || number.find_first_not_of("0123456789") != string::npos) continue;
+        files.push_back(make_pair(strtoull(number.c_str(), nullptr, 10), directory + "/" + name));
+    }
+    closedir(dir);
+    sort(files.begin(), files.end());
+    return files;
+}
+
+// Returns the snapshot's LSN, or 0 if the file is not a valid snapshot
+uint64_t Journal::load_snapshot(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return 0;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const char* data = static_cast<const char*>(map);
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = header.magic == SNAPSHOT_MAGIC && header.page_size == AccountStore::PAGE_SIZE
+        && (size_t)st.st_size == sizeof(header) + header.page_count * SNAPSHOT_RECORD_SIZE;
+
+    if (valid) {
+        const char* p = data + sizeof(header);
+        for (uint64_t i = 0; i < header.page_count; i++, p += SNAPSHOT_RECORD_SIZE) {
+            int64_t first_id;
+            memcpy(&first_id, p, sizeof(first_id));
+            for (size_t j = 0; j < AccountStore::PAGE_SIZE; j++) {
+                Money b;
+                memcpy(&b, p + sizeof(int64_t) * (1 + j), sizeof(b));
+                int id = (int)(first_id + j);
+                if (b != 0 && accounts.contains(id)) accounts.deposit(id, b);
+            }
+        }
+    }
+
+    munmap(map, st.st_size);
+    return valid ? header.lsn : 0;
+}
+
+// Applies the records after after_lsn; a torn or corrupt tail is cut off.
+// Returns the number of records applied.
+uint64_t Journal::replay_segment(const string& path, uint64_t after_lsn, uint64_t& last_lsn) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const char* data = static_cast<const char*>(map);
+    size_t count = st.st_size / sizeof(Record);
+    size_t valid = 0;
+    uint64_t applied = 0;
+    for (; valid < count; valid++) {
+        Record rec;
+        memcpy(&rec, data + valid * sizeof(Record), sizeof(rec));
+        if (rec.lsn == 0 || rec.checksum != compute_checksum(rec)) break;
+        if (rec.lsn > last_lsn) last_lsn = rec.lsn;
+        if (rec.lsn <= after_lsn) continue;
+
+        // Withdrawals were checked when they ran; log order may differ from
+        // the order concurrent deltas were applied in, so replay them as
+        // plain deltas
+        if (rec.type == DEPOSIT) {
+            accounts.deposit(rec.user_id, rec.amount);
+        } else if (rec.type == WITHDRAW) {
+            accounts.deposit(rec.user_id, -rec.amount);
+        } else if (rec.type == TRANSFER) {
+            accounts.deposit(rec.user_id, -rec.amount);
+            accounts.deposit(rec.counterpart, rec.amount);
+        } else if (rec.type == EARN_INTEREST) {
+            accounts.apply_interest(rec.amount);
+        }
+        applied++;
+    }
+    munmap(map, st.st_size);
+
+    if (valid * sizeof(Record) != (size_t)st.st_size) {
+        cerr << "Journal: dropping torn tail of " << path << endl;
+        if (truncate(path.c_str(), valid * sizeof(Record)) < 0) {
+            throw runtime_error("Journal segment truncate failed!");
+        }
+    }
+    return applied;
+}
+
+Journal::RecoveryStats Journal::recover() {
+    RecoveryStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (!enabled()) return stats;
+
+    // Newest valid snapshot wins
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<pair<uint64_t, string> > snapshots = list_files("snapshot");
+    for (size_t i = snapshots.size(); i-- > 0 && stats.snapshot_lsn == 0;) {
+        stats.snapshot_lsn = load_snapshot(snapshots[i].second);
+    }
+    stats.snapshot_seconds = seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    uint64_t last_lsn = stats.snapshot_lsn;
+    vector<pair<uint64_t, string> > segments = list_files("wal");
+    for (size_t i = 0; i < segments.size(); i++) {
+        stats.records_replayed += replay_segment(segments[i].second, stats.snapshot_lsn, last_lsn);
+    }
+    stats.replay_seconds = seconds_since(start);
+    stats.last_lsn = last_lsn;
+
+    next_lsn = last_lsn + 1;
+    synced_lsn = last_lsn;
+    last_snapshot_lsn = stats.snapshot_lsn;
+    open_segment(next_lsn);
+
+    writer = thread([this] { writer_loop(); });
+    if (snapshot_interval_s > 0) {
+        snapshotter = thread([this] { snapshot_loop(); });
+    }
+    return stats;
+}
@@ -0,0 +1,157 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include "common.h"
+#include "account_store.h"
+#include <pthread.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/*
+ * Journal class
+ *
+ * Durability for the finance server's AccountStore: a binary write-ahead
+ * log of every mutation plus periodic snapshots, both kept in one
+ * directory.
+ *
+ * Log: wal.<FIRST_LSN> segments of fixed 32-byte records (deposit and
+ * withdrawal deltas, transfers, interest accruals), each carrying its log sequence
+ * number and a checksum so a torn tail is detected and dropped on
+ * recovery. Appends only copy the record into memory; a writer thread
+ * collects everything appended within the commit delay (the latency
+ * budget), writes it with one write() and makes it durable with one
+ * fdatasync(). Callers wait for their LSN after releasing any locks, so
+ * concurrent requests share fsyncs (group commit).
+ *
+ * Snapshots: snapshot.<LSN> files holding every allocated account page as
+ * of that LSN. The server forks and the child writes the copy-on-write
+ * image of the pages, so taking one only stalls mutations for the fork
+ * itself. The log is rotated at the snapshot LSN and older segments and
+ * snapshots are deleted once the new snapshot is on disk.
+ *
+ * A transfer is one record, so recovery never finds half of one.
+ *
+ * Ordering: deposits, withdrawals and transfers commute, so they run concurrently
+ * under a shared lock and log a delta. Interest does not commute with
+ * them and snapshots need a consistent cut, so both take the lock
+ * exclusively. An LSN is assigned while the lock is held, which makes log
+ * order a valid replay order. Balance reads settle interest, so they take
+ * the shared lock too, without logging anything.
+ *
+ * Recovery mmaps the newest snapshot, loads it, and replays the log
+ * records after its LSN.
+ *
+ * A Journal constructed with an empty directory is disabled: guards take
+ * no locks, log() returns 0 and waiting is a no-op.
+ */
+class Journal {
+public:
+    struct RecoveryStats {
+        uint64_t snapshot_lsn;      // 0 if no snapshot was found
+        uint64_t records_replayed;
+        uint64_t last_lsn;
+        double snapshot_seconds;
+        double replay_seconds;
+    };
+
+    // Holds the journal lock for one mutation and logs it with the LSN
+    // order matching the order it was applied in
+    class Mutation {
+    public:
+        Mutation(Journal& journal, bool exclusive = false);
+        ~Mutation();
+
+        Mutation(const Mutation&) = delete;
+        Mutation& operator=(const Mutation&) = delete;
+
+        // Returns the record's LSN, to be passed to wait_durable().
+        // counterpart is a TRANSFER's destination account.
+        uint64_t log(RequestType type, int user_id, Money amount, int counterpart = 0);
+
+    private:
+        Journal& journal;
+    };
+
+    Journal(const std::string& directory, AccountStore& accounts,
+            int commit_delay_us, int snapshot_interval_s);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    bool enabled() const;
+
+    // Loads the newest snapshot and replays the log into the (empty)
+    // account store, then starts the writer and snapshot threads. Must be
+    // called once before any mutation.
+    RecoveryStats recover();
+
+    // Blocks until every record up to lsn is on disk
+    void wait_durable(uint64_t lsn);
+
+    // Takes a snapshot now and waits for it; returns false if the
+    // snapshot child failed
+    bool snapshot();
+
+    // Counters for benchmarks
+    uint64_t sync_count() const;
+    uint64_t durable_lsn();
+
+private:
+    struct Record {
+        uint64_t lsn;
+        int64_t amount;
+        int32_t user_id;
+        uint16_t type;
+        uint16_t reserved;
+        uint32_t checksum;
+        int32_t counterpart;    // TRANSFER destination, 0 otherwise
+    };
+
+    uint64_t append(RequestType type, int user_id, Money amount, int counterpart);
+    void writer_loop();
+    void snapshot_loop();
+    void open_segment(uint64_t first_lsn);
+    void write_records(const std::vector<Record>& records, size_t first, size_t last);
+    void prune(uint64_t snapshot_lsn);
+    uint64_t load_snapshot(const std::string& path);
+    uint64_t replay_segment(const std::string& path, uint64_t after_lsn, uint64_t& last_lsn);
+    std::vector<std::pair<uint64_t, std::string> > list_files(const std::string& prefix);
+    static uint32_t compute_checksum(const Record& rec);
+
+    std::string directory;
+    AccountStore& accounts;
+    int commit_delay_us;
+    int snapshot_interval_s;
+
+    pthread_rwlock_t state_lock;  // shared: deltas, exclusive: interest and snapshots
+
+    // Group commit state, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable durable;
+    std::vector<Record> pending;
+    uint64_t next_lsn;
+    uint64_t synced_lsn;
+    uint64_t rotate_lsn;          // start a new segment before this LSN, 0 if none
+    bool stopping;
+    std::atomic<uint64_t> syncs;
+
+    int segment_fd;               // writer thread only
+    uint64_t last_snapshot_lsn;
+
+    std::mutex snapshot_mutex;    // one snapshot at a time
+    std::mutex snapshot_wait_mutex;
+    std::condition_variable snapshot_wakeup;
+    bool snapshot_stopping;
+
+    std::thread writer;
+    std::thread snapshotter;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "journal.h"
+#include "account_store.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <getopt.h>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Journal benchmark: group commit throughput (journaled deposits/s and
+// records per fsync) for several commit delays and thread counts, and
+// recovery time from a snapshot plus log tail versus from the log alone.
+
+void print_usage() {
+    cout << "Usage: ./journal_bench [-d DIR] [-n RECORDS] [-t MAX_THREADS] [-a ACCOUNTS] [-r TAIL]" << endl;
+    cout << "  -d, --dir          Scratch directory (default: a new directory in /tmp)" << endl;
+    cout << "  -n, --records      Durable deposits per thread (default: 2000)" << endl;
+    cout << "  -t, --threads      Highest thread count to measure (default: 8)" << endl;
+    cout << "  -a, --accounts     Accounts in the recovery test (default: 1000000)" << endl;
+    cout << "  -r, --tail         Log records after the snapshot (default: 100000)" << endl;
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+// Removes a journal directory (flat: segments and snapshots only)
+void remove_dir(const string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != nullptr) {
+            string name = entry->d_name;
+            if (name != "." && name != "..") unlink((dir + "/" + name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+// Every thread does records durable deposits, waiting for each one
+void run_commit(const string& dir, int delay_us, size_t threads, size_t records) {
+    AccountStore store(1000000);
+    Journal journal(dir, store, delay_us, 0);
+    journal.recover();
+    vector<thread> workers;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&store, &journal, t, records]() {
+            for (size_t i = 0; i < records; i++) {
+                int id = (int)((t * records + i) % 1000000);
+                uint64_t lsn;
+                {
+                    Journal::Mutation mutation(journal);
+                    store.deposit(id, money_from_units(1));
+                    lsn = mutation.log(DEPOSIT, id, money_from_units(1));
+                }
+                journal.wait_durable(lsn);
+            }
+        });
+    }
+    for (thread& w : workers) w.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    double total = (double)threads * records;
+    cout << setw(10) << delay_us << setw(8) << threads
+         << setw(14) << fixed << setprecision(0) << total / seconds
+         << setw(16) << setprecision(1) << total / journal.sync_count() << endl;
+    remove_dir(dir);
+}
+
+// Writes accounts deposits, optionally snapshots, then tail more records;
+// returns the recovered journal's statistics
+Journal::RecoveryStats run_recovery(const string& dir, size_t accounts, size_t tail, bool snapshot) {
+    {
+        AccountStore store(accounts);
+        Journal journal(dir, store, 1000, 0);
+        journal.recover();
+        uint64_t lsn = 0;
+        for (size_t i = 0; i < accounts; i++) {
+            Journal::Mutation mutation(journal);
+            store.deposit((int)i, money_from_units(10));
+            lsn = mutation.log(DEPOSIT, (int)i, money_from_units(10));
+        }
+        if (snapshot) {
+            journal.wait_durable(lsn);
+            if (!journal.snapshot()) cerr << "snapshot failed" << endl;
+        }
+        for (size_t i = 0; i < tail; i++) {
+            Journal::Mutation mutation(journal);
+            int id = (int)(i * 7919 % accounts);
+            store.deposit(id, money_from_units(1));
+            lsn = mutation.log(DEPOSIT, id, money_from_units(1));
+        }
+        journal.wait_durable(lsn);
+    }
+
+    AccountStore store(accounts);
+    Journal journal(dir, store, 1000, 0);
+    Journal::RecoveryStats stats = journal.recover();
+    remove_dir(dir);
+    return stats;
+}
+
+int main(int argc, char* argv[]) {
+    string dir;
+    size_t records = 2000;
+    size_t max_threads = 8;
+    size_t accounts = 1000000;
+    size_t tail = 100000;
+
+    static struct option long_options[] = {
+        {"dir", required_argument, 0, 'd'},
+        {"records", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 't'},
+        {"accounts", required_argument, 0, 'a'},
+        {"tail", required_argument, 0, 'r'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "d:n:t:a:r:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'd':
+                dir = optarg;
+                break;
+            case 'n':
+                records = strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                max_threads = strtoul(optarg, nullptr, 10);
+                break;
+            case 'a':
+                accounts = strtoul(optarg, nullptr, 10);
+                break;
+            case 'r':
+                tail = strtoul(optarg, nullptr, 10);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    if (dir.empty()) {
+        char templ[] = "/tmp/journal_bench.XXXXXX";
+        if (!mkdtemp(templ)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        dir = templ;
+    }
+
+    cout << "Group commit (durable deposits)" << endl;
+    cout << setw(10) << "delay us" << setw(8) << "threads"
+         << setw(14) << "records/s" << setw(16) << "records/fsync" << endl;
+    int delays[] = { 0, 200, 1000 };
+    for (int delay : delays) {
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            run_commit(dir + "/commit", delay, threads, records);
+        }
+    }
+
+    cout << endl << "Recovery (" << accounts << " accounts, " << tail << " tail records)" << endl;
+    cout << setw(16) << "source" << setw(14) << "snapshot ms" << setw(14) << "replay ms"
+         << setw(12) << "replayed" << endl;
+    for (int snapshot = 1; snapshot >= 0; snapshot--) {
+        Journal::RecoveryStats stats = run_recovery(dir + "/recovery", accounts, tail, snapshot);
+        cout << setw(16) << (snapshot ? "snapshot + tail" : "log only")
+             << setw(14) << fixed << setprecision(1) << stats.snapshot_seconds * 1000
+             << setw(14) << stats.replay_seconds * 1000
+             << setw(12) << stats.records_replayed << endl;
+    }
+
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+    const uint64_t SUB_BUCKETS = (uint64_t)1 << LatencyHistogram::SUB_BITS;
+
+    // One row of sub-buckets below 2^SUB_BITS, then one per remaining bit
+    const size_t BUCKET_COUNT = (64 - LatencyHistogram::SUB_BITS + 1) * SUB_BUCKETS;
+}
+
+LatencyHistogram::LatencyHistogram() : buckets(BUCKET_COUNT, 0) {
+    reset();
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t value) {
+    if (value < SUB_BUCKETS) return value;
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::highest_in_bucket(size_t bucket) {
+    if (bucket < SUB_BUCKETS) return bucket;
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    buckets[bucket_of(value)]++;
+    total++;
+    lowest = std::min(lowest, value);
+    highest = std::max(highest, value);
+    sum += value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < buckets.size(); i++) buckets[i] += other.buckets[i];
+    total += other.total;
+    lowest = std::min(lowest, other.lowest);
+    highest = std::max(highest, other.highest);
+    sum += other.sum;
+}
+
+void LatencyHistogram::reset() {
+    fill(buckets.begin(), buckets.end(), 0);
+    total = 0;
+    lowest = UINT64_MAX;
+    highest = 0;
+    sum = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)ceil(total * std::min(std::max(percentile, 0.0), 100.0) / 100.0);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) return std::min(highest_in_bucket(i), highest);
+    }
+    return highest;
+}
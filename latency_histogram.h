@@ -0,0 +1,52 @@
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * LatencyHistogram class
+ *
+ * HDR-style histogram of non-negative integer values (latencies in
+ * nanoseconds, say). Values below 2^SUB_BITS get a bucket each; above
+ * that, every power of two is split into 2^SUB_BITS linear sub-buckets,
+ * so any recorded value is known to within 1 part in 2^SUB_BITS (under
+ * 1%) over the whole 64-bit range, in a fixed 58 KB of counters.
+ * Percentiles report the highest value equivalent to the bucket they fall
+ * in, so they never understate a latency.
+ *
+ * Recording is a few instructions and never allocates. A histogram is not
+ * thread-safe: give each thread its own and merge() them afterwards.
+ */
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 7;
+
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? lowest : 0; }
+    uint64_t max() const { return highest; }
+    double mean() const { return total ? (double)sum / total : 0; }
+
+    // Smallest value v such that at least percentile% of the recorded
+    // values are <= v (at the histogram's precision); 0 when empty
+    uint64_t percentile(double percentile) const;
+
+private:
+    static size_t bucket_of(uint64_t value);
+    static uint64_t highest_in_bucket(size_t bucket);
+
+    std::vector<uint64_t> buckets;
+    uint64_t total;
+    uint64_t lowest;
+    uint64_t highest;
+    long double sum;
+};
+
+#endif
@@ -0,0 +1,465 @@
+#include "network_channel.h"
+#include "latency_histogram.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+#include <getopt.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+// Open-loop load generator: every thread starts requests on a fixed
+// schedule, its share of the target rate, whatever the servers' latency.
+// Latency is measured from when a request was due to be sent, not from
+// when it was sent, so a stalled server cannot hide queueing delay
+// (no coordinated omission). Reports ops/s and latency percentiles per
+// operation and can write them as JSON for comparing builds.
+
+typedef chrono::steady_clock Clock;
+
+enum Operation { OP_DEPOSIT, OP_WITHDRAW, OP_TRANSFER, OP_BALANCE, OP_INTEREST, OP_UPLOAD, OP_DOWNLOAD, OP_LOG, NUM_OPS };
+enum Server { FINANCE, FILE_SERVER, LOGGING, NUM_SERVERS };
+
+const char* OP_NAMES[NUM_OPS] = {"deposit", "withdraw", "transfer", "balance", "interest", "upload", "download", "log"};
+const Server OP_SERVERS[NUM_OPS] = {FINANCE, FINANCE, FINANCE, FINANCE, FINANCE, FILE_SERVER, FILE_SERVER, LOGGING};
+const char* SERVER_NAMES[NUM_SERVERS] = {"finance", "file", "logging"};
+
+const string SEED_FILE = "loadgen-seed.bin";
+
+struct Config {
+    string host;
+    int ports[NUM_SERVERS];
+    double rate;
+    double seconds;
+    size_t threads;
+    size_t window;
+    int users;
+    size_t file_bytes;
+    double mix[NUM_OPS];
+    string output;
+};
+
+struct Results {
+    LatencyHistogram latency[NUM_OPS];
+    uint64_t refused[NUM_OPS];  // answered with success false
+    uint64_t failed[NUM_OPS];   // never answered: the connection failed
+
+    Results() {
+        for (int i = 0; i < NUM_OPS; i++) refused[i] = failed[i] = 0;
+    }
+
+    void merge(const Results& other) {
+        for (int i = 0; i < NUM_OPS; i++) {
+            latency[i].merge(other.latency[i]);
+            refused[i] += other.refused[i];
+            failed[i] += other.failed[i];
+        }
+    }
+};
+
+// One load thread's connection to one server. The load thread sends; a
+// receiver thread matches replies to the slot recorded for their request
+// ID. Servers answer in order, so a slot is free again once window newer
+// requests have been sent.
+class Stream {
+public:
+    Stream(const string& host, int port, size_t _window)
+        : channel(host, port, NetworkRequestChannel::CLIENT_SIDE), slots(_window),
+          next_id(0), in_flight(0), broken(false) {
+        receiver = thread([this] { receive_loop(); });
+    }
+
+    ~Stream() {
+        shutdown(channel.get_socket_fd(), SHUT_RDWR);
+        if (receiver.joinable()) receiver.join();
+    }
+
+    // Waits for a free slot, then sends; false if the connection is gone
+    bool send(const Request& req, Operation op, Clock::time_point due) {
+        uint32_t id;
+        {
+            unique_lock<mutex> lock(mutex_);
+            slot_free.wait(lock, [this] { return broken || in_flight < slots.size(); });
+            if (broken) return false;
+            id = next_id++;
+            slots[id % slots.size()] = Slot(due, op);
+            in_flight++;
+        }
+        try {
+            channel.send_tagged(req, id);
+        } catch (const exception&) {
+            // The caller counts this one; drain() counts the rest
+            lock_guard<mutex> lock(mutex_);
+            next_id--;
+            in_flight--;
+            broken = true;
+            return false;
+        }
+        return true;
+    }
+
+    // Waits up to timeout for outstanding replies, then counts the rest as failed
+    void drain(chrono::milliseconds timeout) {
+        unique_lock<mutex> lock(mutex_);
+        slot_free.wait_for(lock, timeout, [this] { return broken || in_flight == 0; });
+        for (uint32_t id = next_id - in_flight; id != next_id; id++) {
+            results.failed[slots[id % slots.size()].op]++;
+        }
+        in_flight = 0;
+        broken = true;
+    }
+
+    // Valid once drained
+    Results results;
+
+private:
+    struct Slot {
+        Clock::time_point due;
+        Operation op;
+
+        Slot() : op(OP_DEPOSIT) {}
+        Slot(Clock::time_point _due, Operation _op) : due(_due), op(_op) {}
+    };
+
+    void receive_loop() {
+        try {
+            while (true) {
+                Response resp = channel.receive_tagged();
+                Clock::time_point now = Clock::now();
+                lock_guard<mutex> lock(mutex_);
+                if (broken) break;
+                const Slot& slot = slots[resp.request_id % slots.size()];
+                results.latency[slot.op].record(chrono::duration_cast<chrono::nanoseconds>(now - slot.due).count());
+                if (!resp.success) results.refused[slot.op]++;
+                in_flight--;
+                slot_free.notify_all();
+            }
+        } catch (const exception&) {
+            lock_guard<mutex> lock(mutex_);
+            broken = true;
+            slot_free.notify_all();
+        }
+    }
+
+    NetworkRequestChannel channel;
+    mutex mutex_;
+    condition_variable slot_free;
+    vector<Slot> slots;
+    uint32_t next_id;
+    size_t in_flight;
+    bool broken;
+    thread receiver;
+};
+
+// other is a second account, the destination of a transfer
+Request make_request(Operation op, int user, int other, size_t thread_index, const string& file_data) {
+    switch (op) {
+        case OP_DEPOSIT: return Request(DEPOSIT, user, money_from_units(10));
+        case OP_WITHDRAW: return Request(WITHDRAW, user, money_from_units(1));
+        case OP_TRANSFER: return Request(TRANSFER, user, money_from_units(1), "", to_string(other));
+        case OP_BALANCE: return Request(BALANCE, user);
+        case OP_INTEREST: return Request(EARN_INTEREST, user);
+        case OP_UPLOAD: return Request(UPLOAD_FILE, user, 0, "loadgen-" + to_string(thread_index) + ".bin", file_data);
+        case OP_DOWNLOAD: return Request(DOWNLOAD_FILE, user, 0, SEED_FILE);
+        default: return Request(DEPOSIT, user, money_from_units(10)); // an audit record
+    }
+}
+
+// One load thread: requests due every threads / rate seconds, offset so the
+// threads interleave
+Results run_thread(const Config& config, size_t index, Clock::time_point start, const string& file_data) {
+    unique_ptr<Stream> streams[NUM_SERVERS];
+    for (int op = 0; op < NUM_OPS; op++) {
+        Server server = OP_SERVERS[op];
+        if (config.mix[op] > 0 && !streams[server]) {
+            try {
+                streams[server].reset(new Stream(config.host, config.ports[server], config.window));
+            } catch (const exception& e) {
+                throw runtime_error(string(SERVER_NAMES[server]) + " server: " + e.what());
+            }
+        }
+    }
+
+    mt19937_64 rng(index * 7919 + 1);
+    discrete_distribution<int> pick_op(config.mix, config.mix + NUM_OPS);
+    uniform_int_distribution<int> pick_user(1, config.users);
+
+    Results failures;
+    chrono::duration<double> interval(config.threads / config.rate);
+    Clock::time_point end = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(config.seconds));
+    for (uint64_t k = 0; ; k++) {
+        Clock::time_point due = start + chrono::duration_cast<Clock::duration>(
+            interval * (k + (double)index / config.threads));
+        if (due >= end) break;
+        this_thread::sleep_until(due);
+
+        Operation op = (Operation)pick_op(rng);
+        int user = pick_user(rng);
+        Request req = make_request(op, user, pick_user(rng), index, file_data);
+        if (!streams[OP_SERVERS[op]]->send(req, op, due)) failures.failed[op]++;
+    }
+
+    Results results = failures;
+    for (int server = 0; server < NUM_SERVERS; server++) {
+        if (!streams[server]) continue;
+        streams[server]->drain(chrono::milliseconds(10000));
+        results.merge(streams[server]->results);
+    }
+    return results;
+}
+
+bool parse_mix(const string& text, double mix[NUM_OPS]) {
+    for (int i = 0; i < NUM_OPS; i++) mix[i] = 0;
+    stringstream items(text);
+    string item;
+    while (getline(items, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+        string name = item.substr(0, eq);
+        int op = 0;
+        while (op < NUM_OPS && name != OP_NAMES[op]) op++;
+        if (op == NUM_OPS) return false;
+        mix[op] = atof(item.substr(eq + 1).c_str());
+        if (mix[op] < 0) return false;
+    }
+    for (int i = 0; i < NUM_OPS; i++) {
+        if (mix[i] > 0) return true;
+    }
+    return false;
+}
+
+double to_us(uint64_t ns) {
+    return ns / 1000.0;
+}
+
+void print_row(const string& name, const LatencyHistogram& h, uint64_t refused, uint64_t failed, double seconds) {
+    cout << setw(10) << name << setw(10) << h.count() << setw(10) << fixed << setprecision(1) << h.count() / seconds
+         << setw(9) << refused << setw(8) << failed
+         << setw(11) << to_us(h.percentile(50)) << setw(11) << to_us(h.percentile(99))
+         << setw(11) << to_us(h.percentile(99.9)) << setw(12) << to_us(h.max()) << endl;
+}
+
+void write_latency_json(ostream& out, const LatencyHistogram& h, uint64_t refused, uint64_t failed, double seconds) {
+    out << "{\"count\": " << h.count() << ", \"ops_per_sec\": " << h.count() / seconds
+        << ", \"refused\": " << refused << ", \"failed\": " << failed
+        << ", \"mean_us\": " << h.mean() / 1000.0 << ", \"p50_us\": " << to_us(h.percentile(50))
+        << ", \"p90_us\": " << to_us(h.percentile(90)) << ", \"p99_us\": " << to_us(h.percentile(99))
+        << ", \"p999_us\": " << to_us(h.percentile(99.9)) << ", \"max_us\": " << to_us(h.max()) << "}";
+}
+
+bool write_json(const string& path, const Config& config, const Results& results,
+                const LatencyHistogram& all, uint64_t refused, uint64_t failed, double seconds) {
+    ofstream out(path);
+    out << fixed << setprecision(3);
+    out << "{\n  \"config\": {\"rate\": " << config.rate << ", \"seconds\": " << config.seconds
+        << ", \"threads\": " << config.threads << ", \"window\": " << config.window
+        << ", \"users\": " << config.users << ", \"file_bytes\": " << config.file_bytes << ", \"mix\": {";
+    bool first = true;
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (config.mix[op] <= 0) continue;
+        out << (first ? "" : ", ") << "\"" << OP_NAMES[op] << "\": " << config.mix[op];
+        first = false;
+    }
+    out << "}},\n  \"total\": ";
+    write_latency_json(out, all, refused, failed, seconds);
+    out << ",\n  \"operations\": {";
+    first = true;
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (config.mix[op] <= 0) continue;
+        out << (first ? "\n" : ",\n") << "    \"" << OP_NAMES[op] << "\": ";
+        write_latency_json(out, results.latency[op], results.refused[op], results.failed[op], seconds);
+        first = false;
+    }
+    out << "\n  }\n}\n";
+    return (bool)out;
+}
+
+void print_usage() {
+    cout << "Usage: ./loadgen [-r RATE] [-d SECONDS] [-t THREADS] [-w WINDOW] [-m MIX] [-u USERS] [-s BYTES] [-o FILE]" << endl;
+    cout << "  -r, --rate         Requests started per second, all threads together (default: 1000)" << endl;
+    cout << "  -d, --duration     Seconds to run (default: 10)" << endl;
+    cout << "  -t, --threads      Load threads, each with its own connections (default: 4)" << endl;
+    cout << "  -w, --window       Most requests in flight per connection (default: 128)" << endl;
+    cout << "  -m, --mix          Operation weights, e.g. deposit=40,balance=50,log=10" << endl;
+    cout << "                     (deposit withdraw transfer balance interest upload download log;" << endl;
+    cout << "                     default: deposit=30,withdraw=20,balance=30,upload=5,download=5,log=10)" << endl;
+    cout << "  -u, --users        Account IDs used, from 1 (default: 100)" << endl;
+    cout << "  -s, --file-size    Bytes per uploaded and downloaded file (default: 4096)" << endl;
+    cout << "  -o, --output       Also write the results to FILE as JSON" << endl;
+    cout << "  -H, --host         Server host (default: 127.0.0.1)" << endl;
+    cout << "  --finance-port=PORT, --file-port=PORT, --logging-port=PORT (default: 8000, 8001, 8002)" << endl;
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    config.host = "127.0.0.1";
+    config.ports[FINANCE] = 8000;
+    config.ports[FILE_SERVER] = 8001;
+    config.ports[LOGGING] = 8002;
+    config.rate = 1000;
+    config.seconds = 10;
+    config.threads = 4;
+    config.window = 128;
+    config.users = 100;
+    config.file_bytes = 4096;
+    parse_mix("deposit=30,withdraw=20,balance=30,upload=5,download=5,log=10", config.mix);
+
+    static struct option long_options[] = {
+        {"rate", required_argument, 0, 'r'},
+        {"duration", required_argument, 0, 'd'},
+        {"threads", required_argument, 0, 't'},
+        {"window", required_argument, 0, 'w'},
+        {"mix", required_argument, 0, 'm'},
+        {"users", required_argument, 0, 'u'},
+        {"file-size", required_argument, 0, 's'},
+        {"output", required_argument, 0, 'o'},
+        {"host", required_argument, 0, 'H'},
+        {"finance-port", required_argument, 0, 0},
+        {"file-port", required_argument, 0, 0},
+        {"logging-port", required_argument, 0, 0},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "r:d:t:w:m:u:s:o:H:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 0:
+                if (string(long_options[option_index].name) == "finance-port") {
+                    config.ports[FINANCE] = atoi(optarg);
+                } else if (string(long_options[option_index].name) == "file-port") {
+                    config.ports[FILE_SERVER] = atoi(optarg);
+                } else if (string(long_options[option_index].name) == "logging-port") {
+                    config.ports[LOGGING] = atoi(optarg);
+                }
+                break;
+            case 'r':
+                config.rate = atof(optarg);
+                break;
+            case 'd':
+                config.seconds = atof(optarg);
+                break;
+            case 't':
+                config.threads = max(atoi(optarg), 1);
+                break;
+            case 'w':
+                config.window = max(atoi(optarg), 1);
+                break;
+            case 'm':
+                if (!parse_mix(optarg, config.mix)) {
+                    cerr << "Bad operation mix: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'u':
+                config.users = max(atoi(optarg), 1);
+                break;
+            case 's':
+                config.file_bytes = max(atol(optarg), 0L);
+                break;
+            case 'o':
+                config.output = optarg;
+                break;
+            case 'H':
+                config.host = optarg;
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    if (config.rate <= 0 || config.seconds <= 0) {
+        print_usage();
+        return 1;
+    }
+
+    string file_data(config.file_bytes, 'x');
+    vector<Results> results(config.threads);
+    double seconds;
+    try {
+        // Downloads need a file to fetch
+        if (config.mix[OP_DOWNLOAD] > 0) {
+            NetworkRequestChannel seed(config.host, config.ports[FILE_SERVER], NetworkRequestChannel::CLIENT_SIDE);
+            Response resp = seed.send_request(Request(UPLOAD_FILE, 1, 0, SEED_FILE, file_data));
+            seed.send_request(Request(QUIT));
+            if (!resp.success) {
+                cerr << "Could not upload " << SEED_FILE << ": " << resp.message << endl;
+                return 1;
+            }
+        }
+
+        cout << "Offering " << config.rate << " requests/s for " << config.seconds << " s from "
+             << config.threads << " threads" << endl;
+
+        // Leave time for every thread to connect before the first request is due
+        Clock::time_point start = Clock::now() + chrono::milliseconds(200);
+        vector<thread> workers;
+        vector<string> errors(config.threads);
+        for (size_t t = 0; t < config.threads; t++) {
+            workers.emplace_back([&config, &results, &errors, &file_data, start, t]() {
+                try {
+                    results[t] = run_thread(config, t, start, file_data);
+                } catch (const exception& e) {
+                    errors[t] = e.what();
+                }
+            });
+        }
+        for (thread& worker : workers) worker.join();
+        seconds = chrono::duration<double>(Clock::now() - start).count();
+
+        for (const string& error : errors) {
+            if (!error.empty()) {
+                cerr << "Load thread failed: " << error << endl;
+                return 1;
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Load generation failed: " << e.what() << endl;
+        return 1;
+    }
+
+    Results merged;
+    for (const Results& r : results) merged.merge(r);
+    LatencyHistogram all;
+    uint64_t refused = 0, failed = 0;
+    for (int op = 0; op < NUM_OPS; op++) {
+        all.merge(merged.latency[op]);
+        refused += merged.refused[op];
+        failed += merged.failed[op];
+    }
+
+    cout << setw(10) << "operation" << setw(10) << "count" << setw(10) << "ops/s" << setw(9) << "refused"
+         << setw(8) << "failed" << setw(11) << "p50 us" << setw(11) << "p99 us" << setw(11) << "p999 us"
+         << setw(12) << "max us" << endl;
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (config.mix[op] > 0) {
+            print_row(OP_NAMES[op], merged.latency[op], merged.refused[op], merged.failed[op], seconds);
+        }
+    }
+    print_row("total", all, refused, failed, seconds);
+
+    if (!config.output.empty()) {
+        if (!write_json(config.output, config, merged, all, refused, failed, seconds)) {
+            cerr << "Could not write " << config.output << endl;
+            return 1;
+        }
+        cout << "Results written to " << config.output << endl;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,417 @@
+#include "log_writer.h"
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <ctime>
+#include <algorithm>
+#include <zlib.h>
+
+using namespace std;
+
+namespace {
+    // Recognises <base>.<YYYYmmdd-HHMMSS>[-N][.gz] and returns the name
+    // without ".gz" in stem, so plain and compressed files sort together
+    bool parse_rotated(const string& name, const string& base, string& stem, bool& compressed) {
+        if (name.size() < base.size() + 16 || name.compare(0, base.size(), base) != 0 || name[base.size()] != '.') {
+            return false;
+        }
+        stem = name;
+        compressed = stem.size() > 3 && stem.compare(stem.size() - 3, 3, ".gz") == 0;
+        if (compressed) stem.erase(stem.size() - 3);
+
+        const char* p = stem.c_str() + base.size() + 1;
+        for (int i = 0; i < 15; i++) {
+            if (i == 8 ? p[i] != '-' : (p[i] < '0' || p[i] > '9')) return false;
+        }
+        p += 15;
+        if (*p == '-') {
+            p++;
+            if (*p == '\0') return false;
+            while (*p >= '0' && *p <= '9') p++;
+        }
+        return *p == '\0';
+    }
+
+    bool file_exists(const string& name) {
+        struct stat st;
+        return stat(name.c_str(), &st) == 0;
+    }
+}
+
+LogWriter::LogWriter(const string& _path, FlushPolicy _policy, int interval_ms,
+                     const Rotation& _rotation, size_t capacity)
+    : path(_path), fd(-1), policy(_policy), interval(interval_ms > 0 ? interval_ms : 1),
+      rotation(_rotation), file_bytes(0), file_opened(chrono::steady_clock::now()),
+      ring(nullptr), mask(0), enqueue_pos(0), dequeue_pos(0), written_pos(0),
+      sleeping(false), stopping(false), synced_pos(0), flush_request(0), failed(false),
+      compress_pending(true), compress_stopping(false) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    mask = size - 1;
+
+    size_t slash = path.rfind('/');
+    directory = slash == string::npos ? "./" : path.substr(0, slash + 1);
+    base_name = slash == string::npos ? path : path.substr(slash + 1);
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw runtime_error("Log file open failed!");
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) file_bytes = st.st_size;
+
+    ring = new Slot[size];
+    for (size_t i = 0; i < size; i++) {
+        ring[i].sequence.store(i, memory_order_relaxed);
+        ring[i].durable = false;
+    }
+
+    writer = thread([this] { writer_loop(); });
+
+    // Also picks up files left uncompressed by a previous run
+    if (rotation.max_bytes > 0 || rotation.max_age_s > 0 || rotation.keep_count > 0 || rotation.keep_age_s > 0) {
+        compressor = thread([this] { compressor_loop(); });
+    }
+}
+
+LogWriter::~LogWriter() {
+    stopping = true;
+    {
+        lock_guard<mutex> lock(wake_mutex);
+        wake.notify_one();
+    }
+    writer.join();
+    close(fd);
+    delete[] ring;
+
+    {
+        lock_guard<mutex> lock(compress_mutex);
+        compress_stopping = true;
+    }
+    compress_wake.notify_one();
+    if (compressor.joinable()) compressor.join();
+}
+
+// Bounded MPMC queue (Vyukov): a slot is free for ticket pos when its
+// sequence equals pos and holds the line for pos once it equals pos + 1.
+// Returns the position just past the queued line.
+size_t LogWriter::push(string& line, bool durable) {
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &ring[pos & mask];
+        size_t seq = slot->sequence.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Full: wait for the writer to free a slot
+            this_thread::yield();
+            pos = enqueue_pos.load(memory_order_relaxed);
+        } else {
+            pos = enqueue_pos.load(memory_order_relaxed);
+        }
+    }
+
+    slot->line.swap(line);
+    slot->durable = durable;
+    slot->sequence.store(pos + 1); // seq_cst, pairs with the writer's sleeping flag
+    return pos + 1;
+}
+
+bool LogWriter::append(string line, bool durable) {
+    size_t position = push(line, durable);
+
+    if (durable || sleeping.load()) {
+        lock_guard<mutex> lock(wake_mutex);
+        wake.notify_one();
+    }
+    return !durable || wait_synced(position);
+}
+
+bool LogWriter::flush() {
+    size_t target = enqueue_pos.load();
+    {
+        lock_guard<mutex> lock(sync_mutex);
+        if (target > flush_request) flush_request = target;
+    }
+    {
+        lock_guard<mutex> lock(wake_mutex);
+        wake.notify_one();
+    }
+    return wait_synced(target);
+}
+
+// True once position is synced, false if the writer failed first
+bool LogWriter::wait_synced(size_t position) {
+    unique_lock<mutex> lock(sync_mutex);
+    synced.wait(lock, [this, position] { return synced_pos >= position || failed; });
+    return synced_pos >= position;
+}
+
+// Enters the failed state and releases every waiter
+void LogWriter::fail(const char* what) {
+    cerr << what << ": " << strerror(errno) << "; dropping log lines from now on" << endl;
+    {
+        lock_guard<mutex> lock(sync_mutex);
+        failed = true;
+    }
+    synced.notify_all();
+}
+
+// Moves up to MAX_BATCH published lines out of the ring
+size_t LogWriter::drain(vector<string>& batch, bool& durable) {
+    size_t count = 0;
+    while (count < MAX_BATCH) {
+        Slot& slot = ring[dequeue_pos & mask];
+        if (slot.sequence.load(memory_order_acquire) != dequeue_pos + 1) break;
+
+        batch.push_back(string());
+        batch.back().swap(slot.line);
+        durable = durable || slot.durable;
+        slot.sequence.store(dequeue_pos + mask + 1, memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+    return count;
+}
+
+// Adds the bytes that reached the file to written; false if not all did
+bool LogWriter::write_batch(vector<string>& batch, size_t& written) {
+    struct iovec iov[MAX_BATCH];
+    size_t count = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (batch[i].empty()) continue;
+        iov[count].iov_base = const_cast<char*>(batch[i].data());
+        iov[count].iov_len = batch[i].size();
+        count++;
+    }
+
+    // writev may stop short; continue from wherever it did
+    struct iovec* next = iov;
+    while (count > 0) {
+        ssize_t n = writev(fd, next, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += n;
+        while (count > 0 && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + n;
+            next->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+void LogWriter::sync_to(size_t position) {
+    if (fdatasync(fd) < 0) {
+        fail("Log sync failed");
+        return;
+    }
+    {
+        lock_guard<mutex> lock(sync_mutex);
+        synced_pos = position;
+    }
+    synced.notify_all();
+}
+
+void LogWriter::writer_loop() {
+    vector<string> batch;
+    batch.reserve(MAX_BATCH);
+    chrono::steady_clock::time_point last_sync = chrono::steady_clock::now();
+    chrono::milliseconds idle_wait = policy == FLUSH_INTERVAL ? interval : chrono::milliseconds(100);
+
+    while (true) {
+        bool durable = false;
+        size_t count = drain(batch, durable);
+        if (count > 0) {
+            // After a failure lines are still drained, so producers never
+            // block on a full ring
+            if (!failed) {
+                size_t written = 0;
+                bool ok = write_batch(batch, written);
+                file_bytes += written;
+                if (ok) written_pos = dequeue_pos;
+                else fail("Log write failed");
+            }
+            batch.clear();
+        }
+
+        size_t requested;
+        {
+            lock_guard<mutex> lock(sync_mutex);
+            requested = flush_request;
+        }
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        bool unsynced = !failed && written_pos > synced_pos;
+        if (unsynced && (durable || (policy == FLUSH_BATCH && count > 0)
+                || (policy == FLUSH_INTERVAL && now - last_sync >= interval)
+                || (requested > synced_pos && written_pos >= requested))) {
+            sync_to(written_pos);
+            last_sync = now;
+        }
+        if (!failed && rotation_due(now)) {
+            rotate(now);
+            last_sync = now;
+        }
+
+        if (count > 0) continue;
+        if (stopping) break;
+
+        // Sleep until a producer publishes, flush() asks, or the interval ends
+        unique_lock<mutex> lock(wake_mutex);
+        sleeping = true;
+        if (ring[dequeue_pos & mask].sequence.load() != dequeue_pos + 1 && !stopping) {
+            wake.wait_for(lock, idle_wait);
+        }
+        sleeping = false;
+    }
+
+    if (!failed && written_pos > synced_pos) sync_to(written_pos);
+}
+
+bool LogWriter::rotation_due(chrono::steady_clock::time_point now) const {
+    if (file_bytes == 0) return false;
+    if (rotation.max_bytes > 0 && file_bytes >= rotation.max_bytes) return true;
+    return rotation.max_age_s > 0 && now - file_opened >= chrono::seconds(rotation.max_age_s);
+}
+
+// Swaps in a fresh file; runs on the writer thread between two batches
+void LogWriter::rotate(chrono::steady_clock::time_point now) {
+    // Everything in the old file is durable before it is renamed
+    if (written_pos > synced_pos) sync_to(written_pos);
+    if (failed) return;
+
+    time_t seconds = time(nullptr);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    string target = path + "." + stamp;
+    for (int n = 1; file_exists(target) || file_exists(target + ".gz"); n++) {
+        target = path + "." + stamp + "-" + to_string(n);
+    }
+
+    // On failure keep writing to the current file and try again later
+    file_opened = now;
+    if (rename(path.c_str(), target.c_str()) < 0) {
+        cerr << "Log rotation failed: " << strerror(errno) << endl;
+        return;
+    }
+    int new_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (new_fd < 0) {
+        cerr << "Log reopen failed: " << strerror(errno) << endl;
+        return;
+    }
+    close(fd);
+    fd = new_fd;
+    file_bytes = 0;
+
+    {
+        lock_guard<mutex> lock(compress_mutex);
+        compress_pending = true;
+    }
+    compress_wake.notify_one();
+}
+
+void LogWriter::compressor_loop() {
+    unique_lock<mutex> lock(compress_mutex);
+    while (true) {
+        compress_wake.wait(lock, [this] { return compress_pending || compress_stopping; });
+        if (!compress_pending) break;
+        compress_pending = false;
+        lock.unlock();
+
+        vector<string> plain;
+        DIR* dir = opendir(directory.c_str());
+        if (dir) {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                string stem;
+                bool compressed;
+                if (parse_rotated(entry->d_name, base_name, stem, compressed) && !compressed) {
+                    plain.push_back(directory + entry->d_name);
+                }
+            }
+            closedir(dir);
+        }
+        if (rotation.compress) {
+            for (const string& name : plain) compress_file(name);
+        }
+        apply_retention();
+
+        lock.lock();
+    }
+}
+
+// Writes name.gz next to name and removes name
+void LogWriter::compress_file(const string& name) {
+    int in = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return;
+    string temp = name + ".gz.tmp";
+    int out = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return;
+    }
+
+    gzFile gz = gzdopen(dup(out), "wb6");
+    bool ok = gz != nullptr;
+    char buffer[65536];
+    ssize_t n;
+    while (ok && (n = read(in, buffer, sizeof(buffer))) > 0) {
+        ok = gzwrite(gz, buffer, (unsigned)n) == (int)n;
+    }
+    if (gz && gzclose(gz) != Z_OK) ok = false;
+    ok = ok && fsync(out) == 0;
+    close(out);
+    close(in);
+
+    if (ok && rename(temp.c_str(), (name + ".gz").c_str()) == 0) {
+        unlink(name.c_str());
+    } else {
+        cerr << "Log compression failed for " << name << endl;
+        unlink(temp.c_str());
+    }
+}
+
+// Deletes rotated files beyond the count limit (oldest first) or the age limit
+void LogWriter::apply_retention() {
+    if (rotation.keep_count == 0 && rotation.keep_age_s == 0) return;
+
+    vector<pair<string, string> > files;  // stem, file name
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        string stem;
+        bool compressed;
+        if (parse_rotated(entry->d_name, base_name, stem, compressed)) {
+            files.push_back(make_pair(stem, directory + entry->d_name));
+        }
+    }
+    closedir(dir);
+    sort(files.begin(), files.end());
+
+    time_t now = time(nullptr);
+    for (size_t i = 0; i < files.size(); i++) {
+        bool too_many = rotation.keep_count > 0 && files.size() - i > rotation.keep_count;
+        struct stat st;
+        bool too_old = rotation.keep_age_s > 0 && stat(files[i].second.c_str(), &st) == 0
+                       && now - st.st_mtime > rotation.keep_age_s;
+        if (too_many || too_old) unlink(files[i].second.c_str());
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef _LOG_WRITER_H_
+#define _LOG_WRITER_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+
+/*
+ * LogWriter class
+ *
+ * Asynchronous appender for the logging server. Connection threads push
+ * finished lines into a bounded lock-free multi-producer ring buffer; one
+ * writer thread keeps the file open, drains whatever is queued and writes
+ * it with a single writev() per batch.
+ *
+ * Flush policy:
+ *   FLUSH_BATCH     fdatasync after every batch
+ *   FLUSH_INTERVAL  fdatasync at most once per interval
+ *   FLUSH_NONE      write only; the kernel decides when data hits disk
+ *
+ * Independently of the policy, a line appended with durable = true (used
+ * for audit-critical records) does not return until the batch holding it
+ * has been synced, so the caller can acknowledge it safely.
+ *
+ * A failed write or sync is final: nothing not yet on disk counts as
+ * written or synced, durable appends and flush() return false from then
+ * on, and later lines are dropped. Data whose fsync failed cannot be
+ * trusted to reach the disk on a retry.
+ *
+ * When the ring is full producers yield until the writer catches up.
+ *
+ * Rotation: the writer thread checks the file's size and age after every
+ * batch. When a limit is reached it syncs the file, renames it to
+ * <path>.<YYYYmmdd-HHMMSS> and opens a fresh one, all between two writes,
+ * so producers never wait on it. A separate compressor thread gzips rotated
+ * files and then deletes those beyond the count or age limit.
+ */
+class LogWriter {
+public:
+    enum FlushPolicy { FLUSH_BATCH, FLUSH_INTERVAL, FLUSH_NONE };
+
+    static const size_t DEFAULT_CAPACITY = 65536; // ring slots, power of two
+    static const size_t MAX_BATCH = 1024;         // lines per writev (IOV_MAX)
+
+    // Rotation and retention settings; a zero limit is disabled
+    struct Rotation {
+        size_t max_bytes;   // rotate once the file has grown to this size
+        int max_age_s;      // rotate once the file has been open this long
+        size_t keep_count;  // rotated files to keep
+        int keep_age_s;     // delete rotated files older than this
+        bool compress;      // gzip rotated files
+
+        Rotation() : max_bytes(0), max_age_s(0), keep_count(0), keep_age_s(0), compress(true) {}
+    };
+
+    LogWriter(const std::string& path, FlushPolicy policy, int interval_ms,
+              const Rotation& rotation = Rotation(), size_t capacity = DEFAULT_CAPACITY);
+    ~LogWriter();
+
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator=(const LogWriter&) = delete;
+
+    // Queues one line (including its trailing newline). A durable line
+    // returns false if it could not be synced.
+    bool append(std::string line, bool durable = false);
+
+    // Blocks until every line appended so far is written and synced;
+    // false if that failed
+    bool flush();
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        std::string line;
+        bool durable;
+    };
+
+    size_t push(std::string& line, bool durable);
+    size_t drain(std::vector<std::string>& batch, bool& durable);
+    bool write_batch(std::vector<std::string>& batch, size_t& written);
+    void sync_to(size_t position);
+    bool wait_synced(size_t position);
+    void fail(const char* what);
+    void writer_loop();
+
+    bool rotation_due(std::chrono::steady_clock::time_point now) const;
+    void rotate(std::chrono::steady_clock::time_point now);
+    void compressor_loop();
+    void compress_file(const std::string& name);
+    void apply_retention();
+
+    std::string path;
+    std::string directory;            // of path, for finding rotated files
+    std::string base_name;
+    int fd;
+    FlushPolicy policy;
+    std::chrono::milliseconds interval;
+    Rotation rotation;
+
+    // Writer thread only
+    size_t file_bytes;
+    std::chrono::steady_clock::time_point file_opened;
+
+    Slot* ring;
+    size_t mask;
+
+    char pad0[64];
+    std::atomic<size_t> enqueue_pos;  // next ticket handed to a producer
+    char pad1[64];
+    size_t dequeue_pos;               // writer thread only
+    size_t written_pos;               // writer thread only
+
+    // Writer sleep/wake
+    std::atomic<bool> sleeping;
+    std::atomic<bool> stopping;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+
+    // Durability tracking
+    std::mutex sync_mutex;
+    std::condition_variable synced;
+    size_t synced_pos;
+    size_t flush_request;             // flush() asks for a sync up to here
+    bool failed;                      // set once, by the writer thread
+
+    std::thread writer;
+
+    // Compressor thread
+    std::mutex compress_mutex;
+    std::condition_variable compress_wake;
+    bool compress_pending;
+    bool compress_stopping;
+    std::thread compressor;
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "logging_service.h"
+#include "wire.h"
+#include <iostream>
+#include <sstream>
+#include <getopt.h>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <climits>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    // Most records a single QUERY_LOG returns
+    const size_t MAX_QUERY_RECORDS = 1000;
+
+    // Money movements; with --sync-critical they are on disk before the ack
+    bool is_audit_critical(RequestType type) {
+        return type == DEPOSIT || type == WITHDRAW || type == TRANSFER || type == EARN_INTEREST;
+    }
+
+    // One line of QUERY_LOG output, in the text log's wording
+    string format_entry(const BinaryLog::Entry& entry) {
+        time_t seconds = entry.timestamp_us / 1000000;
+        struct tm local;
+        localtime_r(&seconds, &local);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+
+        ostringstream line;
+        line << when << " [" << entry.user_id << "]: ";
+        switch (entry.type) {
+            case LOGIN: line << "logged in"; break;
+            case LOGOUT: line << "logged out"; break;
+            case DEPOSIT: line << "deposited " << format_money(entry.amount); break;
+            case WITHDRAW: line << "withdrew " << format_money(entry.amount); break;
+            case TRANSFER: line << "transferred " << format_money(entry.amount); break;
+            case BALANCE: line << "viewed balance: " << format_money(entry.amount); break;
+            case EARN_INTEREST: line << "accrued interest in all accounts"; break;
+            case UPLOAD_FILE: line << "uploaded a file"; break;
+            case DOWNLOAD_FILE: line << "downloaded a file"; break;
+            default: line << "unknown action (type=" << entry.type << ")";
+        }
+        line << "\n";
+        return line.str();
+    }
+
+    // Answers a user's history from the binary log's index; data is an
+    // optional "FROM TO" range in Unix seconds
+    Response query_log(const Request& r, BinaryLog* binary_log) {
+        Response resp;
+        if (!binary_log) {
+            resp.message = "Binary log not enabled";
+            return resp;
+        }
+
+        long long from = 0, to = 0;
+        int fields = sscanf(r.data.c_str(), "%lld %lld", &from, &to);
+        int64_t from_us = fields >= 1 ? from * 1000000LL : 0;
+        int64_t to_us = fields >= 2 ? to * 1000000LL : LLONG_MAX;
+
+        vector<BinaryLog::Entry> entries = binary_log->query(r.user_id, from_us, to_us, MAX_QUERY_RECORDS);
+        for (const BinaryLog::Entry& entry : entries) {
+            resp.data += format_entry(entry);
+        }
+        resp.success = true;
+        resp.message = "Found " + to_string(entries.size()) + " records";
+        return resp;
+    }
+}
+
+LoggingService::Options::Options()
+    : port(8002), log_file("system.log"), thread_count(4), flush_policy(LogWriter::FLUSH_BATCH),
+      flush_interval(1000), sync_critical(false), segment_mb(64) {}
+
+LoggingService::LoggingService(const Options& options) : sync_critical(options.sync_critical) {
+    try {
+        writer.reset(new LogWriter(options.log_file, options.flush_policy, options.flush_interval, options.rotation));
+    } catch (const exception&) {
+        throw runtime_error("Could not open log file " + options.log_file + "!");
+    }
+    writer->append("=== Logging server started on port " + to_string(options.port) + " ===\n");
+
+    if (!options.binary_log_dir.empty()) {
+        binary_log.reset(new BinaryLog(options.binary_log_dir, (size_t)options.segment_mb << 20));
+    }
+    cout << "Writing logs to " << options.log_file << endl;
+    if (binary_log) {
+        cout << "Indexing audit records in " << options.binary_log_dir << endl;
+    }
+}
+
+LoggingService::~LoggingService() {
+    // The writer drains and syncs on destruction
+    writer->append("=== Logging server shutdown ===\n");
+    writer.reset();
+}
+
+// Formats one audit record and hands it to the writer thread
+Response LoggingService::handle(const Request& r, const string& client_address) {
+    if (r.type == BATCH) {
+        return Wire::execute_batch(r, [this, &client_address](const Request& sub) {
+            return handle(sub, client_address);
+        });
+    }
+    if (r.type == QUERY_LOG) {
+        return query_log(r, binary_log.get());
+    }
+
+    ostringstream logfile;
+    logfile << "[" << r.user_id << "]: ";
+    
+    switch(r.type) {
+        case LOGIN:
+            logfile << "logged in from " << client_address;
+            break;
+        case LOGOUT:
+            logfile << "logged out from " << client_address;
+            break;
+        case DEPOSIT:
+            logfile << "deposited " << format_money(r.amount);
+            break;
+        case WITHDRAW:
+            logfile << "withdrew " << format_money(r.amount);
+            break;
+        case TRANSFER: {
+            int to;
+            logfile << "transferred " << format_money(r.amount) << " to ["
+                    << (r.transfer_destination(to) ? to_string(to) : string("?")) << "]";
+            break;
+        }
+        case BALANCE:
+            logfile << "viewed balance: " << format_money(r.amount);
+            break;
+        case EARN_INTEREST:
+            logfile << "accrued interest in all accounts";
+            break;
+        case UPLOAD_FILE:
+            logfile << "uploaded file: " << r.filename;
+            break;
+        case DOWNLOAD_FILE:
+            logfile << "downloaded file: " << r.filename;
+            break;
+        default:
+            logfile << "unknown action (type=" << r.type << ")";
+    }
+    logfile << "\n";
+    Response resp;
+    if (!writer->append(logfile.str(), sync_critical && is_audit_critical(r.type))) {
+        // Not acknowledged, so the client sends it again
+        resp.message = "Log write failed";
+        return resp;
+    }
+    if (binary_log) {
+        binary_log->append(r.user_id, r.type, r.amount);
+    }
+
+    resp.success = true;
+    resp.message = "Logged successfully";
+    return resp;
+}
+
+void LoggingService::print_usage() {
+    cout << "Usage: ./logging_server [-p PORT] [-f LOG_FILE] [-t THREAD_COUNT] [-F POLICY] [-I MS] [-C] [-r MB] [-a SEC] [-k N] [-K HOURS] [-b DIR [-S MB]]" << endl;
+    cout << "  -p, --port         Port number to listen on (default: 8002)" << endl;
+    cout << "  -f, --file         Log file to write to (default: system.log)" << endl;
+    cout << "  -t, --threads      Number of threads in the thread pool (default: 4)" << endl;
+    cout << "  -F, --flush        When to fsync the log: batch, interval or none (default: batch)" << endl;
+    cout << "  -I, --flush-interval Milliseconds between syncs for -F interval (default: 1000)" << endl;
+    cout << "  -C, --sync-critical Sync deposits, withdrawals, transfers and interest before acknowledging" << endl;
+    cout << "  -r, --rotate-size  Rotate the log once it reaches MB megabytes (default: off)" << endl;
+    cout << "  -a, --rotate-age   Rotate the log every SEC seconds (default: off)" << endl;
+    cout << "  -k, --keep         Rotated logs to keep (default: all)" << endl;
+    cout << "  -K, --keep-hours   Delete rotated logs older than HOURS (default: never)" << endl;
+    cout << "      --no-compress  Leave rotated logs uncompressed" << endl;
+    cout << "  -b, --binary-log   Also keep an indexed binary log in DIR for QUERY_LOG" << endl;
+    cout << "  -S, --segment-size Binary log segment size in MB (default: 64)" << endl;
+    Reactor::print_admission_usage();
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+int LoggingService::parse_options(int argc, char* argv[], Options& options) {
+    // Parse command line arguments
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"file", required_argument, 0, 'f'},
+        {"threads", required_argument, 0, 't'},
+        {"flush", required_argument, 0, 'F'},
+        {"flush-interval", required_argument, 0, 'I'},
+        {"sync-critical", no_argument, 0, 'C'},
+        {"rotate-size", required_argument, 0, 'r'},
+        {"rotate-age", required_argument, 0, 'a'},
+        {"keep", required_argument, 0, 'k'},
+        {"keep-hours", required_argument, 0, 'K'},
+        {"no-compress", no_argument, 0, 0},
+        {"binary-log", required_argument, 0, 'b'},
+        {"segment-size", required_argument, 0, 'S'},
+        {"backlog", required_argument, 0, 0},
+        {"max-frame", required_argument, 0, 0},
+        {"max-queue", required_argument, 0, 0},
+        {"max-delay", required_argument, 0, 0},
+        {"rate-limit", required_argument, 0, 0},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int option_index = 0;
+    int c;
+    
+    while ((c = getopt_long(argc, argv, "p:f:t:F:I:Cr:a:k:K:b:S:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p':
+                options.port = atoi(optarg);
+                break;
+            case 'f':
+                options.log_file = optarg;
+                break;
+            case 't':
+                options.thread_count = atoi(optarg);
+                break;
+            case 'F':
+                if (strcmp(optarg, "batch") == 0) options.flush_policy = LogWriter::FLUSH_BATCH;
+                else if (strcmp(optarg, "interval") == 0) options.flush_policy = LogWriter::FLUSH_INTERVAL;
+                else if (strcmp(optarg, "none") == 0) options.flush_policy = LogWriter::FLUSH_NONE;
+                else {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'I':
+                options.flush_interval = atoi(optarg);
+                break;
+            case 'C':
+                options.sync_critical = true;
+                break;
+            case 0:
+                if (string(long_options[option_index].name) == "no-compress") {
+                    options.rotation.compress = false;
+                } else {
+                    Reactor::parse_admission_option(long_options[option_index].name, optarg, options.admission);
+                }
+                break;
+            case 'r':
+                options.rotation.max_bytes = (size_t)max(atol(optarg), 0L) << 20;
+                break;
+            case 'a':
+                options.rotation.max_age_s = max(atoi(optarg), 0);
+                break;
+            case 'k':
+                options.rotation.keep_count = max(atoi(optarg), 0);
+                break;
+            case 'K':
+                options.rotation.keep_age_s = max(atoi(optarg), 0) * 3600;
+                break;
+            case 'b':
+                options.binary_log_dir = optarg;
+                break;
+            case 'S':
+                options.segment_mb = atol(optarg);
+                if (options.segment_mb < 1) options.segment_mb = 1;
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            case '?':
+                print_usage();
+                return 1;
+            default:
+                abort();
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,63 @@
+#ifndef _LOGGING_SERVICE_H_
+#define _LOGGING_SERVICE_H_
+
+#include "common.h"
+#include "network_channel.h"
+#include "log_writer.h"
+#include "binary_log.h"
+#include <string>
+#include <memory>
+
+/*
+ * LoggingService class
+ *
+ * The logging server's audit log and request handling, independent of how
+ * requests arrive: the logging binary serves it on its own reactor, the
+ * bank binary next to the other services in one process, where the
+ * finance service also calls handle() directly with its audit records.
+ *
+ * handle() formats a record and hands it to the LogWriter's thread; with
+ * sync_critical it returns once money movements are on disk, or fails if
+ * they could not be synced so the sender retries. Safe to call
+ * from any number of threads.
+ */
+class LoggingService {
+public:
+    struct Options {
+        int port;
+        std::string log_file;
+        int thread_count;
+        LogWriter::FlushPolicy flush_policy;
+        int flush_interval;
+        bool sync_critical;
+        LogWriter::Rotation rotation;
+        std::string binary_log_dir; // empty: no binary log, QUERY_LOG unavailable
+        long segment_mb;
+        Reactor::Admission admission; // listen backlog and overload limits
+
+        Options();
+    };
+
+    static void print_usage();
+
+    // Parses the logging server's command line; returns -1 to go on, or
+    // the exit status after printing the usage
+    static int parse_options(int argc, char* argv[], Options& options);
+
+    // Opens the log and its writer thread; throws runtime_error on failure
+    explicit LoggingService(const Options& options);
+    // Logs the shutdown, then drains and syncs the log
+    ~LoggingService();
+
+    LoggingService(const LoggingService&) = delete;
+    LoggingService& operator=(const LoggingService&) = delete;
+
+    Response handle(const Request& r, const std::string& peer);
+
+private:
+    bool sync_critical;
+    std::unique_ptr<LogWriter> writer;
+    std::unique_ptr<BinaryLog> binary_log;
+};
+
+#endif
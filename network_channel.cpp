@@ -1,11 +1,24 @@
 #include "network_channel.h"
+#include "thread_pool.h"
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <iostream>
-#include <sstream>
+#include <stdexcept>
 #include <cstring>
 #include <cerrno>
 #include <vector>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <csignal>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <poll.h>
 
 using namespace std;
 
@@ -17,6 +30,7 @@ using namespace std;
  *           Empty string for server side means bind to all interfaces
  * @param port Port number to use
  * @param side SERVER_SIDE to create a listening socket, CLIENT_SIDE to connect to a server
+ * @param backlog Connections queued before accept() (server side only)
  * 
  * SERVER_SIDE behavior:
  * - Creates a socket and configures it for listening on the specified port
@@ -30,8 +44,9 @@ using namespace std;
  */
 
 // Constructor for setting up a connection (server listening or client connecting)
-NetworkRequestChannel::NetworkRequestChannel(const std::string& ip, int port, Side side) 
-    : my_side(side), client_addr_len(sizeof(client_addr)) {
+NetworkRequestChannel::NetworkRequestChannel(const std::string& ip, int port, Side side, int backlog) 
+    : my_side(side), client_addr_len(sizeof(client_addr)), encoding(Wire::BINARY), next_request_id(1),
+      quick_ack(false), timeout_ms(0), max_frame(DEFAULT_MAX_FRAME), read_start(0), read_end(0) {
     
     // Initialize address structures to zero
     memset(&server_addr, 0, sizeof(server_addr));
@@ -69,7 +84,7 @@ NetworkRequestChannel::NetworkRequestChannel(const std::string& ip, int port, Si
         }
 
         // listen for connections
-        if (listen(sockfd, 10) < 0) {
+        if (listen(sockfd, max(backlog, 1)) < 0) {
             close(sockfd);
             throw runtime_error("listen() failed!");
         }
@@ -106,6 +121,12 @@ NetworkRequestChannel::NetworkRequestChannel(const std::string& ip, int port, Si
             throw runtime_error("connect() failed!");
         }
 
+        int one = 1;
+        if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+            close(sockfd);
+            throw runtime_error("setsockopt() failed!");
+        }
+
         // Store peer information for logging
         peer_ip = ip;
         peer_port = port;
@@ -122,7 +143,8 @@ NetworkRequestChannel::NetworkRequestChannel(const std::string& ip, int port, Si
  * socket connection that was established by accepting a client connection.
  */
 NetworkRequestChannel::NetworkRequestChannel(int fd) 
-    : my_side(SERVER_SIDE), sockfd(fd), client_addr_len(sizeof(client_addr)) {
+    : my_side(SERVER_SIDE), sockfd(fd), client_addr_len(sizeof(client_addr)), encoding(Wire::TEXT), next_request_id(1),
+      quick_ack(false), timeout_ms(0), max_frame(DEFAULT_MAX_FRAME), read_start(0), read_end(0) {
     
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
@@ -170,6 +192,201 @@ int NetworkRequestChannel::get_socket_fd() const {
     return sockfd;
 }
 
+void NetworkRequestChannel::set_encoding(Wire::Encoding enc) {
+    encoding = enc;
+}
+
+Wire::Encoding NetworkRequestChannel::get_encoding() const {
+    return encoding;
+}
+
+void NetworkRequestChannel::set_no_delay(bool enable) {
+    int value = enable ? 1 : 0;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) < 0) {
+        throw runtime_error("setsockopt() failed!");
+    }
+}
+
+void NetworkRequestChannel::set_quick_ack(bool enable) {
+    int value = enable ? 1 : 0;
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value)) < 0) {
+        throw runtime_error("setsockopt() failed!");
+    }
+    quick_ack = enable;
+}
+
+void NetworkRequestChannel::set_timeout(int _timeout_ms) {
+    timeout_ms = max(_timeout_ms, 0);
+}
+
+void NetworkRequestChannel::set_max_frame(size_t _max_frame) {
+    max_frame = _max_frame;
+}
+
+void NetworkRequestChannel::start_deadline() {
+    if (timeout_ms > 0) deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+}
+
+/**
+ * Waits until the socket is ready for events or the frame's deadline passes
+ *
+ * @throws runtime_error naming the operation, after shutting the socket
+ *         down, if the deadline passes
+ */
+void NetworkRequestChannel::wait_for_socket(short events, const char* what) {
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = events;
+    while (true) {
+        int64_t remaining = chrono::duration_cast<chrono::milliseconds>(
+            deadline - chrono::steady_clock::now()).count();
+        int n = remaining > 0 ? poll(&pfd, 1, (int)min(remaining, (int64_t)INT_MAX)) : 0;
+        if (n > 0) return;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            throw runtime_error(string("poll() ") + what + " failed!");
+        }
+        shutdown(sockfd, SHUT_RDWR);
+        throw runtime_error(string(what) + " timed out!");
+    }
+}
+
+/**
+ * Writes the whole buffer, retrying on short writes
+ *
+ * @throws runtime_error naming the failed operation
+ */
+void NetworkRequestChannel::send_all(const char* buf, size_t len, const char* what) {
+    start_deadline();
+    int flags = MSG_NOSIGNAL | (timeout_ms > 0 ? MSG_DONTWAIT : 0);
+    while (len > 0) {
+        ssize_t n = send(sockfd, buf, len, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && timeout_ms > 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            wait_for_socket(POLLOUT, (string("send() ") + what).c_str());
+            continue;
+        }
+        if (n <= 0) {
+            throw runtime_error(string("send() ") + what + " failed!");
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/**
+ * Encodes one request frame and sends it. Large data fields are not
+ * copied: the encoded header and req.data go out with one writev.
+ */
+void NetworkRequestChannel::send_frame(const Request& req, uint32_t request_id, Wire::Encoding enc) {
+    write_buffer.clear();
+    if (req.data.size() < WRITEV_THRESHOLD) {
+        Wire::encode_request(req, request_id, enc, write_buffer);
+        send_all(write_buffer.data(), write_buffer.size(), "request");
+        return;
+    }
+
+    Wire::encode_request_streamed(req, request_id, enc, write_buffer);
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(write_buffer.data());
+    iov[0].iov_len = write_buffer.size();
+    iov[1].iov_base = const_cast<char*>(req.data.data());
+    iov[1].iov_len = req.data.size();
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    start_deadline();
+    int flags = MSG_NOSIGNAL | (timeout_ms > 0 ? MSG_DONTWAIT : 0);
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(sockfd, &msg, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && timeout_ms > 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            wait_for_socket(POLLOUT, "send() request");
+            continue;
+        }
+        if (n <= 0) {
+            throw runtime_error("send() request failed!");
+        }
+        // Skip what was written
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+ * Reads from the socket until at least need bytes are buffered, taking
+ * whatever else has already arrived
+ *
+ * @throws runtime_error naming the failed operation and part
+ */
+void NetworkRequestChannel::fill_read_buffer(size_t need, const char* what, const char* part) {
+    if (buffered() >= need) return;
+
+    // Move the unparsed tail to the front, and grow for large frames
+    if (read_start > 0) {
+        memmove(read_buffer.data(), read_buffer.data() + read_start, buffered());
+        read_end -= read_start;
+        read_start = 0;
+    }
+    if (read_buffer.size() < max(need, (size_t)READ_AHEAD)) {
+        read_buffer.resize(max(need, (size_t)READ_AHEAD));
+    }
+
+    while (read_end < need) {
+        if (quick_ack) {
+            int one = 1;
+            setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+        }
+        ssize_t n = recv(sockfd, read_buffer.data() + read_end, read_buffer.size() - read_end,
+                         timeout_ms > 0 ? MSG_DONTWAIT : 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && timeout_ms > 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            wait_for_socket(POLLIN, (string("recv() ") + what + " " + part).c_str());
+            continue;
+        }
+        if (n <= 0) {
+            throw runtime_error(string("recv() ") + what + " " + part + " failed!");
+        }
+        read_end += n;
+    }
+}
+
+/**
+ * Receives one length-prefixed frame
+ *
+ * @param len Set to the body length
+ * @return The body, valid until the next receive on this channel
+ * @throws runtime_error naming the failed operation
+ */
+const char* NetworkRequestChannel::receive_frame(const char* what, uint32_t& len) {
+    start_deadline();
+    fill_read_buffer(Wire::LENGTH_PREFIX_SIZE, what, "length");
+    uint32_t len_net;
+    memcpy(&len_net, read_buffer.data() + read_start, 4);
+    len = ntohl(len_net);
+    if (len > max_frame) {
+        // The rest of the frame is never read, so the stream is lost
+        shutdown(sockfd, SHUT_RDWR);
+        throw runtime_error(string("recv() ") + what + " failed: frame of " + to_string(len)
+                            + " bytes exceeds the " + to_string(max_frame) + " byte limit!");
+    }
+
+    fill_read_buffer(Wire::LENGTH_PREFIX_SIZE + (size_t)len, what, "body");
+    const char* body = read_buffer.data() + read_start + Wire::LENGTH_PREFIX_SIZE;
+    read_start += Wire::LENGTH_PREFIX_SIZE + len;
+    if (read_start == read_end) read_start = read_end = 0;
+    return body;
+}
+
 /**
  * Sends a request to the server and waits for a response
  * 
@@ -177,69 +394,108 @@ int NetworkRequestChannel::get_socket_fd() const {
  * @return Response from the server
  * 
  * This method:
- * Sends the length of the request followed by the request itself and receives the responses.
+ * Encodes the request (length prefix included) into the channel's write
+ * buffer, sends it in one piece and receives the response.
  * 
  * The wire format uses a 4-byte length header followed by the serialized data.
- * Request format: TYPE|USER_ID|AMOUNT|FILENAME|DATA
- * Response format: SUCCESS|BALANCE|DATA|MESSAGE
+ * See wire.h for the TEXT and BINARY body layouts.
  * 
  * @throws May throw exceptions on network errors
  */
 Response NetworkRequestChannel::send_request(const Request& req) {
-    // Format: TYPE|USER_ID|AMOUNT|FILENAME|DATA
-    stringstream ss;
-    ss << static_cast<int>(req.type) << "|"
-       << req.user_id << "|"
-       << req.amount << "|"
-       << req.filename << "|"
-       << req.data;
-    
-    string request_str = ss.str();
-    
-    // Add message length as header (4 bytes)
-    // Convert the request string length to network byte order
-    uint32_t length = htonl(request_str.length());
-    char length_buf[4];
-    memcpy(length_buf, &length, 4);
+    submit(req);
+    return receive_response();
+}
 
-    // send header
-    ssize_t n = send(sockfd, length_buf, 4, 0);
-    if (n != 4) {
-        throw runtime_error("send() request length failed!");
-    }
+/**
+ * Sends a request without waiting for its response
+ *
+ * @param req The Request object to send
+ * @return The request ID assigned to it on this connection
+ */
+uint32_t NetworkRequestChannel::submit(const Request& req) {
+    uint32_t id = next_request_id++;
+    send_frame(req, id, encoding);
+    pending_ids.push_back(id);
+    return id;
+}
 
-    // send body
-    n = send(sockfd, request_str.c_str(), request_str.size(), 0);
-    if (n != (ssize_t)request_str.size()) {
-        throw runtime_error("send() request body failed!");
+/**
+ * Receives the response to the oldest outstanding request
+ *
+ * @throws runtime_error if nothing is outstanding or a binary response
+ *         carries an unexpected request ID
+ */
+Response NetworkRequestChannel::receive_response() {
+    if (pending_ids.empty()) {
+        throw runtime_error("receive_response() with no request in flight!");
     }
 
-    // receive header
-    uint32_t resp_len_net;
-    n = recv(sockfd, &resp_len_net, 4, MSG_WAITALL);
-    if (n != 4) {
-        throw runtime_error("recv() response length failed!");
-    }
-    
-    // receive body
-    uint32_t resp_len = ntohl(resp_len_net);
-    vector<char> buffer(resp_len);
-    n = recv(sockfd, buffer.data(), resp_len, MSG_WAITALL);
-    if (n != (ssize_t)resp_len) {
-        throw runtime_error("recv() response body failed!");
+    uint32_t len;
+    const char* body = receive_frame("response", len);
+    Response resp = Wire::decode_response(body, len);
+
+    uint32_t expected = pending_ids.front();
+    pending_ids.pop_front();
+    if (encoding == Wire::BINARY && resp.request_id != expected) {
+        throw runtime_error("response for request " + to_string(resp.request_id)
+                            + " received, expected " + to_string(expected));
     }
+    resp.request_id = expected;
+    return resp;
+}
+
+/**
+ * Sends a request under a caller-chosen ID, without tracking it
+ */
+void NetworkRequestChannel::send_tagged(const Request& req, uint32_t request_id) {
+    send_frame(req, request_id, Wire::BINARY);
+}
+
+/**
+ * Receives the next response, whichever request it answers
+ *
+ * @throws runtime_error if the connection fails or closes
+ */
+Response NetworkRequestChannel::receive_tagged() {
+    uint32_t len;
+    const char* body = receive_frame("response", len);
+    return Wire::decode_response(body, len);
+}
 
-    // parse response
-    string resp(buffer.begin(), buffer.end());
-    stringstream fields(resp);
-    string success, balance, data, message;
+/**
+ * Sends a sequence of requests, keeping up to window of them in flight
+ *
+ * Requests are coalesced into one send each time the window is refilled,
+ * so a full window costs one write and window reads.
+ *
+ * @return Responses in the same order as reqs
+ */
+vector<Response> NetworkRequestChannel::send_requests(const vector<Request>& reqs, size_t window) {
+    if (window == 0) window = 1;
+
+    vector<Response> responses;
+    responses.reserve(reqs.size());
+    size_t next = 0;
 
-    getline(fields, success, '|');
-    getline(fields, balance, '|');
-    getline(fields, data, '|');
-    getline(fields, message, '|');
+    while (responses.size() < reqs.size()) {
+        write_buffer.clear();
+        while (next < reqs.size() && pending_ids.size() < window) {
+            uint32_t id = next_request_id++;
+            Wire::encode_request(reqs[next++], id, encoding, write_buffer);
+            pending_ids.push_back(id);
+        }
+        if (!write_buffer.empty()) {
+            send_all(write_buffer.data(), write_buffer.size(), "request");
+        }
+        responses.push_back(receive_response());
+    }
 
-    return Response(success == "1", stod(balance), data, message);
+    return responses;
+}
+
+size_t NetworkRequestChannel::in_flight() const {
+    return pending_ids.size();
 }
 
 /**
@@ -248,23 +504,41 @@ Response NetworkRequestChannel::send_request(const Request& req) {
  * @return The received Request object
  * 
  * This method:
- * Receives the length of the incoming request (4-byte header) and the actual data
+ * Receives the length of the incoming request (4-byte header) and the actual data.
+ * The encoding of the request is remembered so the response is sent back
+ * in the same encoding.
  * 
  */
 Request NetworkRequestChannel::receive_request() {
-    uint32_t len_net;
-    if (recv(sockfd, &len_net, 4, MSG_WAITALL) != 4) {
-        throw runtime_error("recv() request length failed!");
-    }
+    uint32_t len;
+    const char* body = receive_frame("request", len);
+    encoding = Wire::detect_encoding(body, len);
+    return Wire::decode_request(body, len);
+}
 
-    uint32_t len = ntohl(len_net);
-    vector<char> buffer(len);
-    if (recv(sockfd, buffer.data(), len, MSG_WAITALL) != (ssize_t)len) {
-        throw runtime_error("recv() request body failed!");
-    }
+/**
+ * Receives a batch of pipelined requests
+ *
+ * @param out Filled with the received requests (cleared first)
+ * @param max_batch Upper bound on the number of requests taken
+ *
+ * Blocks for the first request only. Further requests are taken while at
+ * least a length prefix is already waiting, read ahead or in the socket
+ * buffer, so a client that pipelines N requests is served with one read
+ * loop.
+ */
+void NetworkRequestChannel::receive_requests(vector<Request>& out, size_t max_batch) {
+    out.clear();
+    out.push_back(receive_request());
 
-    string req(buffer.begin(), buffer.end());
-    return Request::parseRequest(req);
+    while (out.size() < max_batch) {
+        int available = 0;
+        if (buffered() < Wire::LENGTH_PREFIX_SIZE &&
+            (ioctl(sockfd, FIONREAD, &available) < 0 || buffered() + available < Wire::LENGTH_PREFIX_SIZE)) {
+            break;
+        }
+        out.push_back(receive_request());
+    }
 }
 
 /**
@@ -273,27 +547,852 @@ Request NetworkRequestChannel::receive_request() {
  * @param resp The Response object to send
  * 
  * This method:
- * Sends the length of the response followed by the response itself
- * 
- * The wire format uses a 4-byte length header followed by the serialized data.
- * Response format: SUCCESS|BALANCE|DATA|MESSAGE
+ * Encodes the response in the encoding of the last received request and
+ * sends the length prefix and body with a single write.
  */
 void NetworkRequestChannel::send_response(const Response& resp) {
-    // Format: SUCCESS|BALANCE|DATA|MESSAGE
-    stringstream ss;
-    ss << (resp.success ? "1" : "0") << "|"
-       << resp.balance << "|"
-       << resp.data << "|"
-       << resp.message;
-    
-    string response_str = ss.str();
-    
-    uint32_t len = htonl(response_str.size());
-    if (send(sockfd, &len, 4, 0) != 4) {
-        throw runtime_error("send() response length failed!");
+    write_buffer.clear();
+    Wire::encode_response(resp, encoding, write_buffer);
+    send_all(write_buffer.data(), write_buffer.size(), "response");
+}
+
+/**
+ * Sends several responses with a single write
+ */
+void NetworkRequestChannel::send_responses(const vector<Response>& resps) {
+    write_buffer.clear();
+    for (const Response& resp : resps) {
+        Wire::encode_response(resp, encoding, write_buffer);
+    }
+    if (!write_buffer.empty()) {
+        send_all(write_buffer.data(), write_buffer.size(), "response");
+    }
+}
+
+
+namespace {
+    const char* const BUSY_QUEUE_FULL = "Server busy: request queue full";
+    const char* const BUSY_QUEUE_DELAY = "Server busy: request queued too long";
+    const char* const BUSY_RATE_LIMIT = "Server busy: rate limit exceeded";
+
+    // A request refused by admission control
+    void busy_response(Response& resp, const char* reason) {
+        resp.success = false;
+        resp.message = reason;
+        resp.flags |= BUSY;
+    }
+
+    // QUIT and STATS are answered by the reactor itself, even under overload
+    bool answer_locally(const Request& r, ServerMetrics& metrics, Response& resp) {
+        if (r.type == QUIT) {
+            resp.success = true;
+            resp.message = "Server acknowledged disconnect";
+            return true;
+        }
+        if (r.type == STATS) {
+            resp = Response(true, 0, metrics.report(), "Server metrics");
+            return true;
+        }
+        return false;
+    }
+}
+
+Reactor::Admission::Admission()
+    : backlog(NetworkRequestChannel::DEFAULT_BACKLOG), max_frame(NetworkRequestChannel::DEFAULT_MAX_FRAME), max_queue(0), max_queue_delay_ms(0), rate_limit(0) {}
+
+void Reactor::print_admission_usage() {
+    cout << "      --backlog      Connections waiting to be accepted (default: "
+         << NetworkRequestChannel::DEFAULT_BACKLOG << ")" << endl;
+    cout << "      --max-frame    Largest request in MB; bigger ones close the connection (default: "
+         << (NetworkRequestChannel::DEFAULT_MAX_FRAME >> 20) << ")" << endl;
+    cout << "      --max-queue    Answer \"Server busy\" while N batches wait for a worker (default: 0, no limit)" << endl;
+    cout << "      --max-delay    Answer \"Server busy\" to requests that waited MS for a worker (default: 0, no limit)" << endl;
+    cout << "      --rate-limit   Requests per second per client IP (default: 0, no limit)" << endl;
+}
+
+bool Reactor::parse_admission_option(const string& option, const char* value, Admission& admission) {
+    if (option == "backlog") {
+        admission.backlog = max(atoi(value), 1);
+    } else if (option == "max-frame") {
+        // Always room for a full file chunk and its header
+        admission.max_frame = max((size_t)max(atol(value), 0L) << 20, 2 * Wire::FILE_CHUNK_SIZE);
+    } else if (option == "max-queue") {
+        admission.max_queue = (size_t)max(atol(value), 0L);
+    } else if (option == "max-delay") {
+        admission.max_queue_delay_ms = max(atoi(value), 0);
+    } else if (option == "rate-limit") {
+        admission.rate_limit = max(atof(value), 0.0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Creates a Reactor for a listening channel
+ *
+ * @param name Server name used in connection log lines
+ * @param listener SERVER_SIDE channel whose socket is accepted on
+ * @param pool Thread pool that executes decoded requests
+ * @param handler Executes one request and returns its response
+ * @param admission Overload limits of the service
+ *
+ * @throws runtime_error if epoll or eventfd setup fails
+ */
+Reactor::Reactor(const string& _name, NetworkRequestChannel& listener, ThreadPool& _pool, Handler _handler,
+                 const Admission& admission)
+    : name(_name), pool(_pool), outstanding_tasks(0) {
+
+    // sendfile() has no MSG_NOSIGNAL; a vanished peer must be an EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw runtime_error("epoll_create1() failed!");
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        close(epoll_fd);
+        throw runtime_error("eventfd() failed!");
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+        close(wake_fd);
+        close(epoll_fd);
+        throw runtime_error("epoll_ctl() on eventfd failed!");
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = timers.fd();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timers.fd(), &ev) < 0) {
+        close(wake_fd);
+        close(epoll_fd);
+        throw runtime_error("epoll_ctl() on timerfd failed!");
     }
 
-    if (send(sockfd, response_str.c_str(), response_str.size(), 0) != (ssize_t)response_str.size()) {
-        throw runtime_error("send() response body failed!");
+    try {
+        add_service(_name, listener, _handler, admission);
+    } catch (...) {
+        close(wake_fd);
+        close(epoll_fd);
+        throw;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Adds a listening channel to the event loop
+ *
+ * @param name Service name used in connection log lines and its metrics
+ * @param listener SERVER_SIDE channel whose socket is accepted on
+ * @param handler Executes one request of this service
+ * @param admission Overload limits of this service
+ *
+ * @throws runtime_error if the socket cannot be registered
+ */
+ServerMetrics& Reactor::add_service(const string& service_name, NetworkRequestChannel& listener, Handler handler,
+                                    const Admission& admission) {
+    int listen_fd = listener.get_socket_fd();
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw runtime_error("fcntl() on listening socket failed!");
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        throw runtime_error("epoll_ctl() on listening socket failed!");
+    }
+
+    services.push_back(unique_ptr<Service>(new Service(service_name, listen_fd, handler, admission)));
+    Service* service = services.back().get();
+    ServerMetrics& metrics = service->metrics;
+    metrics.add_gauge("connections", [service]() { return (uint64_t)service->connections.load(); });
+    metrics.add_gauge("connections_paused", [service]() { return (uint64_t)service->paused.load(); });
+    metrics.add_gauge("connection_timeouts", [service]() { return service->timeouts.load(); });
+    metrics.add_gauge("busy_queue_full", [service]() { return service->refused_queue_full.load(); });
+    metrics.add_gauge("busy_queue_delay", [service]() { return service->refused_queue_delay.load(); });
+    metrics.add_gauge("busy_rate_limit", [service]() { return service->refused_rate_limit.load(); });
+    metrics.add_gauge("pool_threads", [this]() { return (uint64_t)pool.size(); });
+    metrics.add_gauge("pool_queue_depth", [this]() { return (uint64_t)pool.queued(); });
+    metrics.add_gauge("pool_tasks_outstanding", [this]() { return (uint64_t)pool.outstanding(); });
+    return metrics;
+}
+
+/**
+ * Destructor
+ *
+ * Waits for batches still running on the pool, then closes every
+ * connection. The listening socket belongs to the channel and stays open.
+ */
+Reactor::~Reactor() {
+    {
+        unique_lock<mutex> lock(tasks_mutex);
+        tasks_done.wait(lock, [this] { return outstanding_tasks == 0; });
+    }
+
+    while (!connections.empty()) {
+        close_connection(connections.begin()->second);
+    }
+
+    for (const unique_ptr<Service>& service : services) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, service->listen_fd, NULL);
+    }
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+size_t Reactor::connection_count() const {
+    return connections.size();
+}
+
+/**
+ * Runs the event loop
+ *
+ * @param stop_flag Checked at least every 200ms; the loop returns once it is set
+ */
+void Reactor::run(const atomic<bool>& stop_flag) {
+    struct epoll_event events[64];
+
+    while (!stop_flag) {
+        int n = epoll_wait(epoll_fd, events, 64, 200);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("epoll_wait() failed!");
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            Service* listener = nullptr;
+            for (const unique_ptr<Service>& service : services) {
+                if (service->listen_fd == fd) listener = service.get();
+            }
+            if (listener) {
+                accept_all(*listener);
+                continue;
+            }
+            if (fd == wake_fd) {
+                drain_queues();
+                continue;
+            }
+            if (fd == timers.fd()) {
+                timers.expire();
+                continue;
+            }
+
+            map<int, ConnectionPtr>::iterator it = connections.find(fd);
+            if (it == connections.end()) continue;
+            ConnectionPtr conn = it->second;
+
+            if (events[i].events & EPOLLERR) {
+                close_connection(conn);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                handle_readable(conn);
+            }
+            if (events[i].events & EPOLLOUT) {
+                handle_writable(conn);
+            }
+        }
+    }
+}
+
+/**
+ * Accepts every pending connection (edge-triggered: until EAGAIN)
+ */
+void Reactor::accept_all(Service& service) {
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept4(service.listen_fd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                cerr << service.name << ": accept() failed: " << strerror(errno) << endl;
+            }
+            return;
+        }
+
+        string peer = string(inet_ntoa(addr.sin_addr)) + ":" + to_string(ntohs(addr.sin_port));
+
+        // Responses are written whole, and a message after a sendfile()
+        // body must not wait for the client's delayed ACK
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            cerr << service.name << ": epoll_ctl() failed for " << peer << ": " << strerror(errno) << endl;
+            close(fd);
+            continue;
+        }
+
+        ConnectionPtr conn = make_shared<Connection>(fd, peer, &service);
+        if (service.admission.rate_limit > 0) {
+            // Every connection from one IP draws on the same tokens
+            prune_clients(service);
+            ClientBucketPtr& bucket = service.clients[inet_ntoa(addr.sin_addr)];
+            if (!bucket) bucket = make_shared<ClientBucket>(max(service.admission.rate_limit, 1.0));
+            conn->bucket = bucket;
+        }
+        connections[fd] = conn;
+        service.connections++;
+        cout << "Accepted connection from " << peer << endl;
+        cout << service.name << ": new client connection from " << peer << endl;
+    }
+}
+
+/**
+ * Forgets clients with no connection left whose tokens have refilled, at
+ * most once a second
+ */
+void Reactor::prune_clients(Service& service) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (now - service.clients_pruned < chrono::seconds(1)) return;
+    service.clients_pruned = now;
+
+    double rate = service.admission.rate_limit;
+    map<string, ClientBucketPtr>::iterator it = service.clients.begin();
+    while (it != service.clients.end()) {
+        // Unshared, so no other thread can be taking its tokens
+        const ClientBucket& bucket = *it->second;
+        double elapsed = chrono::duration<double>(now - bucket.refilled).count();
+        if (it->second.use_count() == 1 && bucket.tokens + elapsed * rate >= max(rate, 1.0)) {
+            it = service.clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Reads what is available, decodes complete frames and dispatches them.
+ * A connection with MAX_PENDING_REQUESTS waiting is paused instead: the
+ * rest stays in the socket until its batches catch up.
+ */
+void Reactor::handle_readable(const ConnectionPtr& conn) {
+    unique_lock<mutex> lock(conn->mutex);
+    if (conn->fd < 0) return;
+
+    bool eof = false;
+    char chunk[16384];
+    uint64_t received = 0;
+    size_t pos = 0;
+    try {
+        // Frames left over from before a pause come first
+        pos = decode_locked(*conn, pos);
+        while (true) {
+            pause_or_resume_locked(conn, pos);
+            if (conn->paused) break;
+            ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                if (!conn->closing) conn->in.insert(conn->in.end(), chunk, chunk + n);
+                received += n;
+                pos = decode_locked(*conn, pos);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            eof = true; // orderly shutdown or error
+            break;
+        }
+    } catch (const exception& e) {
+        cerr << "Error handling client " << conn->peer << ": " << e.what() << endl;
+        conn->closing = true;
+        conn->pending.clear();
+        eof = true;
+    }
+    if (received > 0) conn->service->metrics.record_bytes_in(received);
+    conn->in.erase(conn->in.begin(), conn->in.begin() + pos);
+
+    // The deadline runs from the first byte of each request, but not
+    // while the reactor is the one holding it up
+    if (conn->in.empty() || conn->closing || conn->paused) {
+        disarm_locked(conn->read_timer);
+    } else if (pos > 0 || !conn->read_timer) {
+        rearm_locked(conn, conn->read_timer, REQUEST_TIMEOUT_MS);
+    }
+
+    dispatch_locked(conn);
+
+    if (eof) {
+        conn->closing = true;
+        if (!conn->busy) {
+            lock.unlock();
+            close_connection(conn);
+        }
+    }
+}
+
+/**
+ * Decodes the complete frames in conn.in from pos into pending, up to
+ * QUIT or MAX_PENDING_REQUESTS, and returns the position after them.
+ * Throws on a malformed frame, or as soon as a length prefix is over the
+ * service's max_frame. Caller holds conn.mutex.
+ */
+size_t Reactor::decode_locked(Connection& conn, size_t pos) {
+    while (!conn.closing && conn.pending.size() < MAX_PENDING_REQUESTS
+           && conn.in.size() - pos >= Wire::LENGTH_PREFIX_SIZE) {
+        uint32_t len_net;
+        memcpy(&len_net, conn.in.data() + pos, 4);
+        uint32_t len = ntohl(len_net);
+        if (len > conn.service->admission.max_frame) {
+            throw runtime_error("frame of " + to_string(len) + " bytes exceeds the "
+                                + to_string(conn.service->admission.max_frame) + " byte limit");
+        }
+        if (conn.in.size() - pos - Wire::LENGTH_PREFIX_SIZE < len) break;
+
+        const char* body = conn.in.data() + pos + Wire::LENGTH_PREFIX_SIZE;
+        conn.encoding = Wire::detect_encoding(body, len);
+        conn.pending.push_back(Wire::decode_request(body, len));
+        pos += Wire::LENGTH_PREFIX_SIZE + len;
+
+        // Nothing after QUIT is served
+        if (conn.pending.back().type == QUIT) conn.closing = true;
+    }
+    return pos;
+}
+
+/**
+ * Pauses reading a connection that has too much waiting, or asks for a
+ * paused one to be read again once it has caught up halfway. conn->in is
+ * undecoded from decoded on. Caller holds conn->mutex.
+ *
+ * Input only piles up past one frame while pending is full, so resuming
+ * on pending alone is enough: the next read decodes it first.
+ */
+void Reactor::pause_or_resume_locked(const ConnectionPtr& conn, size_t decoded) {
+    size_t output = conn->out.size() - conn->out_pos;
+    size_t input = conn->in.size() - decoded;
+    if (!conn->paused) {
+        if (conn->closing) return;
+        if (conn->pending.size() >= MAX_PENDING_REQUESTS || output >= MAX_PENDING_OUTPUT
+            || input > Wire::LENGTH_PREFIX_SIZE + conn->service->admission.max_frame) {
+            conn->paused = true;
+            conn->service->paused++;
+        }
+    } else if (conn->pending.size() < MAX_PENDING_REQUESTS / 2 && output < MAX_PENDING_OUTPUT / 2) {
+        request_resume_locked(conn);
+    }
+}
+
+/**
+ * Flushes output the socket refused earlier
+ */
+void Reactor::handle_writable(const ConnectionPtr& conn) {
+    unique_lock<mutex> lock(conn->mutex);
+    if (conn->fd < 0) return;
+
+    if (flush_with_deadline_locked(conn) && conn->closing && !conn->busy) {
+        lock.unlock();
+        close_connection(conn);
+    }
+}
+
+/**
+ * Hands the next batch of pending requests to the pool, unless one is
+ * already running for this connection. A batch that admission control
+ * refuses outright is answered here and the next one tried. Caller holds
+ * conn->mutex.
+ */
+void Reactor::dispatch_locked(const ConnectionPtr& conn) {
+    Service& service = *conn->service;
+    while (!conn->busy && !conn->pending.empty() && conn->fd >= 0) {
+        // batch is empty here; swapping keeps both buffers for later batches
+        const size_t max_batch = NetworkRequestChannel::DEFAULT_MAX_BATCH;
+        if (conn->pending.size() <= max_batch) {
+            conn->batch.swap(conn->pending);
+        } else {
+            conn->batch.insert(conn->batch.end(), make_move_iterator(conn->pending.begin()),
+                               make_move_iterator(conn->pending.begin() + max_batch));
+            conn->pending.erase(conn->pending.begin(), conn->pending.begin() + max_batch);
+        }
+        conn->dispatched = chrono::steady_clock::now();
+        conn->admitted = take_tokens(*conn, conn->batch.size());
+        if (conn->paused) pause_or_resume_locked(conn);
+
+        if (conn->admitted == 0) {
+            refuse_batch_locked(conn, BUSY_RATE_LIMIT);
+            continue;
+        }
+
+        conn->busy = true;
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            outstanding_tasks++;
+        }
+        Task task([this, conn]() {
+            run_batch(conn);
+        });
+        if (service.admission.max_queue == 0) {
+            pool.enqueue(std::move(task));
+            return;
+        }
+        if (pool.try_enqueue(std::move(task), service.admission.max_queue)) return;
+
+        // Refused on the spot: the client hears at once instead of queueing
+        conn->busy = false;
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            outstanding_tasks--;
+            tasks_done.notify_all();
+        }
+        refuse_batch_locked(conn, BUSY_QUEUE_FULL);
+    }
+}
+
+/**
+ * Takes up to wanted tokens from the connection's client bucket, refilled
+ * at the service's rate, and returns how many it got
+ */
+size_t Reactor::take_tokens(Connection& conn, size_t wanted) {
+    if (!conn.bucket) return wanted;
+
+    double rate = conn.service->admission.rate_limit;
+    ClientBucket& bucket = *conn.bucket;
+    lock_guard<mutex> lock(bucket.mutex);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double elapsed = chrono::duration<double>(now - bucket.refilled).count();
+    bucket.tokens = min(bucket.tokens + elapsed * rate, max(rate, 1.0));
+    bucket.refilled = now;
+
+    size_t granted = min(wanted, (size_t)bucket.tokens);
+    bucket.tokens -= granted;
+    return granted;
+}
+
+/**
+ * Answers conn->batch busy without running it, from the calling thread.
+ * Nothing of the connection's is running, so responses stay in order.
+ * Caller holds conn->mutex.
+ */
+void Reactor::refuse_batch_locked(const ConnectionPtr& conn, const char* reason) {
+    Service& service = *conn->service;
+    const vector<Request>& batch = conn->batch;
+    vector<Response>& responses = conn->responses;
+    if (responses.size() < batch.size()) responses.resize(batch.size());
+
+    uint64_t refused = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        Response& resp = responses[i];
+        resp.reset();
+        if (!answer_locally(batch[i], service.metrics, resp)) {
+            busy_response(resp, reason);
+            refused++;
+        }
+        resp.request_id = batch[i].request_id;
+    }
+    if (reason == BUSY_QUEUE_FULL) service.refused_queue_full += refused;
+    else service.refused_rate_limit += refused;
+
+    encode_batch_locked(*conn);
+    if (flush_with_deadline_locked(conn) && conn->closing) {
+        request_close_locked(conn);
+    }
+}
+
+/**
+ * Executes conn->batch on a pool thread and writes the responses. While
+ * the connection is busy only this thread touches batch and responses.
+ */
+void Reactor::run_batch(const ConnectionPtr& conn) {
+    const vector<Request>& batch = conn->batch;
+    vector<Response>& responses = conn->responses;
+    if (responses.size() < batch.size()) responses.resize(batch.size());
+
+    Service& service = *conn->service;
+    const int max_delay_ms = service.admission.max_queue_delay_ms;
+    for (size_t i = 0; i < batch.size(); i++) {
+        const Request& r = batch[i];
+        Response& resp = responses[i];
+        resp.reset();
+        chrono::steady_clock::time_point started = chrono::steady_clock::now();
+        if (!answer_locally(r, service.metrics, resp)) {
+            if (i >= conn->admitted) {
+                busy_response(resp, BUSY_RATE_LIMIT);
+                service.refused_rate_limit++;
+            } else if (max_delay_ms > 0 && started - conn->dispatched > chrono::milliseconds(max_delay_ms)) {
+                // Its client has likely given up; the worker is better spent
+                // on requests that can still be answered in time
+                busy_response(resp, BUSY_QUEUE_DELAY);
+                service.refused_queue_delay++;
+            } else {
+                try {
+                    service.handler(r, conn->peer, resp);
+                } catch (const exception& e) {
+                    cerr << "Error handling client " << conn->peer << ": " << e.what() << endl;
+                    resp = Response(false, 0, "", string("Internal server error: ") + e.what());
+                }
+            }
+        }
+        resp.request_id = r.request_id;
+
+        // Refused requests are counted by the busy_ gauges, not timed
+        if (resp.flags & BUSY) continue;
+        service.metrics.record_request(r.type, resp.success,
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count());
+    }
+
+    {
+        lock_guard<mutex> lock(conn->mutex);
+        encode_batch_locked(*conn);
+        bool drained = conn->fd < 0 || flush_with_deadline_locked(conn);
+
+        conn->busy = false;
+        dispatch_locked(conn);
+
+        if (!conn->busy && conn->closing && drained) {
+            request_close_locked(conn);
+        }
+    }
+
+    lock_guard<mutex> lock(tasks_mutex);
+    outstanding_tasks--;
+    tasks_done.notify_all();
+}
+
+/**
+ * Appends the responses to conn.batch to the output, then empties the
+ * batch. Caller holds conn.mutex.
+ */
+void Reactor::encode_batch_locked(Connection& conn) {
+    const vector<Request>& batch = conn.batch;
+    if (conn.fd >= 0) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            const Response& resp = conn.responses[i];
+            size_t start = conn.out.size();
+            try {
+                if (!resp.file_bodies.empty()) {
+                    size_t at = Wire::encode_response_streamed(resp, conn.encoding, conn.out);
+                    for (const shared_ptr<FileBody>& body : resp.file_bodies) {
+                        conn.files.push_back(Attachment(at, body));
+                    }
+                } else {
+                    Wire::encode_response(resp, conn.encoding, conn.out);
+                }
+            } catch (const exception& e) {
+                conn.out.resize(start);
+                Response error(false, 0, "", string("Internal server error: ") + e.what());
+                error.request_id = resp.request_id;
+                Wire::encode_response(error, conn.encoding, conn.out);
+            }
+        }
+    }
+
+    // Keep small buffers for the next batch, but no file descriptors
+    // and no large payloads
+    for (size_t i = 0; i < batch.size(); i++) {
+        Response& resp = conn.responses[i];
+        resp.file_bodies.clear();
+        if (resp.data.capacity() > NetworkRequestChannel::WRITEV_THRESHOLD) string().swap(resp.data);
+    }
+    conn.batch.clear();
+}
+
+/**
+ * Writes as much pending output as the socket accepts
+ *
+ * @return true once the output buffer is empty
+ */
+bool Reactor::flush_locked(Connection& conn) {
+    while (true) {
+        size_t limit = conn.files.empty() ? conn.out.size() : conn.files.front().position;
+        if (conn.out_pos < limit) {
+            ssize_t n = send(conn.fd, conn.out.data() + conn.out_pos, limit - conn.out_pos,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                conn.out_pos += n;
+                conn.bytes_flushed += n;
+                conn.service->metrics.record_bytes_out(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+
+            // Peer is gone; drop the output
+            conn.closing = true;
+            break;
+        }
+        if (conn.files.empty()) break;
+
+        Attachment& file = conn.files.front();
+        if (file.sent < file.body->length) {
+            off_t offset = file.body->offset + file.sent;
+            size_t count = min(file.body->length - file.sent, (uint64_t)1 << 30);
+            ssize_t n;
+            if (file.body->contents) {
+                n = send(conn.fd, file.body->contents->data() + offset, count, MSG_NOSIGNAL | MSG_DONTWAIT);
+            } else if (file.body->descriptor() >= 0) {
+                n = sendfile(conn.fd, file.body->fd, &offset, count);
+            } else {
+                n = 0;
+            }
+            if (n > 0) {
+                file.sent += n;
+                conn.bytes_flushed += n;
+                conn.service->metrics.record_bytes_out(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+
+            // Peer is gone, or the file shrank or vanished and the frame cannot be completed
+            conn.closing = true;
+            break;
+        }
+        conn.files.pop_front();
+    }
+
+    conn.out.clear();
+    conn.out_pos = 0;
+    conn.files.clear();
+    return true;
+}
+
+/**
+ * flush_locked(), keeping the write deadline: armed while output is stuck,
+ * and pushed back whenever the client takes some of it
+ */
+bool Reactor::flush_with_deadline_locked(const ConnectionPtr& conn) {
+    uint64_t before = conn->bytes_flushed;
+    bool drained = flush_locked(*conn);
+    if (drained) {
+        disarm_locked(conn->write_timer);
+    } else if (conn->bytes_flushed != before || !conn->write_timer) {
+        rearm_locked(conn, conn->write_timer, WRITE_TIMEOUT_MS);
+    }
+    if (conn->paused) pause_or_resume_locked(conn);
+    return drained;
+}
+
+/**
+ * Replaces one of a connection's deadlines. Caller holds conn->mutex.
+ */
+void Reactor::rearm_locked(const ConnectionPtr& conn, TimerWheel::TimerId& timer, int timeout_ms) {
+    if (timer) timers.cancel(timer);
+    weak_ptr<Connection> weak(conn);
+    timer = timers.schedule(timeout_ms, [this, weak](TimerWheel::TimerId id) {
+        expire_connection(weak, id);
+    });
+}
+
+void Reactor::disarm_locked(TimerWheel::TimerId& timer) {
+    if (!timer) return;
+    timers.cancel(timer);
+    timer = 0;
+}
+
+/**
+ * Closes a connection whose deadline passed (reactor thread only)
+ */
+void Reactor::expire_connection(const weak_ptr<Connection>& weak, TimerWheel::TimerId id) {
+    ConnectionPtr conn = weak.lock();
+    if (!conn) return;
+
+    const char* what;
+    {
+        lock_guard<mutex> lock(conn->mutex);
+        if (conn->fd < 0) return;
+        if (id == conn->read_timer) {
+            conn->read_timer = 0;
+            what = "sending a request";
+        } else if (id == conn->write_timer) {
+            conn->write_timer = 0;
+            what = "reading responses";
+        } else {
+            return; // re-armed since
+        }
+    }
+    conn->service->timeouts++;
+    cerr << conn->service->name << ": client " << conn->peer << " timed out " << what << endl;
+    close_connection(conn);
+}
+
+/**
+ * Asks the reactor thread to close a connection. Caller holds conn->mutex.
+ */
+void Reactor::request_close_locked(const ConnectionPtr& conn) {
+    {
+        lock_guard<mutex> lock(close_mutex);
+        close_queue.push_back(conn);
+    }
+    wake();
+}
+
+/**
+ * Unpauses a connection and asks the reactor thread to read it again.
+ * Caller holds conn->mutex.
+ */
+void Reactor::request_resume_locked(const ConnectionPtr& conn) {
+    conn->paused = false;
+    conn->service->paused--;
+    {
+        lock_guard<mutex> lock(close_mutex);
+        resume_queue.push_back(conn);
+    }
+    wake();
+}
+
+void Reactor::wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        cerr << name << ": eventfd write failed: " << strerror(errno) << endl;
+    }
+}
+
+void Reactor::drain_queues() {
+    uint64_t count;
+    while (read(wake_fd, &count, sizeof(count)) > 0) {}
+
+    vector<ConnectionPtr> closing, resuming;
+    {
+        lock_guard<mutex> lock(close_mutex);
+        closing.swap(close_queue);
+        resuming.swap(resume_queue);
+    }
+    for (const ConnectionPtr& conn : resuming) {
+        handle_readable(conn);
+    }
+    for (const ConnectionPtr& conn : closing) {
+        close_connection(conn);
+    }
+}
+
+/**
+ * Removes a connection from epoll and closes its socket (reactor thread only)
+ */
+void Reactor::close_connection(ConnectionPtr conn) {
+    int fd;
+    {
+        lock_guard<mutex> lock(conn->mutex);
+        fd = conn->fd;
+        if (fd < 0) return;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        conn->fd = -1;
+        conn->pending.clear();
+        conn->files.clear();
+        conn->bucket.reset();
+        disarm_locked(conn->read_timer);
+        disarm_locked(conn->write_timer);
+        if (conn->paused) {
+            conn->paused = false;
+            conn->service->paused--;
+        }
+    }
+
+    connections.erase(fd);
+    conn->service->connections--;
+    cout << conn->service->name << ": client " << conn->peer << " disconnected" << endl;
+}
@@ -2,7 +2,20 @@
 #define _NETWORK_CHANNEL_H_
 
 #include "common.h"
+#include "wire.h"
+#include "server_metrics.h"
+#include "timer_wheel.h"
 #include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -13,14 +26,43 @@
  * This class implements a communication channel using TCP/IP sockets
  * to replace the FIFO-based RequestChannel class. It will allow the banking 
  * system to work across a network instead of just on a single machine.
+ *
+ * Every message goes out with one send, or one writev when a large data
+ * field is written straight from the request. Reads go through a
+ * read-ahead buffer, so a burst of pipelined frames is parsed from a
+ * single recv. Client channels set TCP_NODELAY: frames are always written
+ * whole, so Nagle can only delay them.
+ *
+ * Client channels may be given a timeout, which bounds every socket wait
+ * with poll() instead of a process-wide alarm, so each thread's channel
+ * keeps its own deadline.
  */
 class NetworkRequestChannel {
 public:
     enum Side {SERVER_SIDE, CLIENT_SIDE};
+
+    // Default cap on the number of pipelined requests served per read
+    static const size_t DEFAULT_MAX_BATCH = 64;
+
+    // Bytes asked of the socket per recv
+    static const size_t READ_AHEAD = 64 * 1024;
+
+    // Request data at least this large is sent from the request itself
+    // with writev instead of being copied into the write buffer
+    static const size_t WRITEV_THRESHOLD = 16 * 1024;
+
+    // Connections the kernel queues for a server before accept(); it
+    // silently caps this at net.core.somaxconn
+    static const int DEFAULT_BACKLOG = SOMAXCONN;
+
+    // Largest frame body accepted from a peer. Chunked transfers stay far
+    // below it; whole-file text transfers of larger files need it raised.
+    static const size_t DEFAULT_MAX_FRAME = 16 * Wire::FILE_CHUNK_SIZE;
     
-    // For server: ip="" means listen on all interfaces
+    // For server: ip="" means listen on all interfaces, with up to backlog
+    // connections waiting to be accepted
     // For client: connect to specified IP and port
-    NetworkRequestChannel(const std::string& ip, int port, Side side);
+    NetworkRequestChannel(const std::string& ip, int port, Side side, int backlog = DEFAULT_BACKLOG);
     
     // For server: use after accept() returns a new client socket
     NetworkRequestChannel(int sockfd);
@@ -31,19 +73,302 @@ public:
     Response send_request(const Request& req);
     Request receive_request();
     void send_response(const Response& resp);
+
+    // Pipelining (client side). submit() sends a request without waiting and
+    // returns its request ID; receive_response() returns the next reply in
+    // submission order. send_requests() keeps up to window requests in flight
+    // and returns the responses in request order.
+    uint32_t submit(const Request& req);
+    Response receive_response();
+    std::vector<Response> send_requests(const std::vector<Request>& reqs, size_t window = 32);
+    size_t in_flight() const;
+
+    // Full-duplex pipelining (client side, binary encoding). send_tagged()
+    // sends req under the caller's request ID and receive_tagged() returns
+    // the next reply whatever its ID, leaving the caller to match them. One
+    // thread may send while another receives.
+    void send_tagged(const Request& req, uint32_t request_id);
+    Response receive_tagged();
+
+    // Batched serving (server side). receive_requests() blocks for one
+    // request, then also takes any frames already queued on the socket, up
+    // to max_batch. send_responses() writes all replies with one send.
+    void receive_requests(std::vector<Request>& out, size_t max_batch = DEFAULT_MAX_BATCH);
+    void send_responses(const std::vector<Response>& resps);
     
     // New methods specific to networking
     int accept_connection(); // Returns socket fd for new connection
     std::string get_peer_address() const;
     int get_socket_fd() const;
+
+    // Wire encoding used for outgoing messages. Clients default to BINARY;
+    // server-side channels follow whatever the peer last sent.
+    void set_encoding(Wire::Encoding enc);
+    Wire::Encoding get_encoding() const;
+
+    // TCP_NODELAY (on by default for clients), and TCP_QUICKACK, which the
+    // kernel clears again on its own and is therefore re-armed before
+    // every read. Throw runtime_error if setsockopt() fails.
+    void set_no_delay(bool enable);
+    void set_quick_ack(bool enable);
+
+    // Every frame must be sent, or received, within timeout_ms of starting
+    // (0, the default, waits forever). On expiry the socket is shut down,
+    // since a late reply would be taken for the next one, and runtime_error
+    // is thrown.
+    void set_timeout(int timeout_ms);
+
+    // A frame whose length prefix exceeds max_frame bytes is not buffered:
+    // the socket is shut down and runtime_error thrown
+    void set_max_frame(size_t max_frame);
     
 private:
+    void send_all(const char* buf, size_t len, const char* what);
+    void send_frame(const Request& req, uint32_t request_id, Wire::Encoding enc);
+    void fill_read_buffer(size_t need, const char* what, const char* part);
+    const char* receive_frame(const char* what, uint32_t& len);
+    size_t buffered() const { return read_end - read_start; }
+    void start_deadline();
+    void wait_for_socket(short events, const char* what);
+
     Side my_side;
     int sockfd;
     struct sockaddr_in server_addr, client_addr;
     socklen_t client_addr_len;
     std::string peer_ip;
     int peer_port;
+    Wire::Encoding encoding;
+    uint32_t next_request_id;
+    std::deque<uint32_t> pending_ids;
+
+    bool quick_ack;
+    int timeout_ms;
+    size_t max_frame;
+    std::chrono::steady_clock::time_point deadline; // of the frame in progress
+
+    // Reused across messages so steady-state traffic does not allocate.
+    // read_buffer[read_start, read_end) has been received but not parsed.
+    std::string write_buffer;
+    std::vector<char> read_buffer;
+    size_t read_start;
+    size_t read_end;
+};
+
+class ThreadPool;
+
+/*
+ * Reactor class
+ *
+ * Edge-triggered epoll event loop that owns a server's listening socket and
+ * every connection accepted on it. Sockets are non-blocking; the reactor
+ * thread accepts, reads and decodes frames, and only complete requests are
+ * handed to the thread pool. This keeps the number of connections
+ * independent of the number of worker threads.
+ *
+ * Requests from one connection run in order, one batch at a time, so
+ * pipelined clients get their responses in submission order. The worker
+ * that finishes a batch writes the responses itself; whatever the socket
+ * does not accept immediately is flushed by the reactor on EPOLLOUT.
+ * Responses with a file body are written up to the body, which then goes
+ * from the page cache to the socket with sendfile(), never through user
+ * space.
+ * QUIT is answered by the reactor and closes the connection once the
+ * pending responses have been written.
+ *
+ * Each connection keeps its receive, batch, response and output buffers
+ * for its whole life, and handlers fill in a Response the connection
+ * reuses, so a small request such as a DEPOSIT or BALANCE makes no heap
+ * allocation between recv and send once the connection is warm (see
+ * alloc_bench.cpp).
+ *
+ * The reactor keeps the server's ServerMetrics: every request is timed
+ * around the handler call, and STATS is answered by the reactor with the
+ * metrics report, including connection count and pool queue depth.
+ *
+ * One reactor can serve several listening sockets, each a service with
+ * its own handler and metrics, from the same event loop and thread pool;
+ * this is how a single process hosts every server (see bank.cpp).
+ *
+ * Every connection has its own deadlines on a TimerWheel that the event
+ * loop drives: a request must arrive whole within REQUEST_TIMEOUT_MS of
+ * its first byte, and a client with responses pending must take some of
+ * them at least every WRITE_TIMEOUT_MS. A connection that misses either
+ * is closed, so stalled clients cannot pin buffers forever.
+ *
+ * Each service has an Admission policy against overload. A connection
+ * with MAX_PENDING_REQUESTS decoded requests, MAX_PENDING_OUTPUT bytes
+ * of responses or a max_frame of undecoded input waiting is not read
+ * until it catches up, so TCP flow control pushes back on the client. A
+ * length prefix over max_frame closes the connection before any of its
+ * body is buffered.
+ * Optionally, batches are refused while the pool queue is full, requests
+ * that waited too long for a worker are shed, and each client IP is held
+ * to a request rate. Refused requests are answered "Server busy" with the
+ * BUSY flag, in order, without running; QUIT and STATS are always served.
+ */
+class Reactor {
+public:
+    // Called on a pool thread for every request except QUIT and STATS.
+    // response arrives reset(); its buffers are reused across requests.
+    typedef std::function<void(const Request& req, const std::string& peer_address, Response& response)> Handler;
+
+    static const int REQUEST_TIMEOUT_MS = 60000;
+    static const int WRITE_TIMEOUT_MS = 30000;
+
+    // Decoded requests, or bytes of responses, a connection may have
+    // waiting before it is no longer read
+    static const size_t MAX_PENDING_REQUESTS = 4 * NetworkRequestChannel::DEFAULT_MAX_BATCH;
+    static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+
+    // Overload limits of one service; 0 turns a limit off
+    struct Admission {
+        int backlog;                // listen() backlog of the service's channel
+        size_t max_frame;           // largest request frame body; its sender is dropped
+        size_t max_queue;           // pool tasks waiting before new batches are refused
+        int max_queue_delay_ms;     // requests that waited longer for a worker are shed
+        double rate_limit;          // requests per second per client IP, in bursts of
+                                    // up to one second's worth
+
+        Admission();
+    };
+
+    // Command line options for Admission, shared by every server; parse
+    // returns false if name is not one of them
+    static void print_admission_usage();
+    static bool parse_admission_option(const std::string& name, const char* value, Admission& admission);
+
+    Reactor(const std::string& name, NetworkRequestChannel& listener, ThreadPool& pool, Handler handler,
+            const Admission& admission = Admission());
+    ~Reactor();
+
+    // Also serves connections accepted on listener, with their own handler,
+    // metrics and admission limits; call before run(). Returns the
+    // service's metrics.
+    ServerMetrics& add_service(const std::string& name, NetworkRequestChannel& listener, Handler handler,
+                               const Admission& admission = Admission());
+
+    // Runs the event loop until stop_flag becomes true
+    void run(const std::atomic<bool>& stop_flag);
+
+    size_t connection_count() const;
+
+    // Metrics of the service passed to the constructor; servers may add
+    // their own gauges
+    ServerMetrics& metrics() { return services.front()->metrics; }
+
+private:
+    // Rate limit tokens of one client IP, shared by its connections
+    struct ClientBucket {
+        std::mutex mutex;
+        double tokens;
+        std::chrono::steady_clock::time_point refilled;
+
+        explicit ClientBucket(double burst) : tokens(burst), refilled(std::chrono::steady_clock::now()) {}
+    };
+    typedef std::shared_ptr<ClientBucket> ClientBucketPtr;
+
+    struct Service {
+        std::string name;
+        int listen_fd;
+        Handler handler;
+        Admission admission;
+        ServerMetrics metrics;
+        std::atomic<size_t> connections;
+        std::atomic<uint64_t> timeouts; // connections closed for missing a deadline
+        std::atomic<size_t> paused;     // connections not read until their batches catch up
+        std::atomic<uint64_t> refused_queue_full;
+        std::atomic<uint64_t> refused_queue_delay;
+        std::atomic<uint64_t> refused_rate_limit;
+        std::map<std::string, ClientBucketPtr> clients; // by IP; reactor thread only
+        std::chrono::steady_clock::time_point clients_pruned;
+
+        Service(const std::string& _name, int fd, Handler _handler, const Admission& _admission)
+            : name(_name), listen_fd(fd), handler(_handler), admission(_admission), metrics(_name),
+              connections(0), timeouts(0), paused(0), refused_queue_full(0), refused_queue_delay(0),
+              refused_rate_limit(0) {}
+    };
+
+    // A file body sent with sendfile() once out has been written up to position
+    struct Attachment {
+        size_t position;
+        std::shared_ptr<FileBody> body;
+        uint64_t sent;
+
+        Attachment(size_t _position, const std::shared_ptr<FileBody>& _body)
+            : position(_position), body(_body), sent(0) {}
+    };
+
+    struct Connection {
+        int fd;
+        std::string peer;
+        Service* service;           // the listener it was accepted on
+        Wire::Encoding encoding;
+
+        std::vector<char> in;       // received bytes not yet decoded
+        std::vector<Request> pending; // decoded, waiting for a worker
+        std::vector<Request> batch;   // running on the pool; swapped with pending
+        std::vector<Response> responses; // of batch, reused
+        size_t admitted;            // batch[admitted..] is over the rate limit
+        std::chrono::steady_clock::time_point dispatched; // of batch
+        ClientBucketPtr bucket;     // while the service has a rate limit
+        std::string out;            // encoded responses not yet written
+        size_t out_pos;
+        std::deque<Attachment> files; // file bodies spliced into out, in order
+        uint64_t bytes_flushed;
+
+        TimerWheel::TimerId read_timer;  // armed while a request is partly received
+        TimerWheel::TimerId write_timer; // armed while out cannot be written
+
+        bool busy;                  // a batch is running on the pool
+        bool closing;               // close once idle and drained
+        bool paused;                // not read until pending drains
+        std::mutex mutex;
+
+        Connection(int _fd, const std::string& _peer, Service* _service)
+            : fd(_fd), peer(_peer), service(_service), encoding(Wire::TEXT), admitted(0), out_pos(0),
+              bytes_flushed(0), read_timer(0), write_timer(0), busy(false), closing(false), paused(false) {}
+    };
+    typedef std::shared_ptr<Connection> ConnectionPtr;
+
+    void accept_all(Service& service);
+    void prune_clients(Service& service);
+    void handle_readable(const ConnectionPtr& conn);
+    void handle_writable(const ConnectionPtr& conn);
+    size_t decode_locked(Connection& conn, size_t pos);
+    void pause_or_resume_locked(const ConnectionPtr& conn, size_t decoded = 0);
+    void dispatch_locked(const ConnectionPtr& conn);
+    size_t take_tokens(Connection& conn, size_t wanted);
+    void refuse_batch_locked(const ConnectionPtr& conn, const char* reason);
+    void run_batch(const ConnectionPtr& conn);
+    void encode_batch_locked(Connection& conn);
+    bool flush_locked(Connection& conn);
+    bool flush_with_deadline_locked(const ConnectionPtr& conn);
+    void rearm_locked(const ConnectionPtr& conn, TimerWheel::TimerId& timer, int timeout_ms);
+    void disarm_locked(TimerWheel::TimerId& timer);
+    void expire_connection(const std::weak_ptr<Connection>& conn, TimerWheel::TimerId id);
+    void request_close_locked(const ConnectionPtr& conn);
+    void request_resume_locked(const ConnectionPtr& conn);
+    void wake();
+    void close_connection(ConnectionPtr conn);
+    void drain_queues();
+
+    std::string name;
+    int epoll_fd;
+    int wake_fd;                    // eventfd: workers ask the reactor to close or resume connections
+    ThreadPool& pool;
+    TimerWheel timers;              // connection deadlines, expired by run()
+
+    std::vector<std::unique_ptr<Service> > services; // fixed once run() starts
+    std::map<int, ConnectionPtr> connections;        // reactor thread only
+
+    std::mutex close_mutex;         // guards both queues
+    std::vector<ConnectionPtr> close_queue;
+    std::vector<ConnectionPtr> resume_queue; // paused connections to read again
+
+    // Batches queued or running on the pool; the destructor waits for zero
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_done;
+    int outstanding_tasks;
 };
 
 #endif
\ No newline at end of file
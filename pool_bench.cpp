@@ -0,0 +1,90 @@
+#include "thread_pool.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <getopt.h>
+
+using namespace std;
+
+// Measures ThreadPool throughput (tasks/s) for one-at-a-time submission and
+// for parallel_for chunks, at increasing thread counts.
+
+void print_usage() {
+    cout << "Usage: ./pool_bench [-n TASKS] [-t MAX_THREADS]" << endl;
+    cout << "  -n, --tasks        Tasks per measurement (default: 1000000)" << endl;
+    cout << "  -t, --threads      Highest thread count to measure (default: 16)" << endl;
+    cout << "  -h, --help         Show this help message" << endl;
+}
+
+double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t tasks = 1000000;
+    size_t max_threads = 16;
+
+    static struct option long_options[] = {
+        {"tasks", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 't'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "n:t:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'n':
+                tasks = strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                max_threads = strtoul(optarg, nullptr, 10);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    cout << setw(8) << "threads" << setw(18) << "enqueue tasks/s" << setw(22) << "parallel_for tasks/s" << endl;
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        atomic<size_t> counter(0);
+        double enqueue_rate, range_rate;
+
+        {
+            ThreadPool pool(threads);
+            auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < tasks; i++) {
+                pool.enqueue([&counter]() { counter.fetch_add(1, memory_order_relaxed); });
+            }
+            pool.wait_idle();
+            enqueue_rate = tasks / seconds_since(start);
+
+            // One task per index, submitted in bulk
+            start = chrono::steady_clock::now();
+            pool.parallel_for(0, tasks, 1, [&counter](size_t lo, size_t hi) {
+                counter.fetch_add(hi - lo, memory_order_relaxed);
+            });
+            range_rate = tasks / seconds_since(start);
+        }
+
+        if (counter != 2 * tasks) {
+            cerr << "Lost tasks: ran " << counter << " of " << 2 * tasks << endl;
+            return 1;
+        }
+
+        cout << setw(8) << threads << setw(18) << fixed << setprecision(0) << enqueue_rate
+             << setw(22) << range_rate << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "replay.h"
+#include <fstream>
+#include <sstream>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+    typedef chrono::steady_clock Clock;
+
+    int parse_user(istringstream& fields, const string& where) {
+        int user;
+        if (!(fields >> user)) throw runtime_error(where + ": missing user ID!");
+        return user;
+    }
+
+    Money parse_amount(istringstream& fields, const string& where) {
+        string text;
+        Money amount;
+        if (!(fields >> text) || !parse_money(text, amount)) throw runtime_error(where + ": bad amount!");
+        return amount;
+    }
+
+    string parse_word(istringstream& fields, const string& where, const char* what) {
+        string word;
+        if (!(fields >> word)) throw runtime_error(where + ": missing " + what + "!");
+        return word;
+    }
+
+    string read_local_file(const string& path, const string& where) {
+        ifstream in(path, ios::binary);
+        if (!in) throw runtime_error(where + ": cannot read " + path + "!");
+        stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+
+    // Waits for the oldest outstanding reply and counts it
+    void collect(deque<future<Response> >& outstanding, Replay::Stats& stats) {
+        try {
+            Response resp = outstanding.front().get();
+            if (resp.success) stats.succeeded++;
+            else stats.refused++;
+        } catch (const exception&) {
+            stats.failed++;
+        }
+        outstanding.pop_front();
+    }
+}
+
+namespace Replay {
+    vector<Operation> load(const string& path) {
+        ifstream in(path);
+        if (!in) throw runtime_error("cannot open operations file " + path + "!");
+
+        vector<Operation> ops;
+        string line;
+        int number = 0;
+        while (getline(in, line)) {
+            number++;
+            istringstream fields(line);
+            string op;
+            if (!(fields >> op) || op[0] == '#') continue;
+
+            string where = path + ":" + to_string(number);
+            int user = parse_user(fields, where);
+            if (op == "deposit") {
+                ops.push_back(Operation(FINANCE, Request(DEPOSIT, user, parse_amount(fields, where))));
+            } else if (op == "withdraw") {
+                ops.push_back(Operation(FINANCE, Request(WITHDRAW, user, parse_amount(fields, where))));
+            } else if (op == "transfer") {
+                Money amount = parse_amount(fields, where);
+                int to = parse_user(fields, where);
+                ops.push_back(Operation(FINANCE, Request(TRANSFER, user, amount, "", to_string(to))));
+            } else if (op == "balance") {
+                ops.push_back(Operation(FINANCE, Request(BALANCE, user)));
+            } else if (op == "interest") {
+                ops.push_back(Operation(FINANCE, Request(EARN_INTEREST, user)));
+            } else if (op == "upload") {
+                string name = parse_word(fields, where, "file name");
+                string data = read_local_file(parse_word(fields, where, "local file"), where);
+                ops.push_back(Operation(FILE, Request(UPLOAD_FILE, user, 0, name, data)));
+            } else if (op == "download") {
+                ops.push_back(Operation(FILE, Request(DOWNLOAD_FILE, user, 0, parse_word(fields, where, "file name"))));
+            } else if (op == "history") {
+                ops.push_back(Operation(LOGGING, Request(QUERY_LOG, user)));
+            } else {
+                throw runtime_error(where + ": unknown operation " + op + "!");
+            }
+        }
+        return ops;
+    }
+
+    Stats run(const vector<Operation>& ops, const Target targets[NUM_SERVERS],
+              double rate, size_t window, size_t repeat, const atomic<bool>& stop) {
+        Stats stats = Stats();
+        if (window == 0) window = 1;
+
+        deque<future<Response> > outstanding;
+        Clock::time_point start = Clock::now();
+        chrono::duration<double> interval(rate > 0 ? 1.0 / rate : 0.0);
+
+        for (size_t round = 0; round < repeat && !stop; round++) {
+            for (size_t i = 0; i < ops.size() && !stop; i++) {
+                if (rate > 0) {
+                    this_thread::sleep_until(start + chrono::duration_cast<Clock::duration>(interval * (double)stats.sent));
+                }
+                while (outstanding.size() >= window) collect(outstanding, stats);
+
+                try {
+                    outstanding.push_back(targets[ops[i].server](ops[i].request));
+                } catch (const exception&) {
+                    stats.failed++;
+                }
+                stats.sent++;
+            }
+        }
+        while (!outstanding.empty()) collect(outstanding, stats);
+
+        stats.seconds = chrono::duration<double>(Clock::now() - start).count();
+        return stats;
+    }
+}
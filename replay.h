@@ -0,0 +1,63 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Operation replay
+ *
+ * Drives the servers non-interactively from an operations file, one
+ * operation per line. Blank lines and lines starting with '#' are skipped.
+ *
+ *   deposit USER AMOUNT        withdraw USER AMOUNT
+ *   transfer USER AMOUNT TO    (moves AMOUNT from USER to account TO)
+ *   balance USER               interest USER
+ *   upload USER NAME LOCAL     (whole-file upload of local file LOCAL)
+ *   download USER NAME         history USER
+ *
+ * Operations are sent through one target per server (a ConnectionPool,
+ * or a FinanceCluster for sharded finance servers) and started
+ * on a fixed schedule, rate per second, whatever the servers' latency
+ * (open loop), so a slow server shows up as replies lagging behind rather
+ * than as a lower offered load. At most window operations are outstanding;
+ * when the servers fall that far behind, the schedule waits for them.
+ */
+namespace Replay {
+    enum Server { FINANCE, FILE, LOGGING, NUM_SERVERS };
+
+    struct Operation {
+        Server server;
+        Request request;
+
+        Operation(Server s, const Request& r) : server(s), request(r) {}
+    };
+
+    // Sends one request and returns its reply's future, e.g. ConnectionPool::submit
+    typedef std::function<std::future<Response>(const Request&)> Target;
+
+    struct Stats {
+        uint64_t sent;
+        uint64_t succeeded;
+        uint64_t refused;   // the server answered with success false
+        uint64_t failed;    // no answer: the connection failed
+        double seconds;
+    };
+
+    // Parses an operations file; throws runtime_error naming the bad line
+    std::vector<Operation> load(const std::string& path);
+
+    // Replays ops repeat times at rate operations per second (0: as fast as
+    // the window allows). targets[server] must be set for every server
+    // used. Returns early once stop becomes true.
+    Stats run(const std::vector<Operation>& ops, const Target targets[NUM_SERVERS],
+              double rate, size_t window, size_t repeat, const std::atomic<bool>& stop);
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include "server_metrics.h"
+#include <atomic>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+    // Slot index of the calling thread, shared by every ServerMetrics in the process
+    size_t thread_slot() {
+        static atomic<size_t> next(0);
+        thread_local size_t slot = next++ % ServerMetrics::MAX_SLOTS;
+        return slot;
+    }
+
+    const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+}
+
+ServerMetrics::Slot::Slot() : bytes_in(0), bytes_out(0) {
+    for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+        requests[t] = 0;
+        errors[t] = 0;
+    }
+}
+
+ServerMetrics::ServerMetrics(const string& server_name)
+    : name(server_name), started(chrono::steady_clock::now()), slots(new Slot[MAX_SLOTS]) {}
+
+ServerMetrics::Slot& ServerMetrics::local_slot() const {
+    return slots[thread_slot()];
+}
+
+void ServerMetrics::record_request(RequestType type, bool success, uint64_t service_nanos) {
+    if (type < 0 || type >= NUM_REQUEST_TYPES) return;
+
+    Slot& slot = local_slot();
+    lock_guard<mutex> lock(slot.mutex);
+    slot.requests[type]++;
+    if (!success) slot.errors[type]++;
+    if (!slot.service[type]) slot.service[type].reset(new LatencyHistogram());
+    slot.service[type]->record(service_nanos);
+}
+
+void ServerMetrics::record_bytes_in(uint64_t bytes) {
+    Slot& slot = local_slot();
+    lock_guard<mutex> lock(slot.mutex);
+    slot.bytes_in += bytes;
+}
+
+void ServerMetrics::record_bytes_out(uint64_t bytes) {
+    Slot& slot = local_slot();
+    lock_guard<mutex> lock(slot.mutex);
+    slot.bytes_out += bytes;
+}
+
+void ServerMetrics::add_gauge(const string& gauge_name, Gauge gauge) {
+    lock_guard<mutex> lock(gauges_mutex);
+    gauges.push_back(make_pair(gauge_name, gauge));
+}
+
+string ServerMetrics::report() const {
+    uint64_t requests[NUM_REQUEST_TYPES] = {0};
+    uint64_t errors[NUM_REQUEST_TYPES] = {0};
+    uint64_t bytes_in = 0, bytes_out = 0;
+    vector<unique_ptr<LatencyHistogram> > service(NUM_REQUEST_TYPES);
+
+    for (size_t i = 0; i < MAX_SLOTS; i++) {
+        const Slot& slot = slots[i];
+        lock_guard<mutex> lock(slot.mutex);
+        for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+            requests[t] += slot.requests[t];
+            errors[t] += slot.errors[t];
+            if (!slot.service[t]) continue;
+            if (!service[t]) service[t].reset(new LatencyHistogram());
+            service[t]->merge(*slot.service[t]);
+        }
+        bytes_in += slot.bytes_in;
+        bytes_out += slot.bytes_out;
+    }
+
+    ostringstream out;
+    out << "# " << name << endl;
+    out << "uptime_seconds " << chrono::duration<double>(chrono::steady_clock::now() - started).count() << endl;
+    for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+        if (requests[t] == 0) continue;
+        string label = string("type=\"") + request_type_name(static_cast<RequestType>(t)) + "\"";
+        out << "requests_total{" << label << "} " << requests[t] << endl;
+        out << "errors_total{" << label << "} " << errors[t] << endl;
+        for (double q : QUANTILES) {
+            out << "service_time_ns{" << label << ",quantile=\"" << q << "\"} "
+                << service[t]->percentile(q * 100) << endl;
+        }
+        out << "service_time_ns{" << label << ",quantile=\"1\"} " << service[t]->max() << endl;
+        out << "service_time_ns_sum{" << label << "} " << (uint64_t)(service[t]->mean() * service[t]->count()) << endl;
+        out << "service_time_ns_count{" << label << "} " << service[t]->count() << endl;
+    }
+    out << "bytes_in_total " << bytes_in << endl;
+    out << "bytes_out_total " << bytes_out << endl;
+
+    lock_guard<mutex> lock(gauges_mutex);
+    for (const pair<string, Gauge>& gauge : gauges) {
+        out << gauge.first << " " << gauge.second() << endl;
+    }
+    return out.str();
+}
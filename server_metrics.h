@@ -0,0 +1,77 @@
+#ifndef _SERVER_METRICS_H_
+#define _SERVER_METRICS_H_
+
+#include "common.h"
+#include "latency_histogram.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * ServerMetrics class
+ *
+ * Counters for one server: requests and failed responses by RequestType,
+ * service time histograms by RequestType, and bytes received and sent.
+ * Every thread records into a slot of its own (threads past MAX_SLOTS
+ * share), padded so that neighbouring slots do not share a cache line; the
+ * slot's lock is only ever contended by report(), so recording a request
+ * costs an uncontended lock and a histogram increment. Histograms are
+ * allocated the first time a thread serves a request of their type.
+ *
+ * report() adds up the slots on demand and renders them, together with
+ * any registered gauges, as "name value" lines in the Prometheus text
+ * format, e.g.
+ *
+ *   requests_total{type="DEPOSIT"} 1200
+ *   service_time_ns{type="DEPOSIT",quantile="0.99"} 48127
+ */
+class ServerMetrics {
+public:
+    static const size_t MAX_SLOTS = 64;
+
+    typedef std::function<uint64_t()> Gauge;
+
+    explicit ServerMetrics(const std::string& server_name);
+
+    ServerMetrics(const ServerMetrics&) = delete;
+    ServerMetrics& operator=(const ServerMetrics&) = delete;
+
+    // Counts one request; success is the response's success flag
+    void record_request(RequestType type, bool success, uint64_t service_nanos);
+    void record_bytes_in(uint64_t bytes);
+    void record_bytes_out(uint64_t bytes);
+
+    // Adds a value sampled by every report(), e.g. a queue depth
+    void add_gauge(const std::string& name, Gauge gauge);
+
+    std::string report() const;
+
+private:
+    struct Slot {
+        mutable std::mutex mutex;
+        uint64_t requests[NUM_REQUEST_TYPES];
+        uint64_t errors[NUM_REQUEST_TYPES];
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        std::unique_ptr<LatencyHistogram> service[NUM_REQUEST_TYPES];
+        char padding[64];
+
+        Slot();
+    };
+
+    Slot& local_slot() const;
+
+    std::string name;
+    std::chrono::steady_clock::time_point started;
+    std::unique_ptr<Slot[]> slots;
+
+    mutable std::mutex gauges_mutex;
+    std::vector<std::pair<std::string, Gauge> > gauges;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "shard_map.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+    // splitmix64 finalizer: spreads nearby user IDs over the whole ring
+    uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // FNV-1a, then mixed
+    uint64_t hash_text(const string& text) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (unsigned char c : text) {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+        return mix(h);
+    }
+}
+
+ShardMap ShardMap::load(const string& path) {
+    ifstream in(path);
+    if (!in) throw runtime_error("cannot open shard map " + path + "!");
+
+    vector<Shard> shards;
+    string line;
+    int number = 0;
+    while (getline(in, line)) {
+        number++;
+        istringstream fields(line);
+        Shard shard;
+        if (!(fields >> shard.name) || shard.name[0] == '#') continue;
+
+        string where = path + ":" + to_string(number);
+        if (!(fields >> shard.host >> shard.port) || shard.port <= 0 || shard.port > 65535) {
+            throw runtime_error(where + ": expected NAME HOST PORT [WEIGHT]!");
+        }
+        int weight;
+        if (!(fields >> weight)) weight = 1;
+        else if (weight <= 0) throw runtime_error(where + ": weight must be positive!");
+        shard.weight = weight;
+        for (const Shard& other : shards) {
+            if (other.name == shard.name) throw runtime_error(where + ": duplicate shard " + shard.name + "!");
+        }
+        shards.push_back(shard);
+    }
+    if (shards.empty()) throw runtime_error("shard map " + path + " lists no shards!");
+    return ShardMap(shards);
+}
+
+ShardMap::ShardMap(const vector<Shard>& shards) : shard_list(shards) {
+    if (shard_list.empty()) throw runtime_error("shard map needs at least one shard!");
+
+    for (size_t i = 0; i < shard_list.size(); i++) {
+        unsigned points = VNODES_PER_WEIGHT * shard_list[i].weight;
+        for (unsigned v = 0; v < points; v++) {
+            ring.push_back(make_pair(hash_text(shard_list[i].name + "#" + to_string(v)), i));
+        }
+    }
+    sort(ring.begin(), ring.end());
+}
+
+size_t ShardMap::shard_for(int user_id) const {
+    uint64_t point = mix(static_cast<uint32_t>(user_id));
+    vector<pair<uint64_t, size_t> >::const_iterator it =
+        lower_bound(ring.begin(), ring.end(), make_pair(point, (size_t)0));
+    if (it == ring.end()) it = ring.begin();
+    return it->second;
+}
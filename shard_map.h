@@ -0,0 +1,54 @@
+#ifndef _SHARD_MAP_H_
+#define _SHARD_MAP_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * ShardMap class
+ *
+ * Assigns user IDs to finance shards by consistent hashing. A shard map
+ * file lists one shard per line, blank lines and '#' comments skipped:
+ *
+ *   NAME HOST PORT [WEIGHT]
+ *
+ * Every shard puts VNODES_PER_WEIGHT * WEIGHT points on a 64-bit hash
+ * ring, hashed from its name, and a user belongs to the first point at or
+ * after the hash of the user ID. Adding or removing a shard therefore
+ * only moves the users between it and its ring neighbours, and since the
+ * points depend on the name alone, a shard can move to another host
+ * without moving any users. The hashes are fixed, so every client with
+ * the same file routes alike.
+ *
+ * A ShardMap is immutable once loaded and safe to share between threads.
+ */
+class ShardMap {
+public:
+    static const unsigned VNODES_PER_WEIGHT = 128;
+
+    struct Shard {
+        std::string name;
+        std::string host;
+        int port;
+        unsigned weight;
+    };
+
+    // Parses a shard map file; throws runtime_error naming the bad line
+    static ShardMap load(const std::string& path);
+
+    explicit ShardMap(const std::vector<Shard>& shards);
+
+    // Index into shards() of the shard that owns user_id
+    size_t shard_for(int user_id) const;
+
+    const std::vector<Shard>& shards() const { return shard_list; }
+
+private:
+    std::vector<Shard> shard_list;
+    std::vector<std::pair<uint64_t, size_t> > ring; // (point, shard index), sorted
+};
+
+#endif
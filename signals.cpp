@@ -3,21 +3,13 @@
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include <ctime>
-#include <algorithm>
-#include <sstream>
 
 using namespace std;
 
 namespace SignalHandling {
     // Initialize atomic flags
     std::atomic<bool> shutdown_requested(false);
-    std::atomic<bool> timeout_occurred(false);
-    std::atomic<int> child_exited(0);
-    
-    // Server process registry
-    std::vector<ServerProcess> server_processes;
     
     void setup_handlers() {
         
@@ -25,14 +17,6 @@ namespace SignalHandling {
         memset(&sa, 0, sizeof(sa));
         sigemptyset(&sa.sa_mask);
 
-        // Set up SIGALRM handler
-        sa.sa_handler = sigalrm_handler;
-        sa.sa_flags = 0;
-        if (sigaction(SIGALRM, &sa, NULL) == -1) {
-            perror("Failed to set SIGALRM handler");
-            exit(1);
-        }
-        
         // Set up SIGINT handler
         sa.sa_handler = sigint_handler;
         sa.sa_flags = 0;
@@ -41,14 +25,6 @@ namespace SignalHandling {
             exit(1);
         }
         
-        // Set up SIGCHLD handler
-        sa.sa_handler = sigchld_handler;
-        sa.sa_flags = SA_RESTART; // Restart interrupted system calls
-        if (sigaction(SIGCHLD, &sa, NULL) == -1) {
-            perror("Failed to set SIGCHLD handler");
-            exit(1);
-        }
-        
         log_signal_event("Signal handlers initialized");
     }
     
@@ -68,34 +44,6 @@ namespace SignalHandling {
         }
     }
     
-    void sigalrm_handler(int sig) {
-        timeout_occurred = true;
-        write(STDOUT_FILENO, "SIGALRM fired!\n", 15);
-        log_signal_event("SIGALRM received - operation timed out");
-    }
-    
-    void sigchld_handler(int sig) {
-        int status;
-        pid_t pid;
-        
-        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-            child_exited++;
-            
-            // Update server registry
-            for (auto& server : server_processes) {
-                if (server.pid == pid) {
-                    server.active = false;
-                    
-                    std::stringstream ss;
-                    ss << "Child process terminated: " << server.name << " (PID: " << pid << ")";
-                    log_signal_event(ss.str());
-                    
-                    break;
-                }
-            }
-        }
-    }
-    
     void block_signals() {
         sigset_t mask;
         sigemptyset(&mask);
@@ -120,40 +68,6 @@ namespace SignalHandling {
         }
     }
     
-    bool wait_with_timeout(int seconds) {
-        timeout_occurred = false;
-        alarm(seconds);
-        return true;
-    }
-    
-    void cancel_timeout() {
-        alarm(0);
-    }
-    
-    void register_server(pid_t pid, const std::string& name) {
-        server_processes.push_back({pid, name, true});
-        
-        std::stringstream ss;
-        ss << "Registered server: " << name << " (PID: " << pid << ")";
-        log_signal_event(ss.str());
-    }
-    
-    bool is_server_active(const std::string& name) {
-        auto it = std::find_if(server_processes.begin(), server_processes.end(),
-                              [&name](const ServerProcess& p) { return p.name == name; });
-        
-        return (it != server_processes.end()) && it->active;
-    }
-    
-    void print_server_status() {
-        std::cout << "\n=== Server Status ===\n";
-        for (const auto& server : server_processes) {
-            std::cout << server.name << " (PID: " << server.pid << "): "
-                      << (server.active ? "ACTIVE" : "TERMINATED") << std::endl;
-        }
-        std::cout << "====================\n";
-    }
-    
     void log_signal_event(const std::string& message) {
         // Get timestamp
         time_t now = time(NULL);
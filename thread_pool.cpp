@@ -1,32 +1,24 @@
 #include "thread_pool.h"
 
-ThreadPool::ThreadPool(size_t numThreads) : stop(false), activeTasks(0) {
-    for (size_t i = 0; i < numThreads; ++i) {
-        workers.emplace_back([this] {
-            while (true) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(queueMutex);
-                    condition.wait(lock, [this] { return stop || !tasks.empty(); });
-
-                    if (stop && tasks.empty()) return;
+namespace {
+    // Identifies the pool and queue of the current worker thread
+    thread_local ThreadPool* currentPool = nullptr;
+    thread_local size_t currentIndex = 0;
+}
 
-                    task = std::move(tasks.front());
-                    tasks.pop();
-                }
-                ++activeTasks;
-                task();
-                --activeTasks;
-                condition.notify_all();
-            }
-        });
+ThreadPool::ThreadPool(size_t numThreads)
+    : numQueues(numThreads > 0 ? numThreads : 1), nextQueue(0), queuedTasks(0),
+      unfinished(0), sleepers(0), stop(false) {
+    queues.reset(new WorkerQueue[numQueues]);
+    for (size_t i = 0; i < numQueues; ++i) {
+        workers.emplace_back([this, i] { workerLoop(i); });
     }
 }
 
 ThreadPool::~ThreadPool() {
+    wait_idle();
     {
-        std::unique_lock<std::mutex> lock(queueMutex);
-        condition.wait(lock, [this] { return tasks.empty() && activeTasks == 0; });
+        std::lock_guard<std::mutex> lock(sleepMutex);
         stop = true;
     }
     condition.notify_all();
@@ -35,10 +27,123 @@ ThreadPool::~ThreadPool() {
     }
 }
 
-void ThreadPool::enqueue(std::function<void()> task) {
+void ThreadPool::workerLoop(size_t index) {
+    currentPool = this;
+    currentIndex = index;
+
+    while (true) {
+        Task task;
+        if (popTask(index, task) || stealTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        ++sleepers;
+        condition.wait(lock, [this] { return stop || queuedTasks > 0; });
+        --sleepers;
+        if (stop && queuedTasks == 0) return;
+    }
+}
+
+// Own queue: oldest first
+bool ThreadPool::popTask(size_t index, Task& task) {
+    WorkerQueue& wq = queues[index];
+    std::lock_guard<std::mutex> lock(wq.mutex);
+    if (wq.tasks.empty()) return false;
+    task = std::move(wq.tasks.front());
+    wq.tasks.pop_front();
+    --queuedTasks;
+    return true;
+}
+
+// Other queues: take from the back so the owner and thief rarely meet
+bool ThreadPool::stealTask(size_t index, Task& task) {
+    for (size_t i = 1; i < numQueues; ++i) {
+        WorkerQueue& wq = queues[(index + i) % numQueues];
+        std::unique_lock<std::mutex> lock(wq.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || wq.tasks.empty()) continue;
+        task = std::move(wq.tasks.back());
+        wq.tasks.pop_back();
+        --queuedTasks;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::tryRunOne() {
+    Task task;
+    size_t index = (currentPool == this) ? currentIndex : submitQueue();
+    if (popTask(index, task) || stealTask(index, task)) {
+        runTask(task);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::runTask(Task& task) {
+    task();
+    if (--unfinished == 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        idleCondition.notify_all();
+    }
+}
+
+// Workers submit to their own queue, everyone else round-robin
+size_t ThreadPool::submitQueue() {
+    if (currentPool == this) return currentIndex;
+    return nextQueue.fetch_add(1, std::memory_order_relaxed) % numQueues;
+}
+
+// Only touches the sleep lock when somebody is actually asleep
+void ThreadPool::notifyWorkers(size_t count) {
+    if (sleepers.load() == 0) return;
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    if (count == 1) condition.notify_one();
+    else condition.notify_all();
+}
+
+void ThreadPool::enqueue(Task task) {
+    ++unfinished;
+    ++queuedTasks;
+    WorkerQueue& wq = queues[submitQueue()];
+    {
+        std::lock_guard<std::mutex> lock(wq.mutex);
+        wq.tasks.push_back(std::move(task));
+    }
+    notifyWorkers(1);
+}
+
+bool ThreadPool::try_enqueue(Task task, size_t max_queued) {
+    // Claim a queue slot first, so concurrent callers cannot overshoot
+    size_t queued = queuedTasks.load();
+    do {
+        if (queued >= max_queued) return false;
+    } while (!queuedTasks.compare_exchange_weak(queued, queued + 1));
+
+    ++unfinished;
+    WorkerQueue& wq = queues[submitQueue()];
     {
-        std::unique_lock<std::mutex> lock(queueMutex);
-        tasks.push(task);
+        std::lock_guard<std::mutex> lock(wq.mutex);
+        wq.tasks.push_back(std::move(task));
     }
-    condition.notify_one();
-}
\ No newline at end of file
+    notifyWorkers(1);
+    return true;
+}
+
+void ThreadPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    idleCondition.wait(lock, [this] { return unfinished == 0; });
+}
+
+size_t ThreadPool::size() const {
+    return workers.size();
+}
+
+size_t ThreadPool::queued() const {
+    return queuedTasks.load(std::memory_order_relaxed);
+}
+
+size_t ThreadPool::outstanding() const {
+    return unfinished.load(std::memory_order_relaxed);
+}
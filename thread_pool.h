@@ -2,26 +2,324 @@
 #define THREAD_POOL_H
 
 #include <vector>
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <functional>
+#include <memory>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <chrono>
 
+// Move-only callable with inline storage. Callables up to INLINE_SIZE bytes
+// (a lambda capturing a few pointers or a shared_ptr) are stored in place,
+// so submitting them does not allocate; larger ones fall back to the heap.
+class Task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    Task() : ops(nullptr) {}
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) : ops(nullptr) {
+        typedef typename std::decay<F>::type Fn;
+        emplace<Fn>(std::forward<F>(f), std::integral_constant<bool, fits_inline<Fn>()>());
+    }
+
+    Task(Task&& other) : ops(other.ops) {
+        if (ops) {
+            ops->move(storage, other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) {
+        if (this != &other) {
+            reset();
+            ops = other.ops;
+            if (ops) {
+                ops->move(storage, other.storage);
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+    explicit operator bool() const { return ops != nullptr; }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Fn>
+    static constexpr bool fits_inline() {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<typename Fn>
+    struct InlineOps {
+        static void invoke(void* s) { (*static_cast<Fn*>(s))(); }
+        static void move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* s) { static_cast<Fn*>(s)->~Fn(); }
+        static const Ops ops;
+    };
+
+    template<typename Fn>
+    struct HeapOps {
+        static Fn*& ptr(void* s) { return *static_cast<Fn**>(s); }
+        static void invoke(void* s) { (*ptr(s))(); }
+        static void move(void* dst, void* src) { new (dst) Fn*(ptr(src)); }
+        static void destroy(void* s) { delete ptr(s); }
+        static const Ops ops;
+    };
+
+    template<typename Fn, typename F>
+    void emplace(F&& f, std::true_type) {
+        new (storage) Fn(std::forward<F>(f));
+        ops = &InlineOps<Fn>::ops;
+    }
+
+    template<typename Fn, typename F>
+    void emplace(F&& f, std::false_type) {
+        new (storage) Fn*(new Fn(std::forward<F>(f)));
+        ops = &HeapOps<Fn>::ops;
+    }
+
+    void reset() {
+        if (ops) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+    const Ops* ops;
+};
+
+template<typename Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = { &InlineOps<Fn>::invoke, &InlineOps<Fn>::move, &InlineOps<Fn>::destroy };
+
+template<typename Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = { &HeapOps<Fn>::invoke, &HeapOps<Fn>::move, &HeapOps<Fn>::destroy };
+
+// Double-ended queue of tasks in a ring buffer. Unlike std::deque, which
+// allocates and frees a block every few tasks as they flow through, the
+// ring only grows (to a power of two), so a busy queue stops allocating
+// once it has reached its working size. Slots are constructed only while
+// they hold a task.
+class TaskQueue {
+public:
+    TaskQueue() : slots(nullptr), capacity(0), head(0), count(0) {}
+    ~TaskQueue() {
+        while (count > 0) pop_front();
+        ::operator delete(slots);
+    }
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    Task& front() { return slots[head]; }
+    Task& back() { return slots[(head + count - 1) & (capacity - 1)]; }
+
+    // Room for n tasks without growing again
+    void reserve(size_t n) {
+        if (n <= capacity) return;
+        size_t bigger = capacity ? capacity : 16;
+        while (bigger < n) bigger *= 2;
+        grow(bigger);
+    }
+
+    void push_back(Task&& task) {
+        if (count == capacity) grow(capacity ? capacity * 2 : 16);
+        new (&slots[(head + count) & (capacity - 1)]) Task(std::move(task));
+        count++;
+    }
+
+    template<typename F>
+    void emplace_back(F&& f) { push_back(Task(std::forward<F>(f))); }
+
+    void pop_front() {
+        slots[head].~Task();
+        head = (head + 1) & (capacity - 1);
+        count--;
+    }
+
+    void pop_back() {
+        back().~Task();
+        count--;
+    }
+
+private:
+    void grow(size_t bigger) {
+        Task* moved = static_cast<Task*>(::operator new(bigger * sizeof(Task)));
+        for (size_t i = 0; i < count; i++) {
+            Task& task = slots[(head + i) & (capacity - 1)];
+            new (&moved[i]) Task(std::move(task));
+            task.~Task();
+        }
+        ::operator delete(slots);
+        slots = moved;
+        capacity = bigger;
+        head = 0;
+    }
+
+    Task* slots;     // capacity is zero or a power of two
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+// Work-stealing thread pool. Each worker owns a queue; tasks submitted from
+// outside the pool are spread round-robin over the queues, tasks submitted
+// by a worker go to its own queue. An idle worker steals from the others
+// before going to sleep, and sleeping workers are only woken when there is
+// work for them.
 class ThreadPool {
 private:
+    // Padded so neighbouring queues do not share a cache line
+    struct WorkerQueue {
+        std::mutex mutex;
+        TaskQueue tasks;
+        char padding[64];
+    };
+
     std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queueMutex;
+    std::unique_ptr<WorkerQueue[]> queues;
+    size_t numQueues;
+
+    std::atomic<size_t> nextQueue;   // round-robin target for external submissions
+    std::atomic<size_t> queuedTasks; // tasks sitting in a queue
+    std::atomic<size_t> unfinished;  // queued + running
+    std::atomic<int> sleepers;
+    std::atomic<bool> stop;
+
+    std::mutex sleepMutex;
     std::condition_variable condition;
-    bool stop;
-    std::atomic<int> activeTasks;
+    std::condition_variable idleCondition;
+
+    void workerLoop(size_t index);
+    bool popTask(size_t index, Task& task);
+    bool stealTask(size_t index, Task& task);
+    bool tryRunOne();
+    void runTask(Task& task);
+    size_t submitQueue();
+    void notifyWorkers(size_t count);
+
+    // Shared state of one parallel_for call
+    struct RangeLatch {
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        explicit RangeLatch(size_t n) : remaining(n) {}
+        void countDown() {
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    };
 
 public:
     ThreadPool(size_t numThreads);
     ~ThreadPool();
-    void enqueue(std::function<void()> task);
+
+    void enqueue(Task task);
+
+    // Like enqueue, unless max_queued tasks are already waiting, in which
+    // case the task is dropped and false returned. Lets servers refuse work
+    // instead of queueing it without bound.
+    bool try_enqueue(Task task, size_t max_queued);
+
+    // Splits [begin, end) into chunks of at most grain indices and submits
+    // fn(chunk_begin, chunk_end) for each chunk, taking each queue's lock
+    // once for the whole range.
+    template<typename F>
+    void enqueue_range(size_t begin, size_t end, size_t grain, F fn);
+
+    // Like enqueue_range, but returns once every chunk has run. Safe to call
+    // from a worker of this pool: the caller runs tasks while it waits.
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F fn);
+
+    // Blocks until every submitted task has finished
+    void wait_idle();
+
+    size_t size() const;
+
+    // Tasks waiting in a queue, and tasks queued or running (for metrics)
+    size_t queued() const;
+    size_t outstanding() const;
 };
 
-#endif
\ No newline at end of file
+template<typename F>
+void ThreadPool::enqueue_range(size_t begin, size_t end, size_t grain, F fn) {
+    if (begin >= end) return;
+    if (grain == 0) grain = 1;
+
+    size_t chunks = (end - begin + grain - 1) / grain;
+    size_t perQueue = (chunks + numQueues - 1) / numQueues;
+    size_t first = submitQueue();
+
+    unfinished += chunks;
+    queuedTasks += chunks;
+
+    size_t lo = begin;
+    for (size_t q = 0; q < numQueues && lo < end; q++) {
+        WorkerQueue& wq = queues[(first + q) % numQueues];
+        std::lock_guard<std::mutex> lock(wq.mutex);
+        wq.tasks.reserve(wq.tasks.size() + perQueue);
+        for (size_t c = 0; c < perQueue && lo < end; c++) {
+            size_t hi = (end - lo > grain) ? lo + grain : end;
+            wq.tasks.emplace_back([fn, lo, hi]() { fn(lo, hi); });
+            lo = hi;
+        }
+    }
+
+    notifyWorkers(chunks);
+}
+
+template<typename F>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, F fn) {
+    if (begin >= end) return;
+    if (grain == 0) grain = 1;
+
+    size_t chunks = (end - begin + grain - 1) / grain;
+    std::shared_ptr<RangeLatch> latch = std::make_shared<RangeLatch>(chunks);
+
+    enqueue_range(begin, end, grain, [fn, latch](size_t lo, size_t hi) {
+        fn(lo, hi);
+        latch->countDown();
+    });
+
+    // Help out instead of blocking, so a worker calling parallel_for cannot
+    // deadlock the pool
+    while (latch->remaining > 0) {
+        if (tryRunOne()) continue;
+
+        std::unique_lock<std::mutex> lock(latch->mutex);
+        latch->done.wait_for(lock, std::chrono::milliseconds(1),
+                             [&latch] { return latch->remaining == 0; });
+    }
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "timer_wheel.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+TimerWheel::TimerWheel(int _tick_ms, size_t slot_count)
+    : tick_ms(max(_tick_ms, 1)), started(chrono::steady_clock::now()),
+      slots(max(slot_count, (size_t)1)), current_tick(0), next_id(1), armed(false) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        throw runtime_error("timerfd_create() failed!");
+    }
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd < 0) {
+        close(timer_fd);
+        throw runtime_error("eventfd() failed!");
+    }
+}
+
+TimerWheel::~TimerWheel() {
+    if (runner.joinable()) {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0) {}
+        runner.join();
+    }
+    close(stop_fd);
+    close(timer_fd);
+}
+
+uint64_t TimerWheel::ticks_since_start() const {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count() / tick_ms;
+}
+
+// Starts the periodic tick; caller holds mutex
+void TimerWheel::arm_locked() {
+    if (armed) return;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_sec = tick_ms / 1000;
+    spec.it_interval.tv_nsec = (long)(tick_ms % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        throw runtime_error("timerfd_settime() failed!");
+    }
+    armed = true;
+}
+
+TimerWheel::TimerId TimerWheel::schedule(int64_t delay_ms, Callback callback) {
+    // Round up, so the timer never fires early
+    int64_t elapsed_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    uint64_t expiry_tick = (uint64_t)((elapsed_ms + max(delay_ms, (int64_t)0) + tick_ms) / tick_ms);
+
+    lock_guard<std::mutex> lock(mutex);
+    expiry_tick = max(expiry_tick, current_tick + 1);
+    arm_locked();
+
+    TimerId id = next_id++;
+    Timer& timer = timers[id];
+    timer.expiry_tick = expiry_tick;
+    timer.callback = std::move(callback);
+    slots[expiry_tick % slots.size()].push_back(id);
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    // The slot entry is dropped when the wheel next passes it
+    lock_guard<std::mutex> lock(mutex);
+    return timers.erase(id) > 0;
+}
+
+size_t TimerWheel::pending() const {
+    lock_guard<std::mutex> lock(mutex);
+    return timers.size();
+}
+
+void TimerWheel::expire() {
+    uint64_t ticks;
+    while (read(timer_fd, &ticks, sizeof(ticks)) > 0) {}
+
+    vector<pair<TimerId, Callback> > due;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        uint64_t now_tick = ticks_since_start();
+        if (now_tick > current_tick && !timers.empty()) {
+            // One full turn visits every slot, however far behind the wheel is
+            uint64_t steps = min(now_tick - current_tick, (uint64_t)slots.size());
+            vector<TimerId> kept;
+            for (uint64_t i = 1; i <= steps; i++) {
+                vector<TimerId>& slot = slots[(current_tick + i) % slots.size()];
+                kept.clear();
+                for (TimerId id : slot) {
+                    unordered_map<TimerId, Timer>::iterator it = timers.find(id);
+                    if (it == timers.end()) continue;
+                    if (it->second.expiry_tick <= now_tick) {
+                        due.push_back(make_pair(id, std::move(it->second.callback)));
+                        timers.erase(it);
+                    } else {
+                        kept.push_back(id); // a later turn
+                    }
+                }
+                slot.swap(kept);
+            }
+        }
+        current_tick = max(current_tick, now_tick);
+
+        // Stop ticking while there is nothing to wait for
+        if (timers.empty() && armed) {
+            for (vector<TimerId>& slot : slots) slot.clear();
+            struct itimerspec spec;
+            memset(&spec, 0, sizeof(spec));
+            timerfd_settime(timer_fd, 0, &spec, NULL);
+            armed = false;
+        }
+    }
+
+    for (pair<TimerId, Callback>& timer : due) {
+        timer.second(timer.first);
+    }
+}
+
+void TimerWheel::start() {
+    if (runner.joinable()) return;
+    runner = thread([this]() {
+        struct pollfd fds[2];
+        fds[0].fd = timer_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_fd;
+        fds[1].events = POLLIN;
+        while (true) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            if (fds[1].revents) return;
+            if (fds[0].revents) expire();
+        }
+    });
+}
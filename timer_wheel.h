@@ -0,0 +1,89 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * TimerWheel class
+ *
+ * Hashed timing wheel for deadlines: scheduling and cancelling a timer
+ * are O(1) whatever the number outstanding, so every request or
+ * connection can carry its own. Time advances in ticks of tick_ms driven
+ * by a timerfd, which only ticks while timers are outstanding. No signals
+ * are involved, so timers never interrupt unrelated system calls.
+ *
+ * An event loop registers fd() for reading and calls expire() when it is
+ * readable, which runs the due callbacks on that thread; start() runs the
+ * same loop on a thread of the wheel's own. A timer never fires early, and
+ * fires within two ticks of its deadline once the loop gets to it.
+ * Callbacks run without the wheel's lock held and may schedule or cancel
+ * timers.
+ *
+ * Safe to call from any number of threads.
+ */
+class TimerWheel {
+public:
+    typedef uint64_t TimerId; // 0 is never a timer
+
+    // Receives the ID that schedule() returned for it
+    typedef std::function<void(TimerId id)> Callback;
+
+    static const int DEFAULT_TICK_MS = 10;
+    static const size_t DEFAULT_SLOTS = 1024;
+
+    // Throws runtime_error if the timerfd cannot be created
+    explicit TimerWheel(int tick_ms = DEFAULT_TICK_MS, size_t slots = DEFAULT_SLOTS);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Runs callback once, delay_ms from now
+    TimerId schedule(int64_t delay_ms, Callback callback);
+
+    // Returns false if the timer already fired (or is firing) or never existed
+    bool cancel(TimerId id);
+
+    size_t pending() const;
+
+    // Readable while a tick is due
+    int fd() const { return timer_fd; }
+
+    // Runs every callback that is due
+    void expire();
+
+    // Calls expire() on a thread of the wheel's own until destruction
+    void start();
+
+private:
+    struct Timer {
+        uint64_t expiry_tick;
+        Callback callback;
+    };
+
+    uint64_t ticks_since_start() const;
+    void arm_locked();
+
+    int tick_ms;
+    int timer_fd;
+    int stop_fd;                    // eventfd: wakes the wheel's own thread
+    std::chrono::steady_clock::time_point started;
+
+    mutable std::mutex mutex;       // guards everything below
+    std::vector<std::vector<TimerId> > slots; // may hold IDs since cancelled
+    std::unordered_map<TimerId, Timer> timers;
+    uint64_t current_tick;          // every slot up to here has been expired
+    TimerId next_id;
+    bool armed;
+
+    std::thread runner;
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "wire.h"
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <endian.h>
+
+using namespace std;
+
+namespace {
+    void put_u8(string& out, uint8_t v) {
+        out.push_back(static_cast<char>(v));
+    }
+
+    void put_u16(string& out, uint16_t v) {
+        uint16_t n = htons(v);
+        out.append(reinterpret_cast<const char*>(&n), 2);
+    }
+
+    void put_u32(string& out, uint32_t v) {
+        uint32_t n = htonl(v);
+        out.append(reinterpret_cast<const char*>(&n), 4);
+    }
+
+    void put_i64(string& out, int64_t v) {
+        uint64_t n = htobe64(static_cast<uint64_t>(v));
+        out.append(reinterpret_cast<const char*>(&n), 8);
+    }
+
+    uint16_t get_u16(const char* p) {
+        uint16_t n;
+        memcpy(&n, p, 2);
+        return ntohs(n);
+    }
+
+    uint32_t get_u32(const char* p) {
+        uint32_t n;
+        memcpy(&n, p, 4);
+        return ntohl(n);
+    }
+
+    int64_t get_i64(const char* p) {
+        uint64_t n;
+        memcpy(&n, p, 8);
+        return static_cast<int64_t>(be64toh(n));
+    }
+
+    // Reserve the length prefix; returns its position so it can be patched
+    size_t begin_frame(string& out) {
+        size_t start = out.size();
+        out.append(Wire::LENGTH_PREFIX_SIZE, '\0');
+        return start;
+    }
+
+    // extra counts bytes of the frame that are sent separately (file bodies)
+    void end_frame(string& out, size_t start, uint64_t extra = 0) {
+        uint64_t body = out.size() - start - Wire::LENGTH_PREFIX_SIZE + extra;
+        if (body > UINT32_MAX) {
+            throw runtime_error("message too large for one frame!");
+        }
+        uint32_t len = htonl(static_cast<uint32_t>(body));
+        memcpy(&out[start], &len, 4);
+    }
+
+    uint64_t file_bodies_length(const Response& resp) {
+        uint64_t len = 0;
+        for (const shared_ptr<FileBody>& body : resp.file_bodies) len += body->length;
+        return len;
+    }
+
+    // Copies the file bodies into memory, for callers that cannot stream them
+    string read_file_bodies(const Response& resp) {
+        string data(file_bodies_length(resp), '\0');
+        size_t pos = 0;
+        for (const shared_ptr<FileBody>& body : resp.file_bodies) {
+            if (!body->read(&data[pos])) throw runtime_error("file body read failed!");
+            pos += body->length;
+        }
+        return data;
+    }
+
+    void check_binary_header(const char* body, size_t len, size_t header_size) {
+        if (len < header_size) {
+            throw runtime_error("binary message truncated!");
+        }
+        if (static_cast<uint8_t>(body[1]) != Wire::VERSION) {
+            throw runtime_error("unsupported wire version " + to_string(static_cast<uint8_t>(body[1])));
+        }
+    }
+
+    // Calls fn(body, len) for every length-prefixed frame in data
+    template<typename Func>
+    void for_each_frame(const string& data, Func fn) {
+        size_t pos = 0;
+        while (pos < data.size()) {
+            if (data.size() - pos < Wire::LENGTH_PREFIX_SIZE) {
+                throw runtime_error("batch frame truncated!");
+            }
+            uint32_t len = get_u32(data.data() + pos);
+            pos += Wire::LENGTH_PREFIX_SIZE;
+            if (data.size() - pos < len) {
+                throw runtime_error("batch frame truncated!");
+            }
+            fn(data.data() + pos, len);
+            pos += len;
+        }
+    }
+}
+
+namespace Wire {
+    Encoding detect_encoding(const char* body, size_t len) {
+        if (len > 0 && static_cast<uint8_t>(body[0]) == MAGIC) return BINARY;
+        return TEXT;
+    }
+
+    void encode_request(const Request& req, Encoding enc, string& out) {
+        encode_request(req, req.request_id, enc, out);
+    }
+
+    void encode_request(const Request& req, uint32_t request_id, Encoding enc, string& out) {
+        encode_request_streamed(req, request_id, enc, out);
+        out.append(req.data);
+    }
+
+    size_t encode_request_streamed(const Request& req, uint32_t request_id, Encoding enc, string& out) {
+        size_t start = begin_frame(out);
+
+        if (enc == BINARY) {
+            put_u8(out, MAGIC);
+            put_u8(out, VERSION);
+            put_u16(out, static_cast<uint16_t>(req.type));
+            put_u32(out, request_id);
+            put_u32(out, static_cast<uint32_t>(req.user_id));
+            put_i64(out, req.amount);
+            put_i64(out, static_cast<int64_t>(req.offset));
+            put_u32(out, req.flags);
+            put_u32(out, req.filename.size());
+            put_u32(out, req.data.size());
+            out.append(req.filename);
+        } else {
+            // Format: TYPE|USER_ID|AMOUNT|FILENAME|DATA
+            out.append(to_string(static_cast<int>(req.type)));
+            out.push_back('|');
+            out.append(to_string(req.user_id));
+            out.push_back('|');
+            out.append(format_money(req.amount));
+            out.push_back('|');
+            out.append(req.filename);
+            out.push_back('|');
+        }
+
+        end_frame(out, start, req.data.size());
+        return out.size();
+    }
+
+    void encode_response(const Response& resp, Encoding enc, string& out) {
+        if (resp.file_bodies.empty()) {
+            encode_response_streamed(resp, enc, out);
+            return;
+        }
+
+        // Read before encoding so a failed read leaves out untouched
+        string data = read_file_bodies(resp);
+        size_t at = encode_response_streamed(resp, enc, out);
+        out.insert(at, data);
+    }
+
+    size_t encode_response_streamed(const Response& resp, Encoding enc, string& out) {
+        size_t start = begin_frame(out);
+        bool streamed = !resp.file_bodies.empty();
+        uint64_t body_len = file_bodies_length(resp);
+        uint64_t data_len = streamed ? body_len : resp.data.size();
+        size_t at;
+
+        if (enc == BINARY) {
+            if (data_len > UINT32_MAX) {
+                throw runtime_error("message too large for one frame!");
+            }
+            put_u8(out, MAGIC);
+            put_u8(out, VERSION);
+            put_u8(out, resp.success ? 1 : 0);
+            put_u8(out, resp.flags);
+            put_u32(out, resp.request_id);
+            put_i64(out, resp.balance);
+            put_i64(out, static_cast<int64_t>(resp.offset));
+            put_u32(out, static_cast<uint32_t>(data_len));
+            put_u32(out, resp.message.size());
+            if (!streamed) out.append(resp.data);
+            at = out.size();
+            out.append(resp.message);
+        } else {
+            // Format: SUCCESS|BALANCE|DATA|MESSAGE
+            out.push_back(resp.success ? '1' : '0');
+            out.push_back('|');
+            out.append(format_money(resp.balance));
+            out.push_back('|');
+            if (!streamed) out.append(resp.data);
+            at = out.size();
+            out.push_back('|');
+            out.append(resp.message);
+        }
+
+        end_frame(out, start, body_len);
+        return at;
+    }
+
+    Request decode_request(const char* body, size_t len) {
+        if (detect_encoding(body, len) == TEXT) {
+            return Request::parseRequest(string(body, len));
+        }
+
+        check_binary_header(body, len, REQUEST_HEADER_SIZE);
+
+        uint16_t type = get_u16(body + 2);
+        uint32_t request_id = get_u32(body + 4);
+        int user_id = static_cast<int32_t>(get_u32(body + 8));
+        Money amount = get_i64(body + 12);
+        uint64_t offset = static_cast<uint64_t>(get_i64(body + 20));
+        uint32_t flags = get_u32(body + 28);
+        uint32_t filename_len = get_u32(body + 32);
+        uint32_t data_len = get_u32(body + 36);
+
+        if ((uint64_t)REQUEST_HEADER_SIZE + filename_len + data_len != len) {
+            throw runtime_error("binary request length mismatch!");
+        }
+        if (type >= NUM_REQUEST_TYPES) {
+            return Request(QUIT); // Same fallback as the text parser
+        }
+
+        const char* p = body + REQUEST_HEADER_SIZE;
+        Request req(static_cast<RequestType>(type), user_id, amount,
+                    string(p, filename_len), string(p + filename_len, data_len));
+        req.request_id = request_id;
+        req.offset = offset;
+        req.flags = flags;
+        return req;
+    }
+
+    Response decode_response(const char* body, size_t len) {
+        if (detect_encoding(body, len) == TEXT) {
+            // DATA may contain '|', MESSAGE never does: split the first two
+            // fields from the front and the message from the back
+            const char* end = body + len;
+            const char* first = static_cast<const char*>(memchr(body, '|', len));
+            const char* second = first ? static_cast<const char*>(memchr(first + 1, '|', end - first - 1)) : nullptr;
+            if (!second) {
+                throw runtime_error("malformed text response!");
+            }
+            const char* last = static_cast<const char*>(memrchr(second + 1, '|', end - second - 1));
+            if (!last) last = end;
+
+            string balance(first + 1, second);
+            string data(second + 1, last);
+            string message(last == end ? end : last + 1, end);
+            Money amount = 0;
+            if (!parse_money(balance, amount)) {
+                throw runtime_error("malformed text response balance!");
+            }
+            return Response(body[0] == '1', amount, data, message);
+        }
+
+        check_binary_header(body, len, RESPONSE_HEADER_SIZE);
+
+        bool success = body[2] != 0;
+        uint32_t request_id = get_u32(body + 4);
+        Money balance = get_i64(body + 8);
+        uint64_t offset = static_cast<uint64_t>(get_i64(body + 16));
+        uint32_t data_len = get_u32(body + 24);
+        uint32_t message_len = get_u32(body + 28);
+
+        if ((uint64_t)RESPONSE_HEADER_SIZE + data_len + message_len != len) {
+            throw runtime_error("binary response length mismatch!");
+        }
+
+        const char* p = body + RESPONSE_HEADER_SIZE;
+        Response resp(success, balance, string(p, data_len), string(p + data_len, message_len));
+        resp.request_id = request_id;
+        resp.offset = offset;
+        resp.flags = static_cast<uint8_t>(body[3]);
+        return resp;
+    }
+
+    string encode_batch(const vector<Request>& reqs) {
+        string out;
+        for (const Request& r : reqs) encode_request(r, BINARY, out);
+        return out;
+    }
+
+    vector<Request> decode_batch(const string& data) {
+        vector<Request> reqs;
+        for_each_frame(data, [&reqs](const char* body, size_t len) {
+            reqs.push_back(decode_request(body, len));
+        });
+        return reqs;
+    }
+
+    string encode_batch_responses(const vector<Response>& resps) {
+        string out;
+        for (const Response& r : resps) encode_response(r, BINARY, out);
+        return out;
+    }
+
+    vector<Response> decode_batch_responses(const string& data) {
+        vector<Response> resps;
+        for_each_frame(data, [&resps](const char* body, size_t len) {
+            resps.push_back(decode_response(body, len));
+        });
+        return resps;
+    }
+
+    Response execute_batch(const Request& batch, const function<Response(const Request&)>& handler) {
+        vector<Request> reqs = decode_batch(batch.data);
+        string out;
+        size_t failed = 0;
+
+        for (const Request& r : reqs) {
+            Response sub;
+            if (r.type == BATCH || r.type == QUIT) {
+                sub = Response(false, 0, "", "Request type not allowed in batch");
+            } else {
+                sub = handler(r);
+            }
+            sub.request_id = r.request_id;
+            if (!sub.success) failed++;
+            encode_response(sub, BINARY, out);
+        }
+
+        Response resp(failed == 0, 0, "", "Batch executed: " + to_string(reqs.size() - failed)
+                      + " succeeded, " + to_string(failed) + " failed");
+        resp.data.swap(out);
+        return resp;
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef _WIRE_H_
+#define _WIRE_H_
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Wire encoding for requests and responses
+ *
+ * Every message on a connection is a 4-byte length prefix (network byte
+ * order) followed by a body. Two body encodings are understood:
+ *
+ * TEXT (legacy):   TYPE|USER_ID|AMOUNT|FILENAME|DATA
+ *                  SUCCESS|BALANCE|DATA|MESSAGE
+ *
+ * BINARY:          fixed-size header followed by the variable-length fields
+ *
+ *   Request header (40 bytes)          Response header (32 bytes)
+ *     uint8   magic (0xBA)               uint8   magic (0xBA)
+ *     uint8   version                    uint8   version
+ *     uint16  type                       uint8   success
+ *     uint32  request_id                 uint8   flags
+ *     int32   user_id                    uint32  request_id
+ *     int64   amount (Money)             int64   balance (Money)
+ *     uint64  offset                     uint64  offset
+ *     uint32  flags                      uint32  data length
+ *     uint32  filename length            uint32  message length
+ *     uint32  data length
+ *   followed by filename, data           followed by data, message
+ *
+ * All integers are big-endian; amounts are Money micro-units (common.h),
+ * and the text encoding writes them as exact decimals. A text body always starts with an ASCII
+ * digit, so the magic byte is enough to tell the encodings apart. Servers
+ * answer in whatever encoding the client last used, which lets old text
+ * clients keep working against new servers.
+ *
+ * request_id is echoed back so a client can keep several requests in
+ * flight on one connection. Text messages carry no ID; responses to them
+ * are matched by order, which servers always preserve.
+ *
+ * A BATCH request carries a sequence of complete binary request frames in
+ * its data field, and its response carries the matching response frames.
+ *
+ * Files of any size move as a stream of UPLOAD_CHUNK / DOWNLOAD_CHUNK
+ * frames of at most FILE_CHUNK_SIZE bytes, positioned by the 64-bit offset
+ * field, so neither side holds more than a few chunks in memory. The text
+ * encoding has no offset or flags and only supports whole-file transfers.
+ */
+namespace Wire {
+    enum Encoding { TEXT, BINARY };
+
+    const uint8_t MAGIC = 0xBA;
+    const uint8_t VERSION = 5;
+
+    const size_t LENGTH_PREFIX_SIZE = 4;
+    const size_t REQUEST_HEADER_SIZE = 40;
+    const size_t RESPONSE_HEADER_SIZE = 32;
+
+    // Payload of one chunked file transfer frame
+    const size_t FILE_CHUNK_SIZE = 1 << 20;
+
+    // Returns the encoding of a message body
+    Encoding detect_encoding(const char* body, size_t len);
+
+    // Append a complete frame (length prefix + body) to out
+    void encode_request(const Request& req, Encoding enc, std::string& out);
+    void encode_request(const Request& req, uint32_t request_id, Encoding enc, std::string& out);
+    void encode_response(const Response& resp, Encoding enc, std::string& out);
+
+    // Like encode_request, but leaves req.data out of the buffer: the frame
+    // is complete once req.data is sent right after out (data comes last in
+    // both encodings). Lets large uploads be written without a copy.
+    size_t encode_request_streamed(const Request& req, uint32_t request_id, Encoding enc, std::string& out);
+
+    // Like encode_response, but leaves file bodies out of the buffer: the
+    // frame is complete once resp.file_bodies are sent, in order, at the
+    // returned position of out. encode_response copies the files in instead.
+    size_t encode_response_streamed(const Response& resp, Encoding enc, std::string& out);
+
+    // Decode a message body (without the length prefix). Throws
+    // runtime_error on malformed binary bodies.
+    Request decode_request(const char* body, size_t len);
+    Response decode_response(const char* body, size_t len);
+
+    // BATCH payload helpers. Sub-messages are always binary frames.
+    std::string encode_batch(const std::vector<Request>& reqs);
+    std::vector<Request> decode_batch(const std::string& data);
+    std::string encode_batch_responses(const std::vector<Response>& resps);
+    std::vector<Response> decode_batch_responses(const std::string& data);
+
+    // Runs every sub-request of a BATCH through handler and packs the
+    // replies into one response. Nested batches are rejected.
+    Response execute_batch(const Request& batch,
+                           const std::function<Response(const Request&)>& handler);
+}
+
+#endif